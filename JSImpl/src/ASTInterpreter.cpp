@@ -2,6 +2,7 @@
 #include "Expression.h"
 #include <iostream>
 #include <math.h>
+#include <stdexcept>
 
 #undef NOT_IMPLEMENTED
 #define NOT_IMPLEMENTED (void)e; assert(0 && "not-implemented")
@@ -569,6 +570,12 @@ void ASTInterpreter::Visit(EmptyExpression* e) {
 
 void ASTInterpreter::Visit(Call* e)
 {
+    // the arguments of a call are its member, the interpreter has no
+    // functions to call
+    if (dynamic_cast<ListExpression*>(e->GetMember().get()))
+    {
+        throw std::runtime_error("unsupported operation");
+    }
     e->GetObjectOrCall()->Accept(*this);
     if (e->GetMember())
     {
@@ -1,14 +1,21 @@
 #include "ByteCodeGenerator.h"
+#include "CaptureAnalysis.h"
 #include "ExpressionVisitor.h"
 #include <algorithm>
 #include <sstream>
+#include <stdexcept>
 #include <iterator>
 
 class ByteCodeGenerator : public ExpressionVisitor
 {
 public:
 
-	ByteCodeGenerator(const ByteCodeGeneratorOptions& o, const IPLVector<IPLString>& source) : m_Source(source), m_Options(o) {};
+	ByteCodeGenerator(const ByteCodeGeneratorOptions& o, const IPLVector<IPLString>& source, ProgramScopes scopes)
+		: m_Functions(1, Function{ IPLVector<IPLString>(), nullptr })
+		, m_Scopes(std::move(scopes))
+		, m_Source(source)
+		, m_Options(o)
+	{};
 	~ByteCodeGenerator() {};
 
 	virtual void Visit(FunctionDeclaration* e) override;
@@ -51,6 +58,7 @@ private:
 			PRINT,
 			READ,
 			CALL,
+			TAILCALL,
 			RET,
 			JMP,
 			JMPT,
@@ -71,6 +79,8 @@ private:
 			SETG,
 			GETUP,
 			SETUP,
+			CLOSURE,
+			CELLS,
 			GET,
 			SET,
 			INC,
@@ -89,6 +99,8 @@ private:
 		};
 
 		Type Descriptor;
+		// the function of the registers in Args
+		unsigned Function;
 		IPLString Args[3];
 		union
 		{
@@ -113,8 +125,32 @@ private:
 	void CloseContinueScope(size_t addr);
 	void PushBreak();
 	void PushContinue();
+
+	// Where a variable lives if it is not in a register of the function
+	struct Slot
+	{
+		Instruction::Type Load;
+		Instruction::Type Store;
+		unsigned Index;
+	};
+	bool FindSlot(const IPLString& name, Slot& slot) const;
+	bool TargetSlot(Expression* target, Slot& slot) const;
+	bool StoreToSlot(Expression* target, const IPLString& value);
+	void CreateCells();
+	void Invoke(ListExpression* args, bool tail);
+	IPLString ResolveRegisterList(const IPLString& names);
 private:
-	IPLVector<IPLString> m_RegisterTable;
+	// The registers and the cells of the code of a function, the program is the first
+	struct Function
+	{
+		IPLVector<IPLString> Registers;
+		const FunctionScope* Scope;
+	};
+	IPLVector<Function> m_Functions;
+	unsigned m_Function = 0;
+	IPLVector<IPLString>& RegisterTable() { return m_Functions[m_Function].Registers; }
+
+	ProgramScopes m_Scopes;
 	IPLVector<Instruction> m_Code;
 	IPLVector<IPLString> m_Source;
 
@@ -167,6 +203,7 @@ size_t ByteCodeGenerator::PushInstruction(Instruction::Type opcode, const IPLStr
 	assert(CheckOpCode(opcode));
 	Instruction ins;
 	ins.Descriptor = opcode;
+	ins.Function = m_Function;
 	ins.Args[0] = arg0;
 	ins.Args[1] = arg1;
 	ins.Args[2] = arg2;
@@ -179,6 +216,7 @@ size_t ByteCodeGenerator::PushInstruction(Instruction::Type opcode, size_t Addre
 	assert(CheckOpCode(opcode));
 	Instruction ins;
 	ins.Descriptor = opcode;
+	ins.Function = m_Function;
 	ins.Values.Address[0] = Address;
 	m_Code.push_back(ins);
 	return m_Code.size() - 1;;
@@ -189,6 +227,7 @@ size_t ByteCodeGenerator::PushInstruction(Instruction::Type opcode, int Int)
 	assert(CheckOpCode(opcode));
 	Instruction ins;
 	ins.Descriptor = opcode;
+	ins.Function = m_Function;
 	ins.Values.Int[0] = Int;
 	m_Code.push_back(ins);
 	return m_Code.size() - 1;;
@@ -199,6 +238,7 @@ size_t ByteCodeGenerator::PushInstruction(Instruction::Type opcode, const IPLStr
 	assert(CheckOpCode(opcode));
 	Instruction ins;
 	ins.Descriptor = opcode;
+	ins.Function = m_Function;
 	ins.Args[0] = arg0;
 	ins.Values.Address[0] = Address;
 	m_Code.push_back(ins);
@@ -210,6 +250,7 @@ size_t ByteCodeGenerator::PushInstruction(Instruction::Type opcode, const IPLStr
 	assert(CheckOpCode(opcode));
 	Instruction ins;
 	ins.Descriptor = opcode;
+	ins.Function = m_Function;
 	ins.Args[0] = arg0;
 	ins.Values.Double[0] = value;
 	m_Code.push_back(ins);
@@ -227,8 +268,8 @@ void ByteCodeGenerator::PushConst(double c)
 IPLString ByteCodeGenerator::CreateRegister()
 {
 	IPLString regName = IPLString("tmp");
-	regName += std::to_string(m_RegisterTable.size());
-	m_RegisterTable.push_back(regName);
+	regName += std::to_string(RegisterTable().size());
+	RegisterTable().push_back(regName);
 	return regName;
 }
 
@@ -240,14 +281,126 @@ void ByteCodeGenerator::AddDebugInformation(Expression* e)
 	}
 	Instruction ins;
 	ins.Descriptor = Instruction::Type::DEBUG;
+	ins.Function = m_Function;
 	ins.Values.Int[0] = e->GetLine();
 	ins.Values.Int[1] = e->GetColumn();
 	m_Code.push_back(ins);
 }
 
+// Finds the cell or the global slot of name, the other variables are registers
+bool ByteCodeGenerator::FindSlot(const IPLString& name, Slot& slot) const
+{
+	auto scope = m_Functions[m_Function].Scope;
+	auto cell = scope ? scope->CellIndex(name) : FunctionScope::NotACell;
+	if (cell != FunctionScope::NotACell)
+	{
+		slot = Slot{ Instruction::Type::GETUP, Instruction::Type::SETUP, cell };
+		return true;
+	}
+	if (scope && std::find(scope->Locals.begin(), scope->Locals.end(), name) != scope->Locals.end())
+	{
+		return false;
+	}
+	auto global = m_Scopes.GlobalSlot(name);
+	if (global != ProgramScopes::NotAGlobal)
+	{
+		slot = Slot{ Instruction::Type::GETG, Instruction::Type::SETG, global };
+		return true;
+	}
+	return false;
+}
+
+// The slot of the variable assigned by target, if it lives in one
+bool ByteCodeGenerator::TargetSlot(Expression* target, Slot& slot) const
+{
+	// a variable on the left side is parsed as a call without a member
+	auto call = dynamic_cast<Call*>(target);
+	if (call && !call->GetMember())
+	{
+		return TargetSlot(call->GetObjectOrCall().get(), slot);
+	}
+	auto identifier = dynamic_cast<IdentifierExpression*>(target);
+	return identifier && FindSlot(identifier->GetName(), slot);
+}
+
+bool ByteCodeGenerator::StoreToSlot(Expression* target, const IPLString& value)
+{
+	Slot slot;
+	if (!TargetSlot(target, slot))
+	{
+		return false;
+	}
+	PushInstruction(slot.Store, value, size_t(slot.Index));
+	return true;
+}
+
+// Makes the cells for the captured variables of the current function on each
+// call, the captured arguments are moved to theirs
+void ByteCodeGenerator::CreateCells()
+{
+	auto scope = m_Functions[m_Function].Scope;
+	if (!scope || scope->Captured.empty())
+	{
+		return;
+	}
+	PushInstruction(Instruction::Type::CELLS, (int)scope->Captured.size());
+	for (const auto& name : scope->Captured)
+	{
+		auto& registers = RegisterTable();
+		if (std::find(registers.begin(), registers.end(), name) != registers.end())
+		{
+			PushInstruction(Instruction::Type::SETUP, name, size_t(scope->CellIndex(name)));
+		}
+	}
+}
+
 void ByteCodeGenerator::Visit(FunctionDeclaration* e)
 {
+	AddDebugInformation(e);
+	auto scope = m_Scopes.Functions.find(e);
+	assert(scope != m_Scopes.Functions.end());
+
+	// the closure copies the cells of its upvalues from the cells of this function
+	IPLString captures;
+	for (const auto& name : scope->second.Upvalues)
+	{
+		// the capture analysis gives this function a cell for each upvalue
+		// of its closures
+		Slot cell;
+		if (!FindSlot(name, cell) || cell.Load != Instruction::Type::GETUP)
+		{
+			throw std::logic_error("no cell for the upvalue " + name);
+		}
+		captures += ' ' + std::to_string(cell.Index);
+	}
+	auto closureReg = CreateRegister();
+	auto closureAddress = PushInstruction(Instruction::Type::CLOSURE, closureReg, captures);
+	auto skipAddress = PushInstruction(Instruction::Type::JMP, (size_t)0);
+	m_Code[closureAddress].Values.Address[0] = m_Code.size();
+
+	auto parent = m_Function;
+	m_Functions.push_back(Function{ e->GetArgumentsIdentifiers(), &scope->second });
+	m_Function = unsigned(m_Functions.size() - 1);
 	e->GetBody()->Accept(*this);
+	PushInstruction(Instruction::Type::RET);
+	m_Function = parent;
+	m_Code[skipAddress].Values.Address[0] = m_Code.size();
+
+	if (e->GetName().empty())
+	{
+		m_RegisterStack.push(closureReg);
+		return;
+	}
+	IdentifierExpression name(e->GetName());
+	if (!StoreToSlot(&name, closureReg))
+	{
+		auto& registers = RegisterTable();
+		if (std::find(registers.begin(), registers.end(), e->GetName()) == registers.end())
+		{
+			registers.push_back(e->GetName());
+		}
+		PushInstruction(Instruction::Type::MOV, e->GetName(), closureReg);
+	}
 }
 
 void ByteCodeGenerator::Visit(ListExpression* e)
@@ -273,28 +426,42 @@ void ByteCodeGenerator::Visit(TopStatements* e)
 	auto& statements = e->GetValues();
 
 	auto startAddress = PushInstruction(Instruction::Type::PUSH, (int)0);
+	CreateCells();
 	for (auto& s : statements)
 	{
 		s->Accept(*this);
 	}
-	m_Code[startAddress].Values.Int[0] = (int)m_RegisterTable.size();
+	m_Code[startAddress].Values.Int[0] = (int)RegisterTable().size();
 
-	PushInstruction(Instruction::Type::POP, (int)m_RegisterTable.size());
+	PushInstruction(Instruction::Type::POP, (int)RegisterTable().size());
 }
 
 void ByteCodeGenerator::Visit(VariableDefinitionExpression* e)
 {
-	auto it = std::find_if(m_RegisterTable.begin(), m_RegisterTable.end(), [&](IPLString& current) {
+	Slot slot;
+	if (FindSlot(e->GetName(), slot))
+	{
+		if (e->GetValue())
+		{
+			e->GetValue()->Accept(*this);
+			AddDebugInformation(e);
+			PushInstruction(slot.Store, m_RegisterStack.top(), size_t(slot.Index));
+			m_RegisterStack.pop();
+		}
+		return;
+	}
+
+	auto it = std::find_if(RegisterTable().begin(), RegisterTable().end(), [&](IPLString& current) {
 		return e->GetName() == current;
 	});
 
 
-	if (it != m_RegisterTable.end())
+	if (it != RegisterTable().end())
 	{
 		// TODO: error double definitions
 		return;
 	}
-	m_RegisterTable.push_back(e->GetName());
+	RegisterTable().push_back(e->GetName());
 	if (e->GetValue())
 	{
 		e->GetValue()->Accept(*this);
@@ -311,6 +478,14 @@ void ByteCodeGenerator::Visit(BinaryExpression* e)
 {
 	e->GetRight()->Accept(*this);
 	auto r = m_RegisterStack.top();
+	Slot slot;
+	if (e->GetOperator() == TokenType::Equal && TargetSlot(e->GetLeft().get(), slot))
+	{
+		AddDebugInformation(e);
+		StoreToSlot(e->GetLeft().get(), r);
+		m_RegisterStack.push(r);
+		return;
+	}
 	e->GetLeft()->Accept(*this);
 	auto l = m_RegisterStack.top();
 
@@ -446,7 +621,15 @@ void ByteCodeGenerator::Visit(Continue*)
 
 void ByteCodeGenerator::Visit(IdentifierExpression* e)
 {
-	m_RegisterStack.push(e->GetName());
+	Slot slot;
+	if (!FindSlot(e->GetName(), slot))
+	{
+		m_RegisterStack.push(e->GetName());
+		return;
+	}
+	auto reg = CreateRegister();
+	PushInstruction(slot.Load, reg, size_t(slot.Index));
+	m_RegisterStack.push(reg);
 }
 
 void ByteCodeGenerator::Visit(LiteralNumber* e)
@@ -461,6 +644,27 @@ void ByteCodeGenerator::Visit(LiteralNumber* e)
 void ByteCodeGenerator::Visit(UnaryExpression* e)
 {
 	AddDebugInformation(e);
+	if (e->GetOperator() == TokenType::Return)
+	{
+		auto call = dynamic_cast<Call*>(e->GetExpr().get());
+		auto args = call ? dynamic_cast<ListExpression*>(call->GetMember().get()) : nullptr;
+		if (args && m_Function != 0)
+		{
+			call->GetObjectOrCall()->Accept(*this);
+			Invoke(args, true);
+		}
+		else if (e->GetExpr())
+		{
+			e->GetExpr()->Accept(*this);
+			PushInstruction(Instruction::Type::RET, m_RegisterStack.top());
+			m_RegisterStack.pop();
+		}
+		else
+		{
+			PushInstruction(Instruction::Type::RET);
+		}
+		return;
+	}
 	e->GetExpr()->Accept(*this);
 	auto reg = m_RegisterStack.top();
 	m_RegisterStack.pop();
@@ -477,6 +681,7 @@ void ByteCodeGenerator::Visit(UnaryExpression* e)
 				PushInstruction(Instruction::Type::MOV, o, reg);
 				m_RegisterStack.push(o);
 				PushInstruction(Instruction::Type::ADD, reg, reg, one);
+				StoreToSlot(e->GetExpr().get(), reg);
 			}
 			return;
 		case TokenType::MinusMinus:
@@ -488,6 +693,7 @@ void ByteCodeGenerator::Visit(UnaryExpression* e)
 				PushInstruction(Instruction::Type::MOV, o, reg);
 				m_RegisterStack.push(o);
 				PushInstruction(Instruction::Type::SUB, reg, reg, one);
+				StoreToSlot(e->GetExpr().get(), reg);
 			}
 			return;
 		default:
@@ -510,6 +716,7 @@ void ByteCodeGenerator::Visit(UnaryExpression* e)
 					m_RegisterStack.pop();
 					m_RegisterStack.push(reg);
 					PushInstruction(Instruction::Type::ADD, reg, reg, one);
+					StoreToSlot(e->GetExpr().get(), reg);
 				}
 				return;
 			case TokenType::MinusMinus:
@@ -519,6 +726,7 @@ void ByteCodeGenerator::Visit(UnaryExpression* e)
 					m_RegisterStack.pop();
 					m_RegisterStack.push(reg);
 					PushInstruction(Instruction::Type::SUB, reg, reg, one);
+					StoreToSlot(e->GetExpr().get(), reg);
 				}
 				return;
 			case TokenType::Void:
@@ -581,9 +789,38 @@ void ByteCodeGenerator::Visit(LiteralString* e)
 	m_RegisterStack.push(stringReg);
 }
 
+// Calls the closure on the top of the register stack. A call in tail position
+// replaces the current function with the callee, which returns to the caller
+// of the current function, so the stack does not grow with the recursion.
+void ByteCodeGenerator::Invoke(ListExpression* args, bool tail)
+{
+	auto function = m_RegisterStack.top();
+	m_RegisterStack.pop();
+	IPLString registers;
+	for (auto& arg : args->GetValues())
+	{
+		arg->Accept(*this);
+		registers += ' ' + m_RegisterStack.top();
+		m_RegisterStack.pop();
+	}
+	if (tail)
+	{
+		PushInstruction(Instruction::Type::TAILCALL, function, registers);
+		return;
+	}
+	auto resultReg = CreateRegister();
+	PushInstruction(Instruction::Type::CALL, resultReg, function, registers);
+	m_RegisterStack.push(resultReg);
+}
+
 void ByteCodeGenerator::Visit(Call* e)
 {
 	e->GetObjectOrCall()->Accept(*this);
+	if (auto args = dynamic_cast<ListExpression*>(e->GetMember().get()))
+	{
+		Invoke(args, false);
+		return;
+	}
 	if (e->GetMember())
 	{
 		e->GetMember()->Accept(*this);
@@ -606,10 +843,23 @@ void ByteCodeGenerator::Visit(MemberAccess* e)
 
 unsigned ByteCodeGenerator::ResolveRegisterName(IPLString& name)
 {
-	auto it = std::find_if(m_RegisterTable.begin(), m_RegisterTable.end(), [&](IPLString& current) {
+	auto it = std::find_if(RegisterTable().begin(), RegisterTable().end(), [&](IPLString& current) {
 		return name == current;
 	});
-	return unsigned(it - m_RegisterTable.begin());
+	return unsigned(it - RegisterTable().begin());
+}
+
+// Resolves the registers in a list of names, each preceded by a space
+IPLString ByteCodeGenerator::ResolveRegisterList(const IPLString& names)
+{
+	IPLString result;
+	std::istringstream list(names);
+	IPLString name;
+	while (list >> name)
+	{
+		result += " r" + std::to_string(ResolveRegisterName(name));
+	}
+	return result;
 }
 
 IPLString ByteCodeGenerator::GetCode()
@@ -618,6 +868,8 @@ IPLString ByteCodeGenerator::GetCode()
 	auto programCounter = 0;
 	for (auto& i : m_Code)
 	{
+		// the registers of the instruction are those of its function
+		m_Function = i.Function;
 		if (i.Descriptor != ByteCodeGenerator::Instruction::DEBUG)
 		{
 			result += std::to_string(programCounter) + ": ";
@@ -661,12 +913,23 @@ IPLString ByteCodeGenerator::GetCode()
 			NOT_IMPLEMENTED;
 			break;
 		case ByteCodeGenerator::Instruction::CALL:
-			result += "call";
-			NOT_IMPLEMENTED;
+			result += "call r" + std::to_string(ResolveRegisterName(i.Args[0]))
+				+ " r" + std::to_string(ResolveRegisterName(i.Args[1]))
+				+ ResolveRegisterList(i.Args[2]) + '\n';
+			break;
+		case ByteCodeGenerator::Instruction::TAILCALL:
+			result += "tcall r" + std::to_string(ResolveRegisterName(i.Args[0]))
+				+ ResolveRegisterList(i.Args[1]) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::RET:
-			result += "ret";
-			NOT_IMPLEMENTED;
+			if (i.Args[0].empty())
+			{
+				result += "ret\n";
+			}
+			else
+			{
+				result += "ret r" + std::to_string(ResolveRegisterName(i.Args[0])) + '\n';
+			}
 			break;
 		case ByteCodeGenerator::Instruction::JMP:
 			result += "jmp " + std::to_string(i.Values.Address[0]) + '\n';
@@ -733,20 +996,27 @@ IPLString ByteCodeGenerator::GetCode()
 				+ " r" + std::to_string(ResolveRegisterName(i.Args[2])) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::GETG:
-			result += "getg";
-			NOT_IMPLEMENTED;
+			result += "getg r" + std::to_string(ResolveRegisterName(i.Args[0]))
+				+ " " + std::to_string(i.Values.Address[0]) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::SETG:
-			result += "setg";
-			NOT_IMPLEMENTED;
+			result += "setg " + std::to_string(i.Values.Address[0])
+				+ " r" + std::to_string(ResolveRegisterName(i.Args[0])) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::GETUP:
-			result += "getup";
-			NOT_IMPLEMENTED;
+			result += "getup r" + std::to_string(ResolveRegisterName(i.Args[0]))
+				+ " " + std::to_string(i.Values.Address[0]) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::SETUP:
-			result += "setup";
-			NOT_IMPLEMENTED;
+			result += "setup " + std::to_string(i.Values.Address[0])
+				+ " r" + std::to_string(ResolveRegisterName(i.Args[0])) + '\n';
+			break;
+		case ByteCodeGenerator::Instruction::CLOSURE:
+			result += "closure r" + std::to_string(ResolveRegisterName(i.Args[0]))
+				+ " " + std::to_string(i.Values.Address[0]) + i.Args[1] + '\n';
+			break;
+		case ByteCodeGenerator::Instruction::CELLS:
+			result += "cells " + std::to_string(i.Values.Int[0]) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::GET:
 			result += "get r" + std::to_string(ResolveRegisterName(i.Args[0]))
@@ -787,12 +1057,10 @@ IPLString ByteCodeGenerator::GetCode()
 			NOT_IMPLEMENTED;
 			break;
 		case ByteCodeGenerator::Instruction::THROW:
-			result += "throw";
-			NOT_IMPLEMENTED;
+			result += "throw r" + std::to_string(ResolveRegisterName(i.Args[0])) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::CATCH:
-			result += "catch";
-			NOT_IMPLEMENTED;
+			result += "catch r" + std::to_string(ResolveRegisterName(i.Args[0])) + '\n';
 			break;
 		case ByteCodeGenerator::Instruction::CONST:
 			result += "const r" + std::to_string(ResolveRegisterName(i.Args[0])) + " " + std::to_string(i.Values.Double[0]) + '\n';
@@ -819,6 +1087,11 @@ IPLString ByteCodeGenerator::GetCode()
 	}
 	result += std::to_string(programCounter) + ": ";
 	result += "halt\n";
+	// the names of the global slots, for the embedder and for debugging
+	for (size_t slot = 0; slot < m_Scopes.Globals.size(); ++slot)
+	{
+		result += "global " + std::to_string(slot) + " " + m_Scopes.Globals[slot] + '\n';
+	}
 	return result;
 }
 
@@ -833,7 +1106,7 @@ IPLString GenerateByteCode(ExpressionPtr program, const IPLString& source, const
 		std::getline(sourceStream, currentLine);
 		sourceByLines.push_back(currentLine);
 	}
-	ByteCodeGenerator generator(options, sourceByLines);
+	ByteCodeGenerator generator(options, sourceByLines, AnalyzeCaptures(program.get()));
 	program->Accept(generator);
 
 	return generator.GetCode();
@@ -0,0 +1,228 @@
+#include "CaptureAnalysis.h"
+
+#include <algorithm>
+
+const unsigned FunctionScope::NotACell;
+
+unsigned FunctionScope::CellIndex(const IPLString& name) const
+{
+	auto upvalue = std::find(Upvalues.begin(), Upvalues.end(), name);
+	if (upvalue != Upvalues.end())
+	{
+		return unsigned(upvalue - Upvalues.begin());
+	}
+	auto captured = std::find(Captured.begin(), Captured.end(), name);
+	if (captured != Captured.end())
+	{
+		return unsigned(Upvalues.size() + (captured - Captured.begin()));
+	}
+	return NotACell;
+}
+
+const unsigned ProgramScopes::NotAGlobal;
+
+unsigned ProgramScopes::GlobalSlot(const IPLString& name) const
+{
+	auto global = std::find(Globals.begin(), Globals.end(), name);
+	return global != Globals.end() ? unsigned(global - Globals.begin()) : NotAGlobal;
+}
+
+namespace
+{
+// Visits all expressions of a tree
+class ExpressionWalker : public ExpressionVisitor
+{
+public:
+	virtual void Visit(LiteralNull*) override {}
+	virtual void Visit(LiteralUndefined*) override {}
+	virtual void Visit(LiteralString*) override {}
+	virtual void Visit(LiteralNumber*) override {}
+	virtual void Visit(LiteralBoolean*) override {}
+	// the identifier of a field is a name, not a variable
+	virtual void Visit(LiteralField* e) override { Walk(e->GetValue()); }
+	virtual void Visit(LiteralObject* e) override { Walk(e->GetValues()); }
+	virtual void Visit(BinaryExpression* e) override
+	{
+		Walk(e->GetLeft());
+		Walk(e->GetRight());
+	}
+	virtual void Visit(UnaryExpression* e) override { Walk(e->GetExpr()); }
+	virtual void Visit(IdentifierExpression*) override {}
+	virtual void Visit(ListExpression* e) override { Walk(e->GetValues()); }
+	virtual void Visit(VariableDefinitionExpression* e) override { Walk(e->GetValue()); }
+	virtual void Visit(BlockStatement* e) override { Walk(e->GetValues()); }
+	virtual void Visit(LabeledStatement* e) override { Walk(e->GetStatement()); }
+	virtual void Visit(IfStatement* e) override
+	{
+		Walk(e->GetCondition());
+		Walk(e->GetIfStatement());
+		Walk(e->GetElseStatement());
+	}
+	virtual void Visit(SwitchStatement* e) override
+	{
+		Walk(e->GetCondition());
+		Walk(e->GetCases());
+		Walk(e->GetDefaultCase());
+	}
+	virtual void Visit(CaseStatement* e) override
+	{
+		Walk(e->GetCondition());
+		Walk(e->GetBody());
+	}
+	virtual void Visit(WhileStatement* e) override
+	{
+		Walk(e->GetCondition());
+		Walk(e->GetBody());
+	}
+	virtual void Visit(ForStatement* e) override
+	{
+		Walk(e->GetInitialization());
+		Walk(e->GetCondition());
+		Walk(e->GetIteration());
+		Walk(e->GetBody());
+	}
+	virtual void Visit(Break*) override {}
+	virtual void Visit(Continue*) override {}
+	virtual void Visit(FunctionDeclaration* e) override { Walk(e->GetBody()); }
+	virtual void Visit(TopStatements* e) override { Walk(e->GetValues()); }
+	virtual void Visit(EmptyExpression*) override {}
+	virtual void Visit(Call* e) override
+	{
+		Walk(e->GetObjectOrCall());
+		Walk(e->GetMember());
+	}
+	virtual void Visit(MemberAccess*) override {}
+
+protected:
+	void Walk(const ExpressionPtr& e)
+	{
+		if (e)
+		{
+			e->Accept(*this);
+		}
+	}
+
+	void Walk(const IPLVector<ExpressionPtr>& expressions)
+	{
+		for (const auto& e : expressions)
+		{
+			Walk(e);
+		}
+	}
+};
+
+// Collects the names declared by a function, without its nested functions
+class Declarations : public ExpressionWalker
+{
+public:
+	using ExpressionWalker::Visit;
+
+	virtual void Visit(VariableDefinitionExpression* e) override
+	{
+		Names.push_back(e->GetName());
+		ExpressionWalker::Visit(e);
+	}
+
+	virtual void Visit(FunctionDeclaration* e) override
+	{
+		if (!e->GetName().empty())
+		{
+			Names.push_back(e->GetName());
+		}
+	}
+
+	IPLVector<IPLString> Names;
+};
+
+class CaptureAnalysis : public ExpressionWalker
+{
+public:
+	using ExpressionWalker::Visit;
+
+	CaptureAnalysis()
+	{
+		// the variables of the program are registers or globals
+		m_Scopes.push_back(Scope{ nullptr, IPLVector<IPLString>() });
+	}
+
+	virtual void Visit(IdentifierExpression* e) override
+	{
+		Resolve(e->GetName());
+	}
+
+	virtual void Visit(FunctionDeclaration* e) override
+	{
+		Declarations declarations;
+		declarations.Names = e->GetArgumentsIdentifiers();
+		if (e->GetBody())
+		{
+			e->GetBody()->Accept(declarations);
+		}
+		m_Result.Functions[e].Locals = declarations.Names;
+		m_Scopes.push_back(Scope{ e, declarations.Names });
+		Walk(e->GetBody());
+		m_Scopes.pop_back();
+	}
+
+	ProgramScopes& Result() { return m_Result; }
+
+private:
+	struct Scope
+	{
+		const FunctionDeclaration* Function;
+		IPLVector<IPLString> Names;
+
+		bool Declares(const IPLString& name) const
+		{
+			return std::find(Names.begin(), Names.end(), name) != Names.end();
+		}
+	};
+
+	static void AddOnce(IPLVector<IPLString>& names, const IPLString& name)
+	{
+		if (std::find(names.begin(), names.end(), name) == names.end())
+		{
+			names.push_back(name);
+		}
+	}
+
+	// A name declared by an enclosing function is captured by it and each
+	// function in between gets an upvalue for it. Any other name used by a
+	// function is a global.
+	void Resolve(const IPLString& name)
+	{
+		const auto current = m_Scopes.size() - 1;
+		for (auto declaring = current; declaring > 0; --declaring)
+		{
+			if (!m_Scopes[declaring].Declares(name))
+			{
+				continue;
+			}
+			if (declaring == current)
+			{
+				return;
+			}
+			AddOnce(m_Result.Functions[m_Scopes[declaring].Function].Captured, name);
+			for (auto i = declaring + 1; i <= current; ++i)
+			{
+				AddOnce(m_Result.Functions[m_Scopes[i].Function].Upvalues, name);
+			}
+			return;
+		}
+		if (current > 0)
+		{
+			AddOnce(m_Result.Globals, name);
+		}
+	}
+
+	IPLVector<Scope> m_Scopes;
+	ProgramScopes m_Result;
+};
+}
+
+ProgramScopes AnalyzeCaptures(Expression* program)
+{
+	CaptureAnalysis analysis;
+	program->Accept(analysis);
+	return std::move(analysis.Result());
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Expression.h"
+
+//! The variables of a function that live in heap cells
+/*
+	A closure is flat - it keeps the cells of all variables it uses from the
+	enclosing functions in one array, so each access is one indexed load. The
+	array starts with the upvalues, followed by the cells of the variables
+	of the function captured by the nested functions, made on each call.
+	All other variables stay in registers.
+*/
+struct FunctionScope
+{
+	//! The arguments and the variables declared by the function
+	IPLVector<IPLString> Locals;
+	IPLVector<IPLString> Upvalues;
+	IPLVector<IPLString> Captured;
+
+	static const unsigned NotACell = unsigned(-1);
+	unsigned CellIndex(const IPLString& name) const;
+};
+
+typedef IPLUnorderedMap<const FunctionDeclaration*, FunctionScope> FunctionScopes;
+
+struct ProgramScopes
+{
+	FunctionScopes Functions;
+
+	//! The global slots, in slot order
+	/*
+		The variables of the program used by its functions and the names
+		that no function declares. The other variables of the program stay
+		in its registers.
+	*/
+	IPLVector<IPLString> Globals;
+
+	static const unsigned NotAGlobal = unsigned(-1);
+	unsigned GlobalSlot(const IPLString& name) const;
+};
+
+//! Finds the variables that the functions of program capture
+/*
+	Every function gets a scope. The variables of the program itself are
+	globals, they are never captured.
+*/
+ProgramScopes AnalyzeCaptures(Expression* program);
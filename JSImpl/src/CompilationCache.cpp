@@ -0,0 +1,355 @@
+#include "CompilationCache.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+const unsigned CompilationCache::CompilerVersion = 1;
+
+namespace
+{
+const char EntryMagic[4] = { 'I', 'P', 'L', 'C' };
+const char* EntryExtension = ".iplc";
+const char* TemporaryExtension = ".tmp";
+//! A temporary entry this old was left by a writer that did not finish
+const auto StaleTemporary = std::chrono::minutes(10);
+
+//! The key and the source are checked on load, so an entry of another
+//! source with the same key is not used unless the source hash collides too
+struct EntryHeader
+{
+	char Magic[4];
+	uint32_t Padding;
+	uint64_t CodeSize;
+	char Key[32];
+	uint64_t SourceSize;
+	uint64_t SourceHash;
+};
+
+//! An entry mapped for reading, unmapped with the last Program using it
+class MappedEntry
+{
+public:
+	explicit MappedEntry(const IPLString& path)
+	{
+#if defined(_WIN32)
+		m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_File == INVALID_HANDLE_VALUE)
+		{
+			m_File = nullptr;
+			return;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_File, &size) || !size.QuadPart)
+		{
+			return;
+		}
+		m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_Mapping)
+		{
+			return;
+		}
+		m_Data = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+		m_Size = m_Data ? size_t(size.QuadPart) : 0;
+#else
+		const auto file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return;
+		}
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			const auto data = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (data != MAP_FAILED)
+			{
+				m_Data = static_cast<const char*>(data);
+				m_Size = size_t(status.st_size);
+			}
+		}
+		// the mapping stays valid after the file is closed
+		close(file);
+#endif
+	}
+
+	~MappedEntry()
+	{
+#if defined(_WIN32)
+		if (m_Data)
+		{
+			UnmapViewOfFile(m_Data);
+		}
+		if (m_Mapping)
+		{
+			CloseHandle(m_Mapping);
+		}
+		if (m_File)
+		{
+			CloseHandle(m_File);
+		}
+#else
+		if (m_Data)
+		{
+			munmap(const_cast<char*>(m_Data), m_Size);
+		}
+#endif
+	}
+
+	MappedEntry(const MappedEntry&) = delete;
+	MappedEntry& operator=(const MappedEntry&) = delete;
+
+	const char* Data() const { return m_Data; }
+	size_t Size() const { return m_Size; }
+
+private:
+	const char* m_Data = nullptr;
+	size_t m_Size = 0;
+#if defined(_WIN32)
+	HANDLE m_File = nullptr;
+	HANDLE m_Mapping = nullptr;
+#endif
+};
+
+//! FNV-1a, two of them with different offsets make the 128 bit key
+struct Hash
+{
+	explicit Hash(uint64_t offset) : Value(offset) {}
+
+	void Add(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			Value = (Value ^ bytes[i]) * 0x100000001b3ULL;
+		}
+	}
+
+	template <typename T>
+	void Add(const T& value)
+	{
+		Add(&value, sizeof(value));
+	}
+
+	uint64_t Value;
+};
+
+IPLString ToHex(uint64_t value)
+{
+	static const char Digits[] = "0123456789abcdef";
+	IPLString hex(16, '0');
+	for (int i = 15; i >= 0; --i, value >>= 4)
+	{
+		hex[i] = Digits[value & 0xf];
+	}
+	return hex;
+}
+
+EntryHeader MakeHeader(const IPLString& key, const IPLString& source, uint64_t codeSize)
+{
+	EntryHeader header{};
+	std::memcpy(header.Magic, EntryMagic, sizeof(EntryMagic));
+	header.CodeSize = codeSize;
+	std::memcpy(header.Key, key.data(), std::min(key.size(), sizeof(header.Key)));
+	header.SourceSize = source.size();
+	// a third offset, so the hash differs from both halves of the key
+	Hash hash(0x6c62272e07bb0142ULL);
+	hash.Add(source.data(), source.size());
+	header.SourceHash = hash.Value;
+	return header;
+}
+}
+
+CompilationCache::CompilationCache(const IPLString& directory, size_t maxBytes)
+	: m_Directory(directory)
+	, m_MaxBytes(maxBytes)
+{
+	std::error_code error;
+	fs::create_directories(m_Directory, error);
+}
+
+IPLString CompilationCache::Key(const IPLString& source, const ByteCodeGeneratorOptions& options)
+{
+	IPLString key;
+	for (auto offset : { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL })
+	{
+		Hash hash(offset);
+		hash.Add(source.data(), source.size());
+		hash.Add(uint64_t(source.size()));
+		hash.Add(uint32_t(CompilerVersion));
+		hash.Add(uint32_t(options.Optimisations));
+		hash.Add(uint8_t(options.AddDebugInformation));
+		key += ToHex(hash.Value);
+	}
+	return key;
+}
+
+CompilationCache::Result CompilationCache::Compile(const IPLString& source, const ByteCodeGeneratorOptions& options)
+{
+	Result result{ false, false, Program() };
+	const auto key = Key(source, options);
+	const auto path = (fs::path(m_Directory) / (key + EntryExtension)).string();
+	if (Load(path, key, source, result.Code))
+	{
+		// the modification time orders the entries for the eviction
+		std::error_code error;
+		fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+		result.IsSuccessful = true;
+		result.IsHit = true;
+		return result;
+	}
+
+	const auto tokens = Tokenize(source.c_str());
+	if (!tokens.IsSuccessful)
+	{
+		return result;
+	}
+	bool parsed = true;
+	auto ast = Parse(tokens.tokens, [&parsed]() { parsed = false; });
+	if (!parsed || !ast)
+	{
+		return result;
+	}
+	auto code = std::make_shared<const IPLString>(GenerateByteCode(ast, source, options));
+	Store(path, key, source, *code);
+
+	result.IsSuccessful = true;
+	result.Code.m_Data = code->data();
+	result.Code.m_Size = code->size();
+	result.Code.m_Owner = code;
+	return result;
+}
+
+bool CompilationCache::Load(const IPLString& path, const IPLString& key, const IPLString& source,
+	Program& program) const
+{
+	auto entry = std::make_shared<MappedEntry>(path);
+	if (entry->Size() < sizeof(EntryHeader))
+	{
+		return false;
+	}
+	EntryHeader header;
+	std::memcpy(&header, entry->Data(), sizeof(header));
+	const auto expected = MakeHeader(key, source, entry->Size() - sizeof(EntryHeader));
+	if (std::memcmp(&header, &expected, sizeof(header)) != 0)
+	{
+		return false;
+	}
+	program.m_Data = entry->Data() + sizeof(EntryHeader);
+	program.m_Size = size_t(header.CodeSize);
+	program.m_Owner = entry;
+	return true;
+}
+
+void CompilationCache::Store(const IPLString& path, const IPLString& key, const IPLString& source,
+	const IPLString& code)
+{
+	// unique per process and call, so concurrent writers never share a file
+	static std::atomic<unsigned> counter{ 0 };
+	const auto temporary = path + "." +
+		std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "." +
+		std::to_string(counter++) + TemporaryExtension;
+	{
+		std::ofstream output(temporary, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		const auto header = MakeHeader(key, source, code.size());
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output.write(code.data(), code.size());
+		if (!output)
+		{
+			output.close();
+			std::error_code error;
+			fs::remove(temporary, error);
+			return;
+		}
+	}
+	std::error_code error;
+	fs::rename(temporary, path, error);
+	if (error)
+	{
+		fs::remove(temporary, error);
+		return;
+	}
+	Evict(path);
+}
+
+//! Removes the least recently used entries until the cache fits its size
+//! and the temporary entries of writers that did not finish
+void CompilationCache::Evict(const IPLString& keep)
+{
+	struct Entry
+	{
+		fs::path Path;
+		uintmax_t Size;
+		fs::file_time_type Used;
+	};
+	IPLVector<Entry> entries;
+	uintmax_t total = 0;
+	const auto stale = fs::file_time_type::clock::now() - StaleTemporary;
+	std::error_code error;
+	for (fs::directory_iterator it(m_Directory, error), end; !error && it != end; it.increment(error))
+	{
+		if (it->path().extension() == TemporaryExtension)
+		{
+			std::error_code entryError;
+			const auto written = it->last_write_time(entryError);
+			if (!entryError && written < stale)
+			{
+				fs::remove(it->path(), entryError);
+			}
+			continue;
+		}
+		if (it->path().extension() != EntryExtension)
+		{
+			continue;
+		}
+		std::error_code entryError;
+		Entry entry{ it->path(), it->file_size(entryError), it->last_write_time(entryError) };
+		if (!entryError)
+		{
+			total += entry.Size;
+			entries.push_back(std::move(entry));
+		}
+	}
+	if (total <= m_MaxBytes)
+	{
+		return;
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+		return lhs.Used < rhs.Used;
+	});
+	for (const auto& entry : entries)
+	{
+		if (total <= m_MaxBytes)
+		{
+			break;
+		}
+		if (entry.Path == fs::path(keep))
+		{
+			continue;
+		}
+		// a mapped entry stays readable after it is removed
+		if (fs::remove(entry.Path, error))
+		{
+			total -= entry.Size;
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "CommonTypes.h"
+#include "ByteCodeGenerator.h"
+
+//! Compiled programs on disk, keyed by the source and the compiler
+/*
+	An entry is named by a hash of the source, CompilerVersion and the
+	options, so a changed source or compiler never finds a stale entry. The
+	entry also keeps its key and another hash of the source, so a source
+	whose key collides with an entry is compiled instead of using it.
+	Entries are written to a temporary file and renamed, so a reader sees a
+	whole entry or none. A hit is mapped and used in place without running
+	the lexer, the parser or the generator. The least recently used entries
+	are removed when the cache grows past its size, together with the
+	temporary files of writers that did not finish.
+*/
+class CompilationCache
+{
+public:
+	//! Bump when the generated code changes for the same source
+	static const unsigned CompilerVersion;
+
+	CompilationCache(const IPLString& directory, size_t maxBytes);
+
+	//! The code of a compiled program, mapped from an entry or in memory
+	class Program
+	{
+	public:
+		const char* Data() const { return m_Data; }
+		size_t Size() const { return m_Size; }
+		IPLString ToString() const { return IPLString(m_Data, m_Size); }
+	private:
+		friend class CompilationCache;
+		const char* m_Data = nullptr;
+		size_t m_Size = 0;
+		//! Keeps the mapping or the string with the code alive
+		IPLSharedPtr<const void> m_Owner;
+	};
+
+	struct Result
+	{
+		bool IsSuccessful;
+		//! Whether the program was found in the cache
+		bool IsHit;
+		Program Code;
+	};
+
+	//! Returns the code of the source from the cache or compiles and stores it
+	Result Compile(const IPLString& source, const ByteCodeGeneratorOptions& options);
+
+	//! The name of the entry of the source
+	static IPLString Key(const IPLString& source, const ByteCodeGeneratorOptions& options);
+
+private:
+	bool Load(const IPLString& path, const IPLString& key, const IPLString& source, Program& program) const;
+	void Store(const IPLString& path, const IPLString& key, const IPLString& source, const IPLString& code);
+	void Evict(const IPLString& keep);
+
+	IPLString m_Directory;
+	size_t m_MaxBytes;
+};
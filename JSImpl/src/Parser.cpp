@@ -444,9 +444,8 @@ ExpressionPtr Parser::CallExpressionHelper(NormalType a)
 
 	if (auto args = Arguments())
 	{
-		// return  meaningfull expr
-		auto next = CallExpressionHelper(a);
-		return nullptr;
+		// the arguments are the member of the call
+		return args;
 	}
 
 	return nullptr;
@@ -1066,7 +1065,7 @@ ExpressionPtr Parser::Arguments()
 			if (Match(TokenType::Comma))
 			{
 				current = AssignmentExpression(NormalType::Normal, AllowType::AllowIn);
-				if (current)
+				if (!current)
 				{
 					// TODO error
 					return nullptr;
@@ -57,6 +57,11 @@ TEST_F(ASTInterpret, StringPlusNumberNotSupported)
 	ASSERT_THROW(Run("var data = 'John Doe' + 42"), std::runtime_error);
 }
 
+TEST_F(ASTInterpret, CallNotSupported)
+{
+	ASSERT_THROW(Run("var data = 6; var answer = data(7)"), std::runtime_error);
+}
+
 TEST_F(ASTInterpret, StringMinusString)
 {
 	ASSERT_THROW(Run("var data = 'John' - 'Doe'"), std::runtime_error);
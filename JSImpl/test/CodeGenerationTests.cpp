@@ -506,3 +506,160 @@ TEST(CodeGen, BreakFor)
 
 	ASSERT_TRUE(asmb == expected);
 }
+
+TEST(CodeGen, ClosureCellsOnlyForCapturedVariables)
+{
+	IPLString source = "function outer(x) { var a = 1; var b = 2; var inner = function() { a = a + x; return a; }; b = b + 1; return b; }";
+	IPLVector<Token> tokens = Tokenize(source.c_str()).tokens;
+	auto ast = Parse(tokens);
+	auto asmb = GenerateByteCode(ast, source,
+		ByteCodeGeneratorOptions(ByteCodeGeneratorOptions::OptimizationsType::None, false));
+	// a and x live in cells, b and inner stay in registers
+	IPLString expected = "0: push 2\n"
+		"1: closure r0 3\n"
+		"2: jmp 28\n"
+		"3: push 8\n"
+		"4: cells 2\n"
+		"5: setup 1 r0\n"
+		"6: const r1 1.000000\n"
+		"7: setup 0 r1\n"
+		"8: const r3 2.000000\n"
+		"9: mov r2 r3\n"
+		"10: closure r5 12 0 1\n"
+		"11: jmp 21\n"
+		"12: push 4\n"
+		"13: getup r0 1\n"
+		"14: getup r1 0\n"
+		"15: add r2 r1 r0\n"
+		"16: setup 0 r2\n"
+		"17: getup r3 0\n"
+		"18: ret r3\n"
+		"19: pop 4\n"
+		"20: ret\n"
+		"21: mov r4 r5\n"
+		"22: const r6 1.000000\n"
+		"23: add r7 r2 r6\n"
+		"24: mov r2 r7\n"
+		"25: ret r2\n"
+		"26: pop 8\n"
+		"27: ret\n"
+		"28: mov r1 r0\n"
+		"29: pop 2\n"
+		"30: halt\n";
+
+	ASSERT_TRUE(asmb == expected);
+}
+
+TEST(CodeGen, FlatClosureForwardsUpvalues)
+{
+	IPLString source = "function f(x) { function g() { function h() { return x; } return 1; } return 2; }";
+	IPLVector<Token> tokens = Tokenize(source.c_str()).tokens;
+	auto ast = Parse(tokens);
+	auto asmb = GenerateByteCode(ast, source,
+		ByteCodeGeneratorOptions(ByteCodeGeneratorOptions::OptimizationsType::None, false));
+	// g does not use x, but gets its cell to make the closure of h
+	IPLString expected = "0: push 2\n"
+		"1: closure r0 3\n"
+		"2: jmp 26\n"
+		"3: push 4\n"
+		"4: cells 1\n"
+		"5: setup 0 r0\n"
+		"6: closure r1 8 0\n"
+		"7: jmp 21\n"
+		"8: push 3\n"
+		"9: closure r0 11 0\n"
+		"10: jmp 16\n"
+		"11: push 1\n"
+		"12: getup r0 0\n"
+		"13: ret r0\n"
+		"14: pop 1\n"
+		"15: ret\n"
+		"16: mov r1 r0\n"
+		"17: const r2 1.000000\n"
+		"18: ret r2\n"
+		"19: pop 3\n"
+		"20: ret\n"
+		"21: mov r2 r1\n"
+		"22: const r3 2.000000\n"
+		"23: ret r3\n"
+		"24: pop 4\n"
+		"25: ret\n"
+		"26: mov r1 r0\n"
+		"27: pop 2\n"
+		"28: halt\n";
+
+	ASSERT_TRUE(asmb == expected);
+}
+
+TEST(CodeGen, GlobalSlots)
+{
+	IPLString source = "var count = 0; var local = 1; var bump = function(n) { count = count + n; total = count; return count; }; local = local + 1;";
+	IPLVector<Token> tokens = Tokenize(source.c_str()).tokens;
+	auto ast = Parse(tokens);
+	auto asmb = GenerateByteCode(ast, source,
+		ByteCodeGeneratorOptions(ByteCodeGeneratorOptions::OptimizationsType::None, false));
+	// count and total are used by a function, local stays in a register
+	IPLString expected = "0: push 7\n"
+		"1: const r0 0.000000\n"
+		"2: setg 0 r0\n"
+		"3: const r2 1.000000\n"
+		"4: mov r1 r2\n"
+		"5: closure r4 7\n"
+		"6: jmp 17\n"
+		"7: push 5\n"
+		"8: getg r1 0\n"
+		"9: add r2 r1 r0\n"
+		"10: setg 0 r2\n"
+		"11: getg r3 0\n"
+		"12: setg 1 r3\n"
+		"13: getg r4 0\n"
+		"14: ret r4\n"
+		"15: pop 5\n"
+		"16: ret\n"
+		"17: mov r3 r4\n"
+		"18: const r5 1.000000\n"
+		"19: add r6 r1 r5\n"
+		"20: mov r1 r6\n"
+		"21: pop 7\n"
+		"22: halt\n"
+		"global 0 count\n"
+		"global 1 total\n";
+
+	ASSERT_TRUE(asmb == expected);
+}
+
+TEST(CodeGen, TailCallInReturn)
+{
+	IPLString source = "var sum = function(acc, n) { if (n == 0) return acc; return sum(acc + n, n - 1); }; var r = sum(0, 10);";
+	IPLVector<Token> tokens = Tokenize(source.c_str()).tokens;
+	auto ast = Parse(tokens);
+	auto asmb = GenerateByteCode(ast, source,
+		ByteCodeGeneratorOptions(ByteCodeGeneratorOptions::OptimizationsType::None, false));
+	// the call in the return of the function reuses its frame
+	IPLString expected = "0: push 6\n"
+		"1: closure r0 3\n"
+		"2: jmp 15\n"
+		"3: push 8\n"
+		"4: const r2 0.000000\n"
+		"5: eq r3 r1 r2\n"
+		"6: jmpf r3 8\n"
+		"7: ret r0\n"
+		"8: getg r4 0\n"
+		"9: add r5 r0 r1\n"
+		"10: const r6 1.000000\n"
+		"11: sub r7 r1 r6\n"
+		"12: tcall r4 r5 r7\n"
+		"13: pop 8\n"
+		"14: ret\n"
+		"15: setg 0 r0\n"
+		"16: getg r2 0\n"
+		"17: const r3 0.000000\n"
+		"18: const r4 10.000000\n"
+		"19: call r5 r2 r3 r4\n"
+		"20: mov r1 r5\n"
+		"21: pop 6\n"
+		"22: halt\n"
+		"global 0 sum\n";
+
+	ASSERT_TRUE(asmb == expected);
+}
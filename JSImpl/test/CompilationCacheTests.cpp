@@ -0,0 +1,120 @@
+#include <src/CommonTypes.h>
+#include <src/Lexer.h>
+#include <src/Parser.h>
+#include "src/ByteCodeGenerator.h"
+#include "src/CompilationCache.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+struct CompilationCacheTest : public ::testing::Test
+{
+	CompilationCacheTest()
+		: Directory((fs::temp_directory_path() / "ipl_compilation_cache_test").string())
+	{
+		fs::remove_all(Directory);
+	}
+
+	~CompilationCacheTest()
+	{
+		fs::remove_all(Directory);
+	}
+
+	fs::path EntryPath(const IPLString& source) const
+	{
+		return fs::path(Directory) / (CompilationCache::Key(source, ByteCodeGeneratorOptions()) + ".iplc");
+	}
+
+	IPLString Directory;
+};
+
+TEST_F(CompilationCacheTest, HitReturnsTheCompiledCode)
+{
+	IPLString source = "var a = 5; do{ a--; }while(a != 0)";
+	auto ast = Parse(Tokenize(source.c_str()).tokens);
+	auto expected = GenerateByteCode(ast, source);
+
+	CompilationCache cache(Directory, 1 << 20);
+	auto miss = cache.Compile(source, ByteCodeGeneratorOptions());
+	ASSERT_TRUE(miss.IsSuccessful);
+	ASSERT_FALSE(miss.IsHit);
+	ASSERT_EQ(miss.Code.ToString(), expected);
+
+	auto hit = cache.Compile(source, ByteCodeGeneratorOptions());
+	ASSERT_TRUE(hit.IsSuccessful);
+	ASSERT_TRUE(hit.IsHit);
+	ASSERT_EQ(hit.Code.ToString(), expected);
+
+	// the entry can go while the program still uses it
+	fs::remove(EntryPath(source));
+	ASSERT_EQ(hit.Code.ToString(), expected);
+	ASSERT_FALSE(cache.Compile(source, ByteCodeGeneratorOptions()).IsHit);
+}
+
+TEST_F(CompilationCacheTest, KeyCoversSourceAndOptions)
+{
+	const ByteCodeGeneratorOptions plain;
+	const ByteCodeGeneratorOptions debug(ByteCodeGeneratorOptions::None, true);
+	ASSERT_EQ(CompilationCache::Key("var a;", plain), CompilationCache::Key("var a;", plain));
+	ASSERT_NE(CompilationCache::Key("var a;", plain), CompilationCache::Key("var b;", plain));
+	ASSERT_NE(CompilationCache::Key("var a;", plain), CompilationCache::Key("var a;", debug));
+}
+
+TEST_F(CompilationCacheTest, EvictsLeastRecentlyUsed)
+{
+	{
+		CompilationCache cache(Directory, 1 << 20);
+		cache.Compile("var a = 1;", ByteCodeGeneratorOptions());
+	}
+	const auto entrySize = fs::file_size(EntryPath("var a = 1;"));
+	CompilationCache cache(Directory, entrySize * 2 + entrySize / 2);
+	cache.Compile("var b = 2;", ByteCodeGeneratorOptions());
+	// the times are set, so the order does not depend on their resolution
+	const auto now = fs::file_time_type::clock::now();
+	fs::last_write_time(EntryPath("var a = 1;"), now - std::chrono::hours(2));
+	fs::last_write_time(EntryPath("var b = 2;"), now - std::chrono::hours(1));
+	ASSERT_TRUE(cache.Compile("var a = 1;", ByteCodeGeneratorOptions()).IsHit);
+	cache.Compile("var c = 3;", ByteCodeGeneratorOptions());
+
+	ASSERT_TRUE(fs::exists(EntryPath("var a = 1;")));
+	ASSERT_FALSE(fs::exists(EntryPath("var b = 2;")));
+	ASSERT_TRUE(fs::exists(EntryPath("var c = 3;")));
+}
+
+TEST_F(CompilationCacheTest, EntryOfAnotherSourceIsNotUsed)
+{
+	CompilationCache cache(Directory, 1 << 20);
+	cache.Compile("var a = 1;", ByteCodeGeneratorOptions());
+	// as if the keys of the two sources collided
+	fs::copy_file(EntryPath("var a = 1;"), EntryPath("var b = 2;"));
+	auto result = cache.Compile("var b = 2;", ByteCodeGeneratorOptions());
+	ASSERT_TRUE(result.IsSuccessful);
+	ASSERT_FALSE(result.IsHit);
+	ASSERT_TRUE(cache.Compile("var b = 2;", ByteCodeGeneratorOptions()).IsHit);
+}
+
+TEST_F(CompilationCacheTest, RemovesStaleTemporaryEntries)
+{
+	CompilationCache cache(Directory, 1 << 20);
+	const auto stale = fs::path(Directory) / "stale.iplc.1.0.tmp";
+	const auto fresh = fs::path(Directory) / "fresh.iplc.2.0.tmp";
+	std::ofstream(stale) << "left by a writer that stopped";
+	std::ofstream(fresh) << "still being written";
+	fs::last_write_time(stale, fs::file_time_type::clock::now() - std::chrono::hours(1));
+	cache.Compile("var a = 1;", ByteCodeGeneratorOptions());
+	ASSERT_FALSE(fs::exists(stale));
+	ASSERT_TRUE(fs::exists(fresh));
+}
+
+TEST_F(CompilationCacheTest, FailedCompilationIsNotStored)
+{
+	CompilationCache cache(Directory, 1 << 20);
+	IPLString source = "var a = \"unterminated";
+	ASSERT_FALSE(cache.Compile(source, ByteCodeGeneratorOptions()).IsSuccessful);
+	ASSERT_FALSE(fs::exists(EntryPath(source)));
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <memory>
 #include <cmath>
+#include <nanbox_value.hpp>
 #include <spasm.hpp>
 
 TEST(Empty, Empty)
@@ -82,7 +83,7 @@ TEST(NaNBox, PlainDoubles)
 
 TEST(NaNBox, Border)
 {
-	Spasm::Value v(Spasm::ValueType::Object, nullptr);
+	Spasm::NanBoxValue v(Spasm::ValueType::Object, nullptr);
     ASSERT_TRUE(std::isnan(v.m_value.as_double));
     ASSERT_FALSE(std::isinf(v.m_value.as_double));
 }
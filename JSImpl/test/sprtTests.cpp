@@ -2,7 +2,19 @@
 
 #include <spasm.hpp>
 #include <assembler.hpp>
+#include <linker.hpp>
+#include <value_map.hpp>
+#include <vector_kernels.hpp>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <sstream>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
 using Spasm::OpCodes;
 
@@ -37,8 +49,22 @@ struct SPASMTest : public SPRTTest
 		programInput.str(program);
 		ASSERT_TRUE(SpasmImpl::ASM::compile(programInput, bytecode))
 			<< "Could not compile the program:" << std::endl << program;
+		Spasm::Spasm::ExceptionHandlers handlers;
+		for (const auto& handler : bytecode.handlers())
+		{
+			handlers.push_back({handler.begin, handler.end, handler.handler});
+		}
+		VM.SetExceptionHandlers(std::move(handlers));
+		VM.SetGlobals(bytecode.globals());
 		Run(bytecode.bytecode());
 	}
+
+	void CompileModule(const std::string& source,
+		SpasmImpl::ASM::Object_Module& module)
+	{
+		std::istringstream input(source);
+		ASSERT_TRUE(SpasmImpl::ASM::compile(input, module));
+	}
 };
 
 TEST_F(SPRTTest, Empty)
@@ -423,3 +449,1392 @@ TEST_F(SPASMTest, StringEscapeD)
 	CompileAndRun(program);
 	ASSERT_EQ(Output.str(), "the answer\\\" is 42");
 }
+
+TEST_F(SPASMTest, StringConcat)
+{
+	const char* program =
+		"push 4"				"\n"
+		"string 1 'the answer'"	"\n"
+		"string 2 ' is '"		"\n"
+		"const 3 42"			"\n"
+		"add 1 1 2"				"\n"
+		"add 1 1 3"				"\n"
+		"print 1"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "the answer is 42");
+}
+
+TEST_F(SPASMTest, RopeEqualsFlat)
+{
+	const char* program =
+		"push 7"				"\n"
+		"const 1 0"				"\n"
+		"const 2 40"			"\n"
+		"const 4 1"				"\n"
+		"string 3 'ab'"			"\n"
+		"string 5 ''"			"\n"
+		"label loop"			"\n"
+		"add 5 5 3"				"\n"
+		"add 1 1 4"				"\n"
+		"less 6 1 2"			"\n"
+		"jmpt 6 loop"			"\n"
+		"string 3 'abababababababababababababababababababababababababababababababababababababababab'" "\n"
+		"equal 6 5 3"			"\n"
+		"print 6"				"\n"
+		"add 5 5 4"				"\n"
+		"equal 6 5 3"			"\n"
+		"print 6"				"\n"
+		"print 5"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "10"
+		"abababababababababababababababababababababababababababababababababababababababab1");
+}
+
+TEST_F(SPASMTest, PrintRope)
+{
+	const char* program =
+		"push 3"				"\n"
+		"string 1 'the answer is the answer is the answer is the answer is '" "\n"
+		"string 2 'forty '"		"\n"
+		"add 3 1 2"				"\n"
+		"add 3 3 2"				"\n"
+		"add 3 3 1"				"\n"
+		"print 3"				"\n"
+		"print 2"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(),
+		"the answer is the answer is the answer is the answer is forty forty "
+		"the answer is the answer is the answer is the answer is forty ");
+}
+
+TEST_F(SPASMTest, ShortStringConcat)
+{
+	const char* program =
+		"push 7"				"\n"
+		"string 1 'ab'"			"\n"
+		"string 2 'c'"			"\n"
+		"add 3 1 2"				"\n"
+		"string 4 'abc'"		"\n"
+		"equal 5 3 4"			"\n"
+		"print 5"				"\n"
+		"const 6 12"			"\n"
+		"add 3 3 6"				"\n"
+		"print 3"				"\n"
+		"add 3 3 3"				"\n"
+		"print 3"				"\n"
+		"equal 5 3 4"			"\n"
+		"print 5"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "1abc12abc12abc120");
+}
+
+static Spasm::Value NativeMultiplyAdd(Spasm::Value* args, size_t count)
+{
+	EXPECT_EQ(count, 3u);
+	return args[0] * args[1] + args[2];
+}
+
+TEST_F(SPASMTest, CallNative)
+{
+	Spasm::NativeRegistry natives;
+	natives.Register("print", nullptr, 0);
+	const auto index = natives.Register("multiplyAdd", &NativeMultiplyAdd, 3);
+	ASSERT_EQ(natives.Find("multiplyAdd"), index);
+	ASSERT_EQ(natives.Find("missing"), Spasm::NativeRegistry::NotFound);
+	VM.SetNatives(natives);
+
+	const char* program =
+		"push 5"				"\n"
+		"const 1 6"				"\n"
+		"const 2 7"				"\n"
+		"const 3 -2"			"\n"
+		"callnative 4 1 1"		"\n"
+		"print 4"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "40");
+}
+
+TEST_F(SPASMTest, FiberYield)
+{
+	const char* program =
+		"push 4"				"\n"
+		"const 1 1"				"\n"
+		"const 2 2"				"\n"
+		"string 4 'r'"			"\n"
+		"spawn 3 worker 1"		"\n"
+		"spawn 3 worker 2"		"\n"
+		"yield 1"				"\n"
+		"print 4"				"\n"
+		"yield 1"				"\n"
+		"halt"					"\n"
+		"label worker"			"\n"
+		"push 1"				"\n"
+		"print 0"				"\n"
+		"yield 1"				"\n"
+		"print 0"				"\n"
+		"ret 1"					"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "12r12");
+}
+
+TEST_F(SPASMTest, FiberResume)
+{
+	const char* program =
+		"push 4"				"\n"
+		"const 2 3"				"\n"
+		"spawn 1 countdown 2"	"\n"
+		"resume 3 1"			"\n"
+		"print 3"				"\n"
+		"resume 3 1"			"\n"
+		"print 3"				"\n"
+		"resume 3 1"			"\n"
+		"print 3"				"\n"
+		"resume 3 1"			"\n"
+		"print 3"				"\n"
+		"resume 3 1"			"\n"
+		"print 3"				"\n"
+		"halt"					"\n"
+		"label countdown"		"\n"
+		"push 3"				"\n"
+		"const 2 1"				"\n"
+		"const 3 0"				"\n"
+		"label next"			"\n"
+		"yield 0"				"\n"
+		"sub 0 0 2"				"\n"
+		"less 1 3 0"			"\n"
+		"jmpt 1 next"			"\n"
+		"ret 0"					"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "32100");
+}
+
+TEST_F(SPASMTest, ForkJoin)
+{
+	Spasm::TaskPool tasks(4);
+	VM.SetTaskPool(tasks);
+
+	const char* program =
+		"push 6"				"\n"
+		"const 1 20"			"\n"
+		"fork 2 triangle 1"		"\n"
+		"const 1 30"			"\n"
+		"fork 3 triangle 1"		"\n"
+		"string 1 'a long string argument'"	"\n"
+		"fork 4 echo 1"			"\n"
+		"join 2 2"				"\n"
+		"join 3 3"				"\n"
+		"join 4 4"				"\n"
+		"print 2"				"\n"
+		"print 3"				"\n"
+		"print 4"				"\n"
+		"halt"					"\n"
+		"label triangle"		"\n"
+		"push 4"				"\n"
+		"const 1 0"				"\n"
+		"const 2 1"				"\n"
+		"label next"			"\n"
+		"add 1 1 0"				"\n"
+		"sub 0 0 2"				"\n"
+		"less 3 2 0"			"\n"
+		"jmpt 3 next"			"\n"
+		"add 1 1 0"				"\n"
+		"ret 1"					"\n"
+		"label echo"			"\n"
+		"push 1"				"\n"
+		"string 1 '!'"			"\n"
+		"add 0 0 1"				"\n"
+		"ret 0"					"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "210465a long string argument!");
+}
+
+TEST_F(SPASMTest, ChannelSendReceive)
+{
+	Spasm::Channel channel(4);
+	ASSERT_EQ(VM.AddChannel(channel), 0u);
+
+	const char* program =
+		"push 4"				"\n"
+		"channel 1 0"			"\n"
+		"const 2 42"			"\n"
+		"send 1 2"				"\n"
+		"string 2 'a string longer than five'"	"\n"
+		"send 1 2"				"\n"
+		"recv 3 1"				"\n"
+		"print 3"				"\n"
+		"recv 3 1"				"\n"
+		"print 3"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "42a string longer than five");
+}
+
+TEST_F(SPASMTest, BudgetSuspendsAndResumes)
+{
+	const char* program =
+		"push 5"				"\n"
+		"const 1 0"				"\n"
+		"const 2 100"			"\n"
+		"const 3 1"				"\n"
+		"label loop"			"\n"
+		"add 1 1 3"				"\n"
+		"less 4 1 2"			"\n"
+		"jmpt 4 loop"			"\n"
+		"print 1"				"\n"
+		;
+	SpasmImpl::ASM::Bytecode_Memory bytecode;
+	std::istringstream programInput(program);
+	ASSERT_TRUE(SpasmImpl::ASM::compile(programInput, bytecode));
+	const auto code = bytecode.bytecode();
+	VM.Initialize(code.size(), code.data(), Input, Output);
+
+	int suspensions = 0;
+	while (VM.run(10) == Spasm::Spasm::RunResult::Suspended)
+	{
+		ASSERT_EQ(Output.str(), "");
+		++suspensions;
+	}
+	ASSERT_EQ(suspensions, 9);
+	ASSERT_EQ(Output.str(), "100");
+}
+
+TEST_F(SPASMTest, BudgetStopsEndlessLoop)
+{
+	const char* program =
+		"label forever"			"\n"
+		"jmp forever"			"\n"
+		;
+	SpasmImpl::ASM::Bytecode_Memory bytecode;
+	std::istringstream programInput(program);
+	ASSERT_TRUE(SpasmImpl::ASM::compile(programInput, bytecode));
+	const auto code = bytecode.bytecode();
+	VM.Initialize(code.size(), code.data(), Input, Output);
+	ASSERT_EQ(VM.run(1000), Spasm::Spasm::RunResult::Suspended);
+	ASSERT_EQ(VM.run(1000), Spasm::Spasm::RunResult::Suspended);
+}
+
+TEST_F(SPASMTest, SnapshotResumesAfterHalt)
+{
+	const char* program =
+		"push 5"				"\n"
+		"const 2 3"				"\n"
+		"spawn 1 countdown 2"	"\n"
+		"resume 3 1"			"\n"
+		"string 4 'a string longer than five'"	"\n"
+		"halt"					"\n"
+		"print 4"				"\n"
+		"print 3"				"\n"
+		"resume 3 1"			"\n"
+		"print 3"				"\n"
+		"halt"					"\n"
+		"label countdown"		"\n"
+		"push 3"				"\n"
+		"const 2 1"				"\n"
+		"const 3 0"				"\n"
+		"label next"			"\n"
+		"yield 0"				"\n"
+		"sub 0 0 2"				"\n"
+		"less 1 3 0"			"\n"
+		"jmpt 1 next"			"\n"
+		"ret 0"					"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "");
+
+	const std::string path = "SnapshotResumesAfterHalt.snapshot";
+	ASSERT_TRUE(VM.SaveSnapshot(path));
+	{
+		Spasm::Spasm restored;
+		std::ostringstream output;
+		ASSERT_TRUE(restored.LoadSnapshot(path, Input, output));
+		ASSERT_EQ(Spasm::Spasm::RunResult::Success, restored.run());
+		ASSERT_EQ(output.str(), "a string longer than five32");
+	}
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, VectorOps)
+{
+	const char* program =
+		"push 9"				"\n"
+		"const 1 5"				"\n"
+		"vnew 2 1"				"\n"
+		"vnew 3 1"				"\n"
+		"const 4 0"				"\n"
+		"const 5 1"				"\n"
+		"label fill"			"\n"
+		"vset 2 4 4"			"\n"
+		"vset 3 4 5"			"\n"
+		"add 4 4 5"				"\n"
+		"less 6 4 1"			"\n"
+		"jmpt 6 fill"			"\n"
+		"vadd 3 2 3"			"\n"
+		"vsum 7 3"				"\n"
+		"print 7"				"\n"
+		"const 8 2"				"\n"
+		"vscale 3 3 8"			"\n"
+		"vmul 3 3 2"			"\n"
+		"const 4 4"				"\n"
+		"vget 7 3 4"			"\n"
+		"print 7"				"\n"
+		"vdot 7 2 2"			"\n"
+		"print 7"				"\n"
+		;
+	CompileAndRun(program);
+	// sum of i + 1, (4 + 1) * 2 * 4 and sum of i * i for i < 5
+	ASSERT_EQ(Output.str(), "154030");
+}
+
+TEST_F(SPASMTest, VectorErrorsThrow)
+{
+	const char* program =
+		"push 6"				"\n"
+		"try get_begin get_end get_handler"	"\n"
+		"try set_begin set_end set_handler"	"\n"
+		"try add_begin add_end add_handler"	"\n"
+		"try new_begin new_end new_handler"	"\n"
+		"const 1 3"				"\n"
+		"vnew 2 1"				"\n"
+		"const 1 2"				"\n"
+		"vnew 3 1"				"\n"
+		"const 1 -1"			"\n"
+		"label get_begin"		"\n"
+		"vget 4 2 1"			"\n"
+		"label get_end"			"\n"
+		"label get_handler"		"\n"
+		"catch 5"				"\n"
+		"print 5"				"\n"
+		"const 1 3"				"\n"
+		"label set_begin"		"\n"
+		"vset 2 1 1"			"\n"
+		"label set_end"			"\n"
+		"label set_handler"		"\n"
+		"catch 5"				"\n"
+		"print 5"				"\n"
+		"label add_begin"		"\n"
+		"vadd 2 2 3"			"\n"
+		"label add_end"			"\n"
+		"label add_handler"		"\n"
+		"catch 5"				"\n"
+		"print 5"				"\n"
+		"const 1 0"				"\n"
+		"div 1 1 1"				"\n"
+		"label new_begin"		"\n"
+		"vnew 4 1"				"\n"
+		"label new_end"			"\n"
+		"label new_handler"		"\n"
+		"catch 5"				"\n"
+		"print 5"				"\n"
+		;
+	// the size of the NaN array is not converted
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "Index out of rangeIndex out of range"
+		"Lengths differLength out of range");
+}
+
+TEST_F(SPASMTest, MapOps)
+{
+	const char* program =
+		"push 8"				"\n"
+		"mnew 1"				"\n"
+		"string 2 'a key longer than five'"	"\n"
+		"string 3 'a key longer'"	"\n"
+		"string 4 ' than five'"	"\n"
+		"add 3 3 4"				"\n"
+		"const 5 7"				"\n"
+		"mset 1 2 5"			"\n"
+		"mget 6 1 3"			"\n"
+		"print 6"				"\n"
+		"string 7 'ab'"			"\n"
+		"mset 1 7 2"			"\n"
+		"mget 6 1 7"			"\n"
+		"print 6"				"\n"
+		"mset 1 5 5"			"\n"
+		"mhas 6 1 5"			"\n"
+		"print 6"				"\n"
+		"mdel 6 1 5"			"\n"
+		"print 6"				"\n"
+		"mhas 6 1 5"			"\n"
+		"print 6"				"\n"
+		"mdel 6 1 5"			"\n"
+		"print 6"				"\n"
+		"mget 6 1 5"			"\n"
+		"print 6"				"\n"
+		"halt"					"\n"
+		"mget 6 1 7"			"\n"
+		"print 6"				"\n"
+		;
+	// the concatenated key finds the value of the equal literal
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "7a key longer than five1100");
+
+	const std::string path = "MapOps.snapshot";
+	ASSERT_TRUE(VM.SaveSnapshot(path));
+	{
+		Spasm::Spasm restored;
+		std::ostringstream output;
+		ASSERT_TRUE(restored.LoadSnapshot(path, Input, output));
+		ASSERT_EQ(Spasm::Spasm::RunResult::Success, restored.run());
+		ASSERT_EQ(output.str(), "a key longer than five");
+	}
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, SnapshotStringsOfOtherRepresentations)
+{
+	if (Spasm::Value::ShortStringCapacity >= 8)
+	{
+		// 'abcdefgh' is inline here, there is no string table to patch
+		return;
+	}
+	const char* program =
+		"push 4"				"\n"
+		"string 1 'ab'"			"\n"
+		"setg inline 1"			"\n"
+		"string 1 'abcdefgh'"	"\n"
+		"setg interned 1"		"\n"
+		"halt"					"\n"
+		"getg 1 inline"			"\n"
+		"string 2 'abcdefgh'"	"\n"
+		"equal 3 1 2"			"\n"
+		"print 3"				"\n"
+		"getg 1 interned"		"\n"
+		"string 2 'abc'"		"\n"
+		"equal 3 1 2"			"\n"
+		"print 3"				"\n"
+		;
+	CompileAndRun(program);
+	const std::string path = "SnapshotStrings.snapshot";
+	ASSERT_TRUE(VM.SaveSnapshot(path));
+	std::string image;
+	{
+		std::ifstream file(path, std::ios::binary);
+		image.assign(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+	}
+	const auto words = [](uint64_t first, const char* second) {
+		std::string bytes(16, '\0');
+		std::memcpy(&bytes[0], &first, sizeof(first));
+		std::memcpy(&bytes[8], second, std::strlen(second));
+		return bytes;
+	};
+	// a build with 8 inline characters saves 'abcdefgh' inline, one with
+	// 3 or fewer saves 'abc' in the string table
+	const uint64_t shortString =
+		uint64_t(Spasm::ValueType::String) | 0x100 | (2 << 16);
+	const auto inlined = image.find(words(shortString, "ab"));
+	ASSERT_NE(inlined, std::string::npos);
+	image.replace(inlined, 16, words(shortString + (6 << 16), "abcdefgh"));
+	const auto interned = image.find(words(8, "abcdefgh"));
+	ASSERT_NE(interned, std::string::npos);
+	image.replace(interned, 16, words(3, "abc"));
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << image;
+	}
+
+	// both are made as this build makes them, so they equal the literals
+	Spasm::Spasm restored;
+	std::ostringstream output;
+	ASSERT_TRUE(restored.LoadSnapshot(path, Input, output));
+	ASSERT_EQ(Spasm::Spasm::RunResult::Success, restored.run());
+	ASSERT_EQ(output.str(), "11");
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, SnapshotTruncatedWithTasks)
+{
+	Spasm::TaskPool tasks(2);
+	VM.SetTaskPool(tasks);
+	const char* program =
+		"push 2"				"\n"
+		"const 1 3"				"\n"
+		"fork 0 double 1"		"\n"
+		"join 0 0"				"\n"
+		"halt"					"\n"
+		"label double"			"\n"
+		"push 1"				"\n"
+		"add 0 0 0"				"\n"
+		"ret 0"					"\n"
+		;
+	CompileAndRun(program);
+	const std::string path = "SnapshotTruncated.snapshot";
+	ASSERT_TRUE(VM.SaveSnapshot(path));
+	std::string image;
+	{
+		std::ifstream file(path, std::ios::binary);
+		image.assign(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+	}
+	// the last object loses its last word, the size follows the magic
+	// and the version
+	uint64_t size;
+	std::memcpy(&size, &image[16], sizeof(size));
+	ASSERT_EQ(size, image.size());
+	size -= sizeof(uint64_t);
+	std::memcpy(&image[16], &size, sizeof(size));
+	image.resize(size);
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << image;
+	}
+
+	// the task of the image was never forked, so it is not waited for
+	Spasm::Spasm restored;
+	restored.SetTaskPool(tasks);
+	std::ostringstream output;
+	ASSERT_FALSE(restored.LoadSnapshot(path, Input, output));
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, SnapshotCorruptWordsDoNotCrash)
+{
+	const char* program =
+		"push 4"				"\n"
+		"const 2 3"				"\n"
+		"spawn 1 wait 2"		"\n"
+		"resume 3 1"			"\n"
+		"string 2 'a string longer than five'"	"\n"
+		"setg text 2"			"\n"
+		"mnew 2"				"\n"
+		"setg map 2"			"\n"
+		"const 2 4"				"\n"
+		"vnew 2 2"				"\n"
+		"setg vector 2"			"\n"
+		"halt"					"\n"
+		"label wait"			"\n"
+		"push 1"				"\n"
+		"yield 0"				"\n"
+		"ret 0"					"\n"
+		;
+	CompileAndRun(program);
+	const std::string path = "SnapshotCorrupt.snapshot";
+	ASSERT_TRUE(VM.SaveSnapshot(path));
+	std::string image;
+	{
+		std::ifstream file(path, std::ios::binary);
+		image.assign(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+	}
+	// every word of the image after the magic, set to a small and to a
+	// huge number, loads or fails, but is never read out of bounds
+	const uint64_t patterns[] = {3, ~uint64_t(0) >> 1, ~uint64_t(0)};
+	for (size_t offset = 8; offset + 8 <= image.size(); offset += 8)
+	{
+		for (const auto pattern : patterns)
+		{
+			auto corrupt = image;
+			std::memcpy(&corrupt[offset], &pattern, sizeof(pattern));
+			{
+				std::ofstream file(path, std::ios::binary);
+				file << corrupt;
+			}
+			Spasm::Spasm restored;
+			std::ostringstream output;
+			restored.LoadSnapshot(path, Input, output);
+		}
+	}
+	std::remove(path.c_str());
+}
+
+TEST(ValueMap, IntegerAndNaNKeys)
+{
+	using SpasmImpl::data_t;
+	SpasmImpl::ValueMap map;
+	for (int i = 0; i <= 1000; ++i)
+	{
+		map.Entries[data_t(double(i))] = data_t(double(i));
+	}
+	ASSERT_EQ(map.Entries.size(), 1001u);
+	// the table grows only for the count, not for long probe runs
+	ASSERT_LE(map.Entries.bucket_count(), 4096u);
+	for (int i = 0; i <= 1000; ++i)
+	{
+		ASSERT_EQ(map.Entries.count(data_t(double(i))), 1u);
+	}
+	// a 32 bit size_t keeps the low bits, they must tell integers apart
+	const SpasmImpl::ValueMapHash hash;
+	ASSERT_NE(uint32_t(hash(data_t(1.0))), uint32_t(hash(data_t(2.0))));
+
+	double nans[2];
+	const uint64_t bits[] = {0x7ff8000000000000ull, 0xfff8000000000000ull};
+	std::memcpy(nans, bits, sizeof(nans));
+	map.Entries[data_t(nans[0])] = data_t(1.0);
+	map.Entries[data_t(nans[1])] = data_t(2.0);
+	ASSERT_EQ(map.Entries.size(), 1002u);
+	ASSERT_EQ(map.Entries[data_t(nans[0])].get_double(), 2.0);
+}
+
+TEST_F(SPASMTest, BufferOps)
+{
+	const std::string path = "BufferOps.bin";
+	{
+		std::ofstream file(path, std::ios::binary);
+		const uint32_t word = 70000;
+		const int16_t half = -3;
+		const double number = 2.5;
+		file.write(reinterpret_cast<const char*>(&word), sizeof(word));
+		file.write(reinterpret_cast<const char*>(&half), sizeof(half));
+		file.write(reinterpret_cast<const char*>(&number), sizeof(number));
+	}
+	const char* program =
+		"push 9"				"\n"
+		"string 1 'BufferOps.bin'"	"\n"
+		"bopen 2 1"				"\n"
+		"bsize 3 2"				"\n"
+		"print 3"				"\n"
+		"const 4 0"				"\n"
+		"bget 5 2 4 u32"		"\n"
+		"print 5"				"\n"
+		"const 4 4"				"\n"
+		"bget 5 2 4 i16"		"\n"
+		"print 5"				"\n"
+		"const 6 10"			"\n"
+		"bslice 7 2 4 6"		"\n"
+		"const 4 2"				"\n"
+		"bget 5 7 4 f64"		"\n"
+		"print 5"				"\n"
+		"bnew 7 6"				"\n"
+		"bslice 8 7 4 4"		"\n"
+		"const 5 300"			"\n"
+		"const 4 0"				"\n"
+		"bset 8 4 5 u16"		"\n"
+		"const 4 2"				"\n"
+		"bget 5 7 4 u8"			"\n"
+		"print 5"				"\n"
+		"string 1 'missing.bin'"	"\n"
+		"bopen 2 1"				"\n"
+		"print 2"				"\n"
+		;
+	CompileAndRun(program);
+	// the write through the slice is seen by the buffer, 300 is 0x12c
+	ASSERT_EQ(Output.str(), "1470000-32.5440");
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, BufferErrorsThrow)
+{
+	const std::string path = "BufferErrors.bin";
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << "abcd";
+	}
+	const char* program =
+		"push 7"				"\n"
+		"try get_begin get_end get_handler"	"\n"
+		"try set_begin set_end set_handler"	"\n"
+		"try slice_begin slice_end slice_handler"	"\n"
+		"try value_begin value_end value_handler"	"\n"
+		"try new_begin new_end new_handler"	"\n"
+		"const 1 4"				"\n"
+		"bnew 1 1"				"\n"
+		"const 2 -1"			"\n"
+		"label get_begin"		"\n"
+		"bget 3 1 2 u8"			"\n"
+		"label get_end"			"\n"
+		"label get_handler"		"\n"
+		"catch 4"				"\n"
+		"print 4"				"\n"
+		"string 5 'BufferErrors.bin'"	"\n"
+		"bopen 6 5"				"\n"
+		"const 2 0"				"\n"
+		"label set_begin"		"\n"
+		"bset 6 2 2 u8"			"\n"
+		"label set_end"			"\n"
+		"label set_handler"		"\n"
+		"catch 4"				"\n"
+		"print 4"				"\n"
+		"bget 3 6 2 u8"			"\n"
+		"print 3"				"\n"
+		"const 2 3"				"\n"
+		"label slice_begin"		"\n"
+		"bslice 3 1 2 2"		"\n"
+		"label slice_end"		"\n"
+		"label slice_handler"	"\n"
+		"catch 4"				"\n"
+		"print 4"				"\n"
+		"const 2 0"				"\n"
+		"const 3 -1"			"\n"
+		"bset 1 2 3 u8"			"\n"
+		"bget 3 1 2 u8"			"\n"
+		"print 3"				"\n"
+		"const 3 1000000000"	"\n"
+		"mul 3 3 3"				"\n"
+		"mul 3 3 3"				"\n"
+		"label value_begin"		"\n"
+		"bset 1 2 3 i32"		"\n"
+		"label value_end"		"\n"
+		"label value_handler"	"\n"
+		"catch 4"				"\n"
+		"print 4"				"\n"
+		"const 3 -1"			"\n"
+		"label new_begin"		"\n"
+		"bnew 1 3"				"\n"
+		"label new_end"			"\n"
+		"label new_handler"		"\n"
+		"catch 4"				"\n"
+		"print 4"				"\n"
+		;
+	CompileAndRun(program);
+	// the mapped file is read-only, so it still starts with 'a', and -1
+	// wraps to the unsigned byte
+	ASSERT_EQ(Output.str(),
+		"Offset out of rangeThe buffer is read-only97Slice out of range"
+		"255Value out of rangeSize out of range");
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, ThrowCatch)
+{
+	const char* program =
+		"push 3"				"\n"
+		"try begin end handler"	"\n"
+		"const 1 1"				"\n"
+		"label begin"			"\n"
+		"const 2 42"			"\n"
+		"throw 2"				"\n"
+		"const 1 2"				"\n"
+		"label end"				"\n"
+		"print 1"				"\n"
+		"halt"					"\n"
+		"label handler"			"\n"
+		"catch 3"				"\n"
+		"print 1"				"\n"
+		"print 3"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "142");
+}
+
+TEST_F(SPASMTest, OnlyCountedRunsCount)
+{
+	const char* program =
+		"push 1"				"\n"
+		"const 0 1"				"\n"
+		"halt"					"\n"
+		"print 0"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(VM.InstructionCount(), 0u);
+	ASSERT_EQ(VM.RunCounted(), Spasm::Spasm::RunResult::Success);
+	ASSERT_EQ(VM.InstructionCount(), 1u);
+	ASSERT_EQ(Output.str(), "1");
+}
+
+TEST_F(SPASMTest, ThrowLoopUsesBudget)
+{
+	// the handler throws again, so the loop has no backward jump
+	const char* program =
+		"push 1"				"\n"
+		"try begin end begin"	"\n"
+		"label begin"			"\n"
+		"throw 0"				"\n"
+		"label end"				"\n"
+		;
+	SpasmImpl::ASM::Bytecode_Memory bytecode;
+	std::istringstream programInput(program);
+	ASSERT_TRUE(SpasmImpl::ASM::compile(programInput, bytecode));
+	Spasm::Spasm::ExceptionHandlers handlers;
+	for (const auto& handler : bytecode.handlers())
+	{
+		handlers.push_back({handler.begin, handler.end, handler.handler});
+	}
+	VM.SetExceptionHandlers(std::move(handlers));
+	const auto code = bytecode.bytecode();
+	VM.Initialize(code.size(), code.data(), Input, Output);
+	ASSERT_EQ(VM.run(1000), Spasm::Spasm::RunResult::Suspended);
+	ASSERT_EQ(VM.run(1000), Spasm::Spasm::RunResult::Suspended);
+}
+
+TEST_F(SPASMTest, ThrowUnwindsCalls)
+{
+	const char* program =
+		"push 4"				"\n"
+		"try outer_begin outer_end outer"	"\n"
+		"try begin end inner"	"\n"
+		"label outer_begin"		"\n"
+		"const 1 0"				"\n"
+		"const 2 7"				"\n"
+		"const 3 1"				"\n"
+		"label begin"			"\n"
+		"pushr 1"				"\n"
+		"pushr 2"				"\n"
+		"pushr 3"				"\n"
+		"call thrower"			"\n"
+		"popr 1"				"\n"
+		"label end"				"\n"
+		"label outer_end"		"\n"
+		"halt"					"\n"
+		"label outer"			"\n"
+		"print 2"				"\n"
+		"halt"					"\n"
+		"label inner"			"\n"
+		"catch 4"				"\n"
+		"print 4"				"\n"
+		"pushr 2"				"\n"
+		"popr 1"				"\n"
+		"print 1"				"\n"
+		"halt"					"\n"
+		"label thrower"			"\n"
+		"push 2"				"\n"
+		"const 2 1"				"\n"
+		"pushr 1"				"\n"
+		"pushr -1"				"\n"
+		"pushr 2"				"\n"
+		"call nested"			"\n"
+		"popr 1"				"\n"
+		"ret 1"					"\n"
+		"label nested"			"\n"
+		"throw -1"				"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "77");
+}
+
+TEST_F(SPASMTest, UncaughtThrow)
+{
+	const char* program =
+		"push 1"				"\n"
+		"const 1 5"				"\n"
+		"throw 1"				"\n"
+		"print 1"				"\n"
+		;
+	SpasmImpl::ASM::Bytecode_Memory bytecode;
+	std::istringstream programInput(program);
+	ASSERT_TRUE(SpasmImpl::ASM::compile(programInput, bytecode));
+	const auto code = bytecode.bytecode();
+	VM.Initialize(code.size(), code.data(), Input, Output);
+	ASSERT_EQ(VM.run(), Spasm::Spasm::RunResult::Exception);
+	ASSERT_EQ(Output.str(), "");
+}
+
+TEST_F(SPASMTest, Globals)
+{
+	const char* program =
+		"push 3"				"\n"
+		"const 1 5"				"\n"
+		"setg total 1"			"\n"
+		"string 1 'name'"		"\n"
+		"setg title 1"			"\n"
+		"const 1 0"				"\n"
+		"pushr 1"				"\n"
+		"pushr 1"				"\n"
+		"call add_two"			"\n"
+		"getg 2 total"			"\n"
+		"print 2"				"\n"
+		"halt"					"\n"
+		"label add_two"			"\n"
+		"push 2"				"\n"
+		"getg 1 total"			"\n"
+		"const 2 2"				"\n"
+		"add 1 1 2"				"\n"
+		"setg total 1"			"\n"
+		"ret 1"					"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "7");
+	ASSERT_EQ(VM.GlobalCount(), 2u);
+	ASSERT_EQ(VM.FindGlobal("total"), 0u);
+	ASSERT_EQ(VM.GlobalName(1), "title");
+	ASSERT_EQ(VM.FindGlobal("missing"), Spasm::Spasm::NoGlobal);
+	ASSERT_EQ(VM.GetGlobal(VM.FindGlobal("total")).get_double(), 7);
+
+	const std::string path = "Globals.snapshot";
+	ASSERT_TRUE(VM.SaveSnapshot(path));
+	{
+		Spasm::Spasm restored;
+		std::ostringstream output;
+		ASSERT_TRUE(restored.LoadSnapshot(path, Input, output));
+		ASSERT_EQ(restored.GlobalCount(), 2u);
+		ASSERT_EQ(restored.GetGlobal(0).get_double(), 7);
+		restored.SetGlobal(1, restored.GetGlobal(0));
+		ASSERT_EQ(restored.GetGlobal(1).get_double(), 7);
+	}
+	std::remove(path.c_str());
+}
+
+TEST_F(SPASMTest, CompileMappedFile)
+{
+	// longer than the window of the lexer and ending on a page boundary
+	std::ostringstream source;
+	source << "push 3\n";
+	for (int i = 0; i < 10000; ++i)
+	{
+		source << "const 1 " << i << "\nadd 2 2 1\n";
+	}
+	source << "print 2\n";
+	auto text = source.str();
+	while (text.size() % 4096)
+	{
+		const auto length = std::min<size_t>(64, 4096 - text.size() % 4096);
+		text += length > 1 ? "#" + std::string(length - 2, 'x') + "\n" : "\n";
+	}
+
+	const std::string path = "CompileMappedFile.spa";
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << text;
+	}
+	SpasmImpl::ASM::Bytecode_Memory streamed;
+	std::istringstream input(text);
+	ASSERT_TRUE(SpasmImpl::ASM::compile(input, streamed));
+	SpasmImpl::ASM::Bytecode_Memory mapped;
+	ASSERT_TRUE(SpasmImpl::ASM::compile_file(path, mapped));
+	ASSERT_EQ(streamed.bytecode(), mapped.bytecode());
+	ASSERT_FALSE(SpasmImpl::ASM::compile_file("missing.spa", mapped));
+	std::remove(path.c_str());
+
+	const auto& code = mapped.bytecode();
+	VM.Initialize(code.size(), code.data(), Input, Output);
+	VM.run();
+	ASSERT_EQ(Output.str(), "4.9995e+07");
+}
+
+TEST_F(SPASMTest, StreamTokensOutliveTheBuffer)
+{
+	// the name of setg is used after the lexer buffer is refilled for the
+	// register that follows it, some times more than once in between
+	std::ostringstream source;
+	source << "push 2\n";
+	for (int i = 0; i < 3000; ++i)
+	{
+		source << "string 1 'string number " << i << "'\n"
+			<< "setg global_number_" << i;
+		if (i % 100 == 0)
+		{
+			source << "\n#" << std::string(3000, 'x') << "\n";
+		}
+		source << " 1\n";
+	}
+	source << "halt\n";
+	SpasmImpl::ASM::Bytecode_Memory bytecode;
+	std::istringstream input(source.str());
+	ASSERT_TRUE(SpasmImpl::ASM::compile(input, bytecode));
+	const auto& globals = bytecode.globals();
+	ASSERT_EQ(globals.size(), 3000u);
+	for (size_t i = 0; i < globals.size(); ++i)
+	{
+		ASSERT_EQ(globals[i], "global_number_" + std::to_string(i));
+	}
+}
+
+TEST_F(SPASMTest, WriteProgramFile)
+{
+	// more code than the first mapping of the file, with forward labels,
+	// a handler and globals after it
+	std::ostringstream source;
+	source << "push 2\n"
+		<< "try begin end handler\n"
+		<< "jmp begin\n";
+	for (int i = 0; i < 200000; ++i)
+	{
+		source << "const 1 1000000\n";
+	}
+	source << "label begin\n"
+		<< "setg first 1\n"
+		<< "setg second 1\n"
+		<< "label end\n"
+		<< "label handler\n"
+		<< "halt\n";
+	SpasmImpl::ASM::Bytecode_Memory memory;
+	std::istringstream input(source.str());
+	ASSERT_TRUE(SpasmImpl::ASM::compile(input, memory));
+
+	const std::string path = "WriteProgramFile.bin";
+	{
+		SpasmImpl::ASM::Bytecode_File file(path);
+		ASSERT_TRUE(file.is_open());
+		std::istringstream again(source.str());
+		ASSERT_TRUE(SpasmImpl::ASM::compile(again, file));
+		ASSERT_EQ(file.size(), memory.size());
+		ASSERT_TRUE(file.close());
+	}
+	std::ifstream file(path, std::ios::binary);
+	const std::string image((std::istreambuf_iterator<char>(file)),
+		std::istreambuf_iterator<char>());
+	file.close();
+	std::remove(path.c_str());
+
+	size_t offset = 0;
+	const auto read_size = [&] {
+		size_t value = 0;
+		std::memcpy(&value, image.data() + offset, sizeof(value));
+		offset += sizeof(value);
+		return value;
+	};
+	const auto& code = memory.bytecode();
+	ASSERT_GT(code.size(), size_t(1) << 20);
+	ASSERT_EQ(read_size(), code.size());
+	ASSERT_EQ(image.compare(offset, code.size(),
+		std::string(code.begin(), code.end())), 0);
+	offset += code.size();
+	ASSERT_EQ(read_size(), 1u);
+	ASSERT_EQ(read_size(), memory.handlers()[0].begin);
+	ASSERT_EQ(read_size(), memory.handlers()[0].end);
+	ASSERT_EQ(read_size(), memory.handlers()[0].handler);
+	ASSERT_EQ(read_size(), 2u);
+	ASSERT_EQ(read_size(), 5u);
+	ASSERT_EQ(image.substr(offset, 5), "first");
+	offset += 5;
+	ASSERT_EQ(read_size(), 6u);
+	ASSERT_EQ(image.substr(offset), "second");
+
+	// a program that is not closed is not left behind
+	{
+		SpasmImpl::ASM::Bytecode_File file(path);
+		ASSERT_TRUE(file.is_open());
+		file.push_opcode(0);
+	}
+	ASSERT_FALSE(std::ifstream(path));
+}
+
+#if !defined(_WIN32)
+TEST_F(SPASMTest, WriteProgramFileThatCanNotGrow)
+{
+	// the file takes 1 MB when it is opened and can not take 2
+	rlimit limit;
+	ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &limit), 0);
+	const auto saved = limit;
+	limit.rlim_cur = 3 << 19;
+	ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+	const auto handler = std::signal(SIGXFSZ, SIG_IGN);
+
+	const std::string path = "WriteProgramFileThatCanNotGrow.bin";
+	bool closed = true;
+	{
+		SpasmImpl::ASM::Bytecode_File file(path);
+		if (file.is_open())
+		{
+			const std::vector<uint8_t> code((1 << 20) - 64, 0);
+			file.push_bytes(code.data(), code.size());
+			file.push_global(std::string(128, 'g'));
+			closed = file.close();
+		}
+	}
+	std::signal(SIGXFSZ, handler);
+	ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &saved), 0);
+	// the tables do not fit, so the program is not left behind
+	ASSERT_FALSE(closed);
+	ASSERT_FALSE(std::ifstream(path));
+}
+#endif
+
+TEST_F(SPASMTest, LinkModules)
+{
+	const char* main =
+		"push 3"			"\n"
+		"const 1 100"		"\n"
+		"setg base 1"		"\n"
+		"const 2 6"			"\n"
+		"pushr 2"			"\n"
+		"pushr 2"			"\n"
+		"const 3 1"			"\n"
+		"pushr 3"			"\n"
+		"call twice"		"\n"
+		"popr 3"			"\n"
+		"print 3"			"\n"
+		"halt"				"\n"
+		;
+	const char* math =
+		"export twice"		"\n"
+		"label twice"		"\n"
+		"push 2"			"\n"
+		"jmp body"			"\n"
+		"label body"		"\n"
+		"const 2 1"			"\n"
+		"setg seen 2"		"\n"
+		"getg 2 base"		"\n"
+		"add 1 -1 -1"		"\n"
+		"add 1 1 2"			"\n"
+		"ret 1"				"\n"
+		;
+	SpasmImpl::ASM::Object_Module mainModule, compiled, mathModule;
+	CompileModule(main, mainModule);
+	CompileModule(math, compiled);
+	std::stringstream file;
+	compiled.save(file);
+	ASSERT_TRUE(mathModule.load(file));
+
+	{
+		SpasmImpl::ASM::Linker linker;
+		linker.add(mainModule);
+		ASSERT_FALSE(linker.link());
+		ASSERT_EQ(linker.unresolved(), std::vector<std::string>{"twice"});
+	}
+	{
+		SpasmImpl::ASM::Linker linker;
+		linker.add(mainModule);
+		linker.add(mathModule);
+		linker.add(compiled);
+		ASSERT_FALSE(linker.link());
+		ASSERT_EQ(linker.duplicates(), std::vector<std::string>{"twice"});
+	}
+
+	SpasmImpl::ASM::Linker linker;
+	linker.add(mainModule);
+	linker.add(mathModule);
+	ASSERT_TRUE(linker.link());
+	const auto& program = linker.program();
+	ASSERT_EQ(program.globals(),
+		(std::vector<std::string>{"base", "seen"}));
+	VM.SetGlobals(program.globals());
+	Run(program.bytecode());
+	ASSERT_EQ(Output.str(), "112");
+	ASSERT_EQ(VM.GetGlobal(VM.FindGlobal("seen")).get_double(), 1);
+}
+
+TEST_F(SPASMTest, LazyLinkBindsOnFirstCall)
+{
+	const char* main =
+		"push 3"			"\n"
+		"const 1 0"			"\n"
+		"label loop"		"\n"
+		"const 2 6"			"\n"
+		"pushr 2"			"\n"
+		"pushr 2"			"\n"
+		"const 3 1"			"\n"
+		"pushr 3"			"\n"
+		"call twice"		"\n"
+		"popr 3"			"\n"
+		"print 3"			"\n"
+		"const 2 1"			"\n"
+		"add 1 1 2"			"\n"
+		"const 2 2"			"\n"
+		"less 2 1 2"		"\n"
+		"jmpt 2 loop"		"\n"
+		"halt"				"\n"
+		;
+	const char* math =
+		"export twice"		"\n"
+		"label twice"		"\n"
+		"push 1"			"\n"
+		"add 1 -1 -1"		"\n"
+		"ret 1"				"\n"
+		;
+	const char* unused =
+		"export never"		"\n"
+		"label never"		"\n"
+		"ret 0"				"\n"
+		;
+	SpasmImpl::ASM::Object_Module mainModule, mathModule, unusedModule;
+	CompileModule(main, mainModule);
+	CompileModule(math, mathModule);
+	CompileModule(unused, unusedModule);
+
+	SpasmImpl::ASM::Linker linker;
+	linker.add(mainModule);
+	linker.add(mathModule);
+	linker.add(unusedModule);
+	ASSERT_TRUE(linker.link_lazy());
+	ASSERT_FALSE(linker.is_placed(1));
+
+	int binds = 0;
+	VM.SetCallBinder([&](Spasm::PC_t address, Spasm::PC_t position) {
+		++binds;
+		const auto location = linker.bind(address, position);
+		return Spasm::Spasm::CallBinding{location, linker.image(),
+			linker.program().size()};
+	});
+	const auto code = linker.program().bytecode();
+	Run(code);
+	ASSERT_EQ(Output.str(), "1212");
+	ASSERT_EQ(binds, 1);
+	ASSERT_TRUE(linker.is_placed(1));
+	ASSERT_FALSE(linker.is_placed(2));
+	ASSERT_EQ(linker.program().size(),
+		mainModule.size() + mathModule.size());
+
+	// the tasks would run the code that the bind replaces
+	SpasmImpl::ASM::Linker again;
+	again.add(mainModule);
+	again.add(mathModule);
+	ASSERT_TRUE(again.link_lazy());
+	Spasm::TaskPool tasks(1);
+	Spasm::Spasm pooled;
+	pooled.SetTaskPool(tasks);
+	pooled.SetCallBinder([&](Spasm::PC_t address, Spasm::PC_t position) {
+		const auto location = again.bind(address, position);
+		return Spasm::Spasm::CallBinding{location, again.image(),
+			again.program().size()};
+	});
+	const auto lazy = again.program().bytecode();
+	std::ostringstream output;
+	pooled.Initialize(lazy.size(), lazy.data(), Input, output);
+	ASSERT_EQ(pooled.run(), Spasm::Spasm::RunResult::Exception);
+	ASSERT_FALSE(again.is_placed(1));
+}
+
+TEST_F(SPASMTest, TailCallReusesTheFrame)
+{
+	const char* program =
+		"push 3"			"\n"
+		"const 1 0"			"\n"
+		"const 2 1000"		"\n"
+		"const 3 2"			"\n"
+		"pushr 1"			"\n"
+		"pushr 1"			"\n"
+		"pushr 2"			"\n"
+		"pushr 3"			"\n"
+		"call sum"			"\n"
+		"popr 1"			"\n"
+		"print 1"			"\n"
+		"halt"				"\n"
+		"label sum"			"\n"
+		"push 3"			"\n"
+		"const 3 0"			"\n"
+		"equal 1 -1 3"		"\n"
+		"jmpf 1 more"		"\n"
+		"ret -2"			"\n"
+		"label more"		"\n"
+		"add 2 -2 -1"		"\n"
+		"const 3 1"			"\n"
+		"sub 3 -1 3"		"\n"
+		"pushr 2"			"\n"
+		"pushr 3"			"\n"
+		"const 1 2"			"\n"
+		"pushr 1"			"\n"
+		"tcall sum"			"\n"
+		;
+	CompileAndRun(program);
+	ASSERT_EQ(Output.str(), "500500");
+}
+
+TEST_F(SPASMTest, EmbeddingCallsExportsByName)
+{
+	const char* program =
+		"halt"				"\n"
+		"export plus"		"\n"
+		"label plus"			"\n"
+		"push 3"			"\n"
+		"add 1 -2 -1"		"\n"
+		"getg 2 calls"		"\n"
+		"const 3 1"			"\n"
+		"add 2 2 3"			"\n"
+		"setg calls 2"		"\n"
+		"ret 1"				"\n"
+		"export total"		"\n"
+		"label total"			"\n"
+		"push 1"			"\n"
+		"vnew 1 -1"			"\n"
+		"setg last 1"		"\n"
+		"vsum 1 1"			"\n"
+		"ret 1"				"\n"
+		;
+	SpasmImpl::ASM::Bytecode_Memory bytecode;
+	std::istringstream input(program);
+	ASSERT_TRUE(SpasmImpl::ASM::compile(input, bytecode));
+	const auto& code = bytecode.bytecode();
+	auto image = std::make_shared<Spasm::Spasm::ProgramImage>(code.data(), code.size());
+	image->Globals = bytecode.globals();
+	for (const auto& symbol : bytecode.exports())
+	{
+		image->Exports[symbol.name] = symbol.location;
+	}
+
+	Spasm::Spasm first, second;
+	first.Attach(image, Input, Output);
+	second.Attach(image, Input, Output);
+	image.reset();
+
+	Spasm::Value result;
+	ASSERT_EQ(first.Call("plus", {Spasm::Value(2.0), Spasm::Value(3.0)}, result),
+		Spasm::Spasm::RunResult::Success);
+	ASSERT_EQ(result.get_double(), 5);
+	ASSERT_EQ(first.Call("plus", {Spasm::Value(10.0), Spasm::Value(20.0)}, result),
+		Spasm::Spasm::RunResult::Success);
+	ASSERT_EQ(result.get_double(), 30);
+	ASSERT_EQ(second.Call("plus", {Spasm::Value(1.0), Spasm::Value(1.0)}, result),
+		Spasm::Spasm::RunResult::Success);
+	ASSERT_EQ(result.get_double(), 2);
+	ASSERT_EQ(first.GetGlobal(first.FindGlobal("calls")).get_double(), 2);
+	ASSERT_EQ(second.GetGlobal(second.FindGlobal("calls")).get_double(), 1);
+
+	// a call that made heap objects is followed by a full reset
+	ASSERT_EQ(first.Call("total", {Spasm::Value(4.0)}, result),
+		Spasm::Spasm::RunResult::Success);
+	ASSERT_EQ(result.get_double(), 0);
+	const Spasm::Value args[] = {Spasm::Value(4.0), Spasm::Value(5.0)};
+	ASSERT_EQ(first.Call(first.FindExport("plus"), args, 2, result),
+		Spasm::Spasm::RunResult::Success);
+	ASSERT_EQ(result.get_double(), 9);
+	// the globals outlive the full reset too, but not the freed vector
+	ASSERT_EQ(first.GetGlobal(first.FindGlobal("calls")).get_double(), 3);
+	ASSERT_EQ(first.GetGlobal(first.FindGlobal("last")).get_type(),
+		Spasm::ValueType::Number);
+
+	ASSERT_EQ(first.FindExport("missing"), Spasm::Spasm::NoExport);
+	ASSERT_EQ(first.Call("missing", {}, result),
+		Spasm::Spasm::RunResult::Exception);
+	ASSERT_EQ(Output.str(), "");
+}
+
+TEST(VectorKernelsTest, MatchScalar)
+{
+	const auto kernels = SpasmImpl::VectorKernels::Supported();
+	const auto& scalar = *kernels.back();
+	ASSERT_STREQ(scalar.Name, "scalar");
+	for (size_t count : {0, 1, 3, 8, 13, 64})
+	{
+		std::vector<double> a(count), b(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			a[i] = double(i) + 0.5;
+			b[i] = 2.0 - double(i);
+		}
+		std::vector<double> expected(count);
+		scalar.Add(expected.data(), a.data(), b.data(), count);
+		for (auto kernel : kernels)
+		{
+			std::vector<double> out(count);
+			kernel->Add(out.data(), a.data(), b.data(), count);
+			ASSERT_EQ(out, expected) << kernel->Name;
+			kernel->Mul(out.data(), a.data(), b.data(), count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				ASSERT_EQ(out[i], a[i] * b[i]) << kernel->Name;
+			}
+			kernel->Scale(out.data(), a.data(), 3.0, count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				ASSERT_EQ(out[i], a[i] * 3.0) << kernel->Name;
+			}
+			// the sums are exact for these values in any order
+			ASSERT_EQ(kernel->Sum(a.data(), count),
+					  scalar.Sum(a.data(), count)) << kernel->Name;
+			ASSERT_EQ(kernel->Dot(a.data(), b.data(), count),
+					  scalar.Dot(a.data(), b.data(), count)) << kernel->Name;
+		}
+	}
+}
+
+TEST(ChannelTest, MultipleProducers)
+{
+	Spasm::Channel channel(8, Spasm::Channel::Mode::MultipleProducers);
+	const int Count = 10000;
+	auto produce = [&channel](int first) {
+		for (int i = first; i < first + Count; ++i)
+		{
+			channel.Send(Spasm::Value(double(i)));
+		}
+	};
+	std::thread first(produce, 0);
+	std::thread second(produce, Count);
+	double sum = 0;
+	for (int i = 0; i < 2 * Count; ++i)
+	{
+		sum += channel.Receive().get_double();
+	}
+	first.join();
+	second.join();
+	ASSERT_EQ(sum, double(2 * Count - 1) * Count);
+	Spasm::Value value;
+	ASSERT_FALSE(channel.TryReceive(value));
+}
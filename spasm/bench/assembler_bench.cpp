@@ -0,0 +1,40 @@
+#include <sstream>
+
+#include "assembler.hpp"
+#include "bench.hpp"
+
+namespace
+{
+const size_t Count = 200000;
+
+//! A chain of Count labels, each jumped to before and after its definition
+std::string Labels()
+{
+    std::ostringstream source;
+    source << "push 1\n"
+           << "jmp label_0\n";
+    for (size_t i = 0; i < Count; ++i)
+    {
+        source << "label label_" << i << "\n"
+               << "jmp label_" << i + 1 << "\n"
+               << "jmp label_" << (i * 7919) % Count << "\n";
+    }
+    source << "label label_" << Count << "\n"
+           << "halt\n";
+    return source.str();
+}
+
+void Assemble_Labels(SpasmBench::State& state)
+{
+    const auto source = Labels();
+    while (state.Loop())
+    {
+        std::istringstream input(source);
+        SpasmImpl::ASM::Bytecode_Memory bytecode;
+        SpasmImpl::ASM::compile(input, bytecode);
+        SpasmBench::DoNotOptimize(bytecode.bytecode().size());
+    }
+    state.SetItemsPerIteration(Count);
+}
+SPASM_BENCHMARK(Assemble_Labels);
+}  // namespace
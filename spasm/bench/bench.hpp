@@ -0,0 +1,103 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "spasm.hpp"
+
+//! Minimal benchmarking harness for the spasm runtime
+namespace SpasmBench
+{
+//! Controls the timed loop of a single benchmark run
+/*!
+** The benchmark function does its setup and then loops while Loop()
+** returns true. Only the loop is timed.
+*/
+class State
+{
+   public:
+    explicit State(size_t iterations);
+
+    bool Loop()
+    {
+        if (m_Remaining == m_Iterations)
+        {
+            m_Start = Clock::now();
+        }
+        if (m_Remaining-- == 0)
+        {
+            m_Elapsed = Clock::now() - m_Start;
+            return false;
+        }
+        return true;
+    }
+
+    size_t Iterations() const { return m_Iterations; }
+
+    //! Number of items (instructions, calls, bytes) done by one iteration
+    void SetItemsPerIteration(size_t items) { m_Items = items; }
+    size_t ItemsPerIteration() const { return m_Items; }
+
+    //! Extra value reported along with the timings, e.g. a scaling factor
+    void SetCounter(const char* name, double value);
+
+    double ElapsedNs() const;
+
+    struct Counter
+    {
+        std::string Name;
+        double Value;
+    };
+    const std::vector<Counter>& Counters() const { return m_Counters; }
+
+   private:
+    typedef std::chrono::steady_clock Clock;
+
+    size_t m_Iterations;
+    size_t m_Remaining;
+    size_t m_Items = 0;
+    Clock::time_point m_Start;
+    Clock::duration m_Elapsed{};
+    std::vector<Counter> m_Counters;
+};
+
+typedef void (*BenchmarkFunction)(State&);
+
+bool Register(const char* name, BenchmarkFunction function);
+
+//! Assembles spasm source into bytecode
+std::vector<Spasm::byte> Assemble(const std::string& source);
+
+//! Replaces all occurrences of name in source with value
+std::string Substitute(std::string source,
+                       const std::string& name,
+                       const std::string& value);
+
+//! Runs the .spa programs given on the command line, see corpus.cpp
+/*!
+** Reports the median time per run and per executed instruction, writes
+** them to JSON and compares them against a baseline written before.
+*/
+int RunCorpus(int argc, const char* argv[]);
+
+//! Prevents the compiler from optimizing away the computation of value
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    const volatile void* sink = &value;
+    (void)sink;
+#else
+    asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+}  // namespace SpasmBench
+
+#define SPASM_BENCHMARK(function) \
+    static const bool function##_Registered = \
+        ::SpasmBench::Register(#function, function)
+
+#endif  // BENCH_HPP
@@ -0,0 +1,59 @@
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Counts to $COUNT, one backward jump per iteration
+const char* CountingLoop =
+    "push 5"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 3 1"         "\n"
+    "label loop"        "\n"
+    "add 1 1 3"         "\n"
+    "less 4 1 2"        "\n"
+    "jmpt 4 loop"       "\n"
+    "halt"              "\n";
+
+const size_t Count = 1 << 20;
+
+void RunSlices(SpasmBench::State& state, uint64_t slice)
+{
+    const auto bytecode = SpasmBench::Assemble(SpasmBench::Substitute(
+        CountingLoop, "$COUNT", std::to_string(Count)));
+    std::istringstream input;
+    std::ostream output(nullptr);
+    size_t slices = 0;
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        slices = 1;
+        while (vm.run(slice) == Spasm::Spasm::RunResult::Suspended)
+        {
+            ++slices;
+        }
+    }
+    state.SetItemsPerIteration(Count);
+    state.SetCounter("slices", double(slices));
+}
+
+void BudgetUnlimited(SpasmBench::State& state)
+{
+    RunSlices(state, UINT64_MAX);
+}
+SPASM_BENCHMARK(BudgetUnlimited);
+
+void BudgetSlice_1000(SpasmBench::State& state)
+{
+    RunSlices(state, 1000);
+}
+SPASM_BENCHMARK(BudgetSlice_1000);
+
+void BudgetSlice_10(SpasmBench::State& state)
+{
+    RunSlices(state, 10);
+}
+SPASM_BENCHMARK(BudgetSlice_10);
+}  // namespace
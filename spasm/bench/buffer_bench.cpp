@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Sums the $COUNT 32 bit numbers of the file $PATH
+const char* ScanBuffer =
+    "push 8"            "\n"
+    "string 1 '$PATH'"  "\n"
+    "bopen 2 1"         "\n"
+    "const 3 0"         "\n"
+    "const 4 0"         "\n"
+    "const 5 4"         "\n"
+    "bsize 6 2"         "\n"
+    "label loop"        "\n"
+    "bget 7 2 4 u32"    "\n"
+    "add 3 3 7"         "\n"
+    "add 4 4 5"         "\n"
+    "less 7 4 6"        "\n"
+    "jmpt 7 loop"       "\n"
+    "print 3"           "\n"
+    "halt"              "\n";
+
+//! Sums the $COUNT numbers of the input
+const char* ReadInput =
+    "push 6"            "\n"
+    "const 1 0"         "\n"
+    "const 2 0"         "\n"
+    "const 3 1"         "\n"
+    "const 4 $COUNT"    "\n"
+    "label loop"        "\n"
+    "read 5"            "\n"
+    "add 1 1 5"         "\n"
+    "add 2 2 3"         "\n"
+    "less 5 2 4"        "\n"
+    "jmpt 5 loop"       "\n"
+    "print 1"           "\n"
+    "halt"              "\n";
+
+const size_t Count = 1 << 20;
+const char* Path = "spasm_bench.bin";
+
+void Buffer_ScanMappedFile(SpasmBench::State& state)
+{
+    {
+        std::ofstream file(Path, std::ios::binary);
+        for (uint32_t i = 0; i < Count; ++i)
+        {
+            file.write(reinterpret_cast<const char*>(&i), sizeof(i));
+        }
+    }
+    const auto bytecode =
+        SpasmBench::Assemble(SpasmBench::Substitute(ScanBuffer, "$PATH", Path));
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+    state.SetItemsPerIteration(Count);
+    std::remove(Path);
+}
+SPASM_BENCHMARK(Buffer_ScanMappedFile);
+
+void Buffer_ReadStream(SpasmBench::State& state)
+{
+    std::ostringstream numbers;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        numbers << i << ' ';
+    }
+    const auto text = numbers.str();
+    const auto bytecode = SpasmBench::Assemble(
+        SpasmBench::Substitute(ReadInput, "$COUNT", std::to_string(Count)));
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        std::istringstream input(text);
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+    state.SetItemsPerIteration(Count);
+}
+SPASM_BENCHMARK(Buffer_ReadStream);
+}  // namespace
@@ -0,0 +1,145 @@
+#include <sstream>
+#include <thread>
+
+#include "bench.hpp"
+
+namespace
+{
+const size_t Count = 1 << 20;
+const size_t Capacity = 1 << 10;
+
+//! Sends 0 .. $COUNT - 1 on the channel 0
+const char* Producer =
+    "push 6"            "\n"
+    "channel 1 0"       "\n"
+    "const 2 0"         "\n"
+    "const 3 $COUNT"    "\n"
+    "const 4 1"         "\n"
+    "label loop"        "\n"
+    "send 1 2"          "\n"
+    "add 2 2 4"         "\n"
+    "less 5 2 3"        "\n"
+    "jmpt 5 loop"       "\n"
+    "halt"              "\n";
+
+//! Receives $COUNT values from the channel 0 and prints their sum
+const char* Consumer =
+    "push 8"            "\n"
+    "channel 1 0"       "\n"
+    "const 2 0"         "\n"
+    "const 3 $COUNT"    "\n"
+    "const 4 1"         "\n"
+    "const 6 0"         "\n"
+    "label loop"        "\n"
+    "recv 5 1"          "\n"
+    "add 6 6 5"         "\n"
+    "add 2 2 4"         "\n"
+    "less 7 2 3"        "\n"
+    "jmpt 7 loop"       "\n"
+    "print 6"           "\n"
+    "halt"              "\n";
+
+void RunNative(SpasmBench::State& state,
+               Spasm::Channel::Mode mode,
+               size_t producers,
+               size_t batch)
+{
+    while (state.Loop())
+    {
+        Spasm::Channel channel(Capacity, mode);
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; ++p)
+        {
+            threads.emplace_back([&channel, producers, batch] {
+                std::vector<Spasm::Value> values(batch);
+                for (size_t i = 0; i < Count / producers; i += batch)
+                {
+                    for (size_t j = 0; j < batch; ++j)
+                    {
+                        values[j] = Spasm::Value(double(i + j));
+                    }
+                    size_t sent = 0;
+                    while (sent < batch)
+                    {
+                        sent += channel.TrySendBatch(values.data() + sent,
+                                                     batch - sent);
+                        if (sent < batch)
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                }
+            });
+        }
+        std::vector<Spasm::Value> values(batch);
+        double sum = 0;
+        for (size_t received = 0; received < Count;)
+        {
+            const auto count = channel.TryReceiveBatch(values.data(), batch);
+            if (!count)
+            {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < count; ++i)
+            {
+                sum += values[i].get_double();
+            }
+            received += count;
+        }
+        SpasmBench::DoNotOptimize(sum);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+void Channel_SPSC(SpasmBench::State& state)
+{
+    RunNative(state, Spasm::Channel::Mode::SingleProducer, 1, 1);
+}
+SPASM_BENCHMARK(Channel_SPSC);
+
+void Channel_SPSC_Batch64(SpasmBench::State& state)
+{
+    RunNative(state, Spasm::Channel::Mode::SingleProducer, 1, 64);
+}
+SPASM_BENCHMARK(Channel_SPSC_Batch64);
+
+void Channel_MPSC_2Producers(SpasmBench::State& state)
+{
+    RunNative(state, Spasm::Channel::Mode::MultipleProducers, 2, 1);
+}
+SPASM_BENCHMARK(Channel_MPSC_2Producers);
+
+//! A producer and a consumer machine on different threads
+void Channel_Machines(SpasmBench::State& state)
+{
+    const auto count = std::to_string(Count);
+    const auto producer =
+        SpasmBench::Assemble(SpasmBench::Substitute(Producer, "$COUNT", count));
+    const auto consumer =
+        SpasmBench::Assemble(SpasmBench::Substitute(Consumer, "$COUNT", count));
+
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Channel channel(Capacity);
+        std::thread sender([&] {
+            Spasm::Spasm vm;
+            vm.Initialize(producer.size(), producer.data(), input, output);
+            vm.AddChannel(channel);
+            vm.run();
+        });
+        Spasm::Spasm vm;
+        vm.Initialize(consumer.size(), consumer.data(), input, output);
+        vm.AddChannel(channel);
+        vm.run();
+        sender.join();
+    }
+    state.SetItemsPerIteration(Count);
+}
+SPASM_BENCHMARK(Channel_Machines);
+}  // namespace
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Runs the corpus with each value representation of the machine.
+#
+# usage: compare_values.sh [output directory]
+#
+# spasm_bench is rebuilt in release for every SPASM_VALUE_REPRESENTATION,
+# the results go to <output directory>/<representation>.json and the ns per
+# instruction of all representations are printed side by side.
+
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+solution="$here/../../JSImpl/solution"
+bin="$here/../../JSImpl/build/bin/Release"
+out=${1:-values}
+mkdir -p "$out"
+out=$(cd "$out" && pwd)
+
+for representation in 1:nanbox 2:tagged 3:union; do
+    number=${representation%%:*}
+    name=${representation#*:}
+    (
+        cd "$solution"
+        make config=release64 clean > /dev/null
+        make config=release64 sprt spasm_lib spasm_bench \
+            CPPFLAGS="-DSPASM_VALUE_REPRESENTATION=$number" > /dev/null
+    )
+    cp "$bin/spasm_bench" "$out/spasm_bench_$name"
+    "$out/spasm_bench_$name" --corpus "$here"/corpus/*.spa \
+        --json "$out/$name.json" > /dev/null
+done
+
+# leave the default representation in the build directory
+(cd "$solution" && make config=release64 clean > /dev/null &&
+    make config=release64 sprt spasm_lib spasm_bench > /dev/null)
+
+printf '%-20s %12s %12s %12s   (ns/instr)\n' program nanbox tagged union
+for json in "$out"/nanbox.json; do
+    grep '"name"' "$json" | sed 's/.*"name": "\([^"]*\)".*/\1/'
+done | while read -r program; do
+    row=$(printf '%-20s' "$program")
+    for name in nanbox tagged union; do
+        value=$(grep "\"name\": \"$program\"" "$out/$name.json" |
+            sed 's/.*"ns_per_instruction": \([0-9.]*\).*/\1/')
+        row="$row $(printf '%12s' "$value")"
+    done
+    echo "$row"
+done
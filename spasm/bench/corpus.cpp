@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "assembler.hpp"
+#include "bench.hpp"
+
+namespace SpasmBench
+{
+namespace
+{
+//! Swallows the output of the programs, so printing is measured too
+class NullBuffer : public std::streambuf
+{
+   protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override
+    {
+        return count;
+    }
+};
+
+struct CorpusResult
+{
+    std::string Name;
+    uint64_t Instructions;
+    size_t Runs;
+    double MedianNs;
+    double NsPerInstruction;
+};
+
+struct CorpusOptions
+{
+    std::vector<std::string> Programs;
+    size_t Runs = 21;
+    std::string JsonPath;
+    std::string BaselinePath;
+    //! Slowdown of the median allowed before a regression is reported
+    double Threshold = 0.05;
+};
+
+std::string ProgramName(const std::string& path)
+{
+    auto begin = path.find_last_of("/\\");
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    const auto end = path.rfind('.');
+    return path.substr(begin, end > begin ? end - begin : std::string::npos);
+}
+
+bool RunProgram(const std::string& path,
+                size_t runs,
+                CorpusResult& result)
+{
+    std::ifstream source(path);
+    SpasmImpl::ASM::Bytecode_Memory bytecode;
+    if (!source || !SpasmImpl::ASM::compile(source, bytecode))
+    {
+        std::cerr << path << ": could not compile" << std::endl;
+        return false;
+    }
+    const auto& code = bytecode.bytecode();
+
+    std::istringstream input;
+    NullBuffer sink;
+    std::ostream output(&sink);
+    // the first run warms up and counts the instructions
+    uint64_t instructions = 0;
+    std::vector<double> times;
+    for (size_t i = 0; i <= runs; ++i)
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(code.size(), code.data(), input, output);
+        const auto start = std::chrono::steady_clock::now();
+        const auto status = i == 0 ? vm.RunCounted() : vm.run();
+        if (status != Spasm::Spasm::RunResult::Success)
+        {
+            std::cerr << path << ": failed to run" << std::endl;
+            return false;
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0)
+        {
+            instructions = vm.InstructionCount();
+            continue;
+        }
+        times.push_back(double(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                .count()));
+    }
+    std::sort(times.begin(), times.end());
+
+    result.Name = ProgramName(path);
+    result.Instructions = instructions;
+    result.Runs = runs;
+    result.MedianNs = times[times.size() / 2];
+    result.NsPerInstruction =
+        instructions ? result.MedianNs / double(instructions) : 0.0;
+    return true;
+}
+
+void WriteJson(std::ostream& output, const std::vector<CorpusResult>& results)
+{
+    output << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto& result = results[i];
+        output << (i ? "," : "") << "\n    {\"name\": \"" << result.Name
+               << "\", \"instructions\": " << result.Instructions
+               << ", \"runs\": " << result.Runs << std::fixed
+               << std::setprecision(1) << ", \"median_ns\": " << result.MedianNs
+               << std::setprecision(3)
+               << ", \"ns_per_instruction\": " << result.NsPerInstruction
+               << "}";
+    }
+    output << "\n  ]\n}\n";
+}
+
+//! Reads the medians from a file written by WriteJson
+/*!
+** Only the format of WriteJson is understood: every benchmark is an object
+** on its own line with its name first.
+*/
+std::vector<std::pair<std::string, double>> ReadBaseline(std::istream& input)
+{
+    std::vector<std::pair<std::string, double>> medians;
+    std::string line;
+    const std::string nameKey = "\"name\": \"";
+    const std::string medianKey = "\"median_ns\": ";
+    while (std::getline(input, line))
+    {
+        const auto name = line.find(nameKey);
+        const auto median = line.find(medianKey);
+        if (name == std::string::npos || median == std::string::npos)
+        {
+            continue;
+        }
+        const auto begin = name + nameKey.size();
+        medians.emplace_back(
+            line.substr(begin, line.find('"', begin) - begin),
+            std::strtod(line.c_str() + median + medianKey.size(), nullptr));
+    }
+    return medians;
+}
+
+bool ParseOptions(int argc, const char* argv[], CorpusOptions& options)
+{
+    for (int i = 0; i < argc; ++i)
+    {
+        const auto hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--runs") && hasValue)
+        {
+            options.Runs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (!std::strcmp(argv[i], "--json") && hasValue)
+        {
+            options.JsonPath = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--compare") && hasValue)
+        {
+            options.BaselinePath = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--threshold") && hasValue)
+        {
+            options.Threshold = std::atof(argv[++i]) / 100;
+        }
+        else if (!std::strncmp(argv[i], "--", 2))
+        {
+            return false;
+        }
+        else
+        {
+            options.Programs.push_back(argv[i]);
+        }
+    }
+    return !options.Programs.empty();
+}
+}  // namespace
+
+int RunCorpus(int argc, const char* argv[])
+{
+    CorpusOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        std::cerr << "usage: spasm_bench --corpus program.spa... [--runs N]"
+                     " [--json results.json] [--compare baseline.json]"
+                     " [--threshold percent]"
+                  << std::endl;
+        return 2;
+    }
+
+    std::vector<CorpusResult> results;
+    for (const auto& path : options.Programs)
+    {
+        CorpusResult result;
+        if (!RunProgram(path, options.Runs, result))
+        {
+            return 1;
+        }
+        std::cout << std::left << std::setw(40) << result.Name << std::right
+                  << std::setw(16) << std::fixed << std::setprecision(1)
+                  << result.MedianNs << " ns/run" << std::setw(12)
+                  << std::setprecision(3) << result.NsPerInstruction
+                  << " ns/instr  instructions=" << result.Instructions
+                  << std::endl;
+        results.push_back(result);
+    }
+
+    if (!options.JsonPath.empty())
+    {
+        std::ofstream json(options.JsonPath);
+        WriteJson(json, results);
+    }
+
+    if (options.BaselinePath.empty())
+    {
+        return 0;
+    }
+    std::ifstream baselineFile(options.BaselinePath);
+    if (!baselineFile)
+    {
+        std::cerr << options.BaselinePath << ": no baseline" << std::endl;
+        return 2;
+    }
+    int regressions = 0;
+    for (const auto& baseline : ReadBaseline(baselineFile))
+    {
+        auto result = std::find_if(
+            results.begin(), results.end(),
+            [&baseline](const CorpusResult& r) {
+                return r.Name == baseline.first;
+            });
+        if (result == results.end() || baseline.second <= 0)
+        {
+            continue;
+        }
+        const auto change = result->MedianNs / baseline.second - 1;
+        if (change > options.Threshold)
+        {
+            std::cout << "REGRESSION " << result->Name << ": "
+                      << std::setprecision(1) << change * 100 << "% slower"
+                      << std::endl;
+            ++regressions;
+        }
+    }
+    return regressions ? 1 : 0;
+}
+}  // namespace SpasmBench
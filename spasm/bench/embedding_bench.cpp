@@ -0,0 +1,89 @@
+#include <sstream>
+
+#include "assembler.hpp"
+#include "bench.hpp"
+
+namespace
+{
+//! A program with count functions, the host calls the last one
+std::string Program(size_t count)
+{
+    std::ostringstream source;
+    source << "halt\n";
+    for (size_t i = 0; i < count; ++i)
+    {
+        source << "export f" << i << "\n"
+               << "label f" << i << "\n"
+               << "push 2\n"
+               << "const 2 " << i << "\n"
+               << "add 1 -2 -1\n"
+               << "add 1 1 2\n"
+               << "ret 1\n";
+    }
+    return source.str();
+}
+
+struct Image
+{
+    explicit Image(size_t count)
+    {
+        std::istringstream input(Program(count));
+        SpasmImpl::ASM::compile(input, Bytecode);
+        const auto& code = Bytecode.bytecode();
+        Shared = std::make_shared<Spasm::Spasm::ProgramImage>(code.data(),
+                                                             code.size());
+        for (const auto& symbol : Bytecode.exports())
+        {
+            Shared->Exports[symbol.name] = symbol.location;
+        }
+        Function = "f" + std::to_string(count - 1);
+    }
+
+    SpasmImpl::ASM::Bytecode_Memory Bytecode;
+    std::shared_ptr<Spasm::Spasm::ProgramImage> Shared;
+    std::string Function;
+};
+
+const size_t Functions = 256;
+
+//! A new machine with a copy of the program for each request
+void Embed_NewMachinePerRequest(SpasmBench::State& state)
+{
+    const Image image(Functions);
+    const auto& code = image.Bytecode.bytecode();
+    std::istringstream input;
+    std::ostream output(nullptr);
+    const std::vector<Spasm::Value> args{Spasm::Value(1.0), Spasm::Value(2.0)};
+    const auto address = image.Shared->Exports.at(image.Function);
+    Spasm::Value result;
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Attach(std::make_shared<Spasm::Spasm::ProgramImage>(code.data(),
+                                                               code.size()),
+                  input, output);
+        vm.Call(address, args.data(), args.size(), result);
+        SpasmBench::DoNotOptimize(result);
+    }
+    state.SetCounter("KB", double(code.size()) / 1024);
+}
+SPASM_BENCHMARK(Embed_NewMachinePerRequest);
+
+//! One machine attached to the shared image serves all requests
+void Embed_CallPerRequest(SpasmBench::State& state)
+{
+    const Image image(Functions);
+    std::istringstream input;
+    std::ostream output(nullptr);
+    Spasm::Spasm vm;
+    vm.Attach(image.Shared, input, output);
+    const std::vector<Spasm::Value> args{Spasm::Value(1.0), Spasm::Value(2.0)};
+    Spasm::Value result;
+    while (state.Loop())
+    {
+        vm.Call(image.Function, args, result);
+        SpasmBench::DoNotOptimize(result);
+    }
+}
+SPASM_BENCHMARK(Embed_CallPerRequest);
+}  // namespace
@@ -0,0 +1,147 @@
+#include <sstream>
+
+#include "assembler.hpp"
+#include "bench.hpp"
+
+namespace
+{
+//! Counts to $COUNT, the body of the loop is in a try range or not
+const char* CountLoop =
+    "push 5"                        "\n"
+    "try begin end handler"         "\n"
+    "const 1 0"                     "\n"
+    "const 2 $COUNT"                "\n"
+    "const 3 1"                     "\n"
+    "label loop"                    "\n"
+    "$BEGIN"                        "\n"
+    "add 1 1 3"                     "\n"
+    "$END"                          "\n"
+    "less 4 1 2"                    "\n"
+    "jmpt 4 loop"                   "\n"
+    "halt"                          "\n"
+    "label handler"                 "\n"
+    "catch 5"                       "\n"
+    "halt"                          "\n"
+    "$LABELS"                       "\n";
+
+//! Throws and catches in every iteration, the thrower is $DEPTH calls deep
+const char* ThrowLoop =
+    "push 5"                        "\n"
+    "try begin end handler"         "\n"
+    "const 1 0"                     "\n"
+    "const 2 $COUNT"                "\n"
+    "const 3 1"                     "\n"
+    "const 4 $DEPTH"                "\n"
+    "label loop"                    "\n"
+    "label begin"                   "\n"
+    "pushr 5"                       "\n"
+    "pushr 4"                       "\n"
+    "pushr 3"                       "\n"
+    "call thrower"                  "\n"
+    "popr 5"                        "\n"
+    "label end"                     "\n"
+    "label handler"                 "\n"
+    "add 1 1 3"                     "\n"
+    "less 5 1 2"                    "\n"
+    "jmpt 5 loop"                   "\n"
+    "halt"                          "\n"
+    "label thrower"                 "\n"
+    "push 3"                        "\n"
+    "const 1 1"                     "\n"
+    "less 2 -1 1"                   "\n"
+    "jmpt 2 bottom"                 "\n"
+    "sub 3 -1 1"                    "\n"
+    "pushr 2"                       "\n"
+    "pushr 3"                       "\n"
+    "pushr 1"                       "\n"
+    "call thrower"                  "\n"
+    "popr 2"                        "\n"
+    "ret 2"                         "\n"
+    "label bottom"                  "\n"
+    "throw -1"                      "\n";
+
+struct Program
+{
+    std::vector<Spasm::byte> Code;
+    Spasm::Spasm::ExceptionHandlers Handlers;
+};
+
+Program Assemble(const std::string& source)
+{
+    SpasmImpl::ASM::Bytecode_Memory bytecode;
+    std::istringstream input(source);
+    SpasmImpl::ASM::compile(input, bytecode);
+    Program program{bytecode.bytecode(), {}};
+    for (const auto& handler : bytecode.handlers())
+    {
+        program.Handlers.push_back(
+            {handler.begin, handler.end, handler.handler});
+    }
+    return program;
+}
+
+void RunProgram(SpasmBench::State& state, const Program& program)
+{
+    std::istringstream input;
+    std::ostream output(nullptr);
+    Spasm::Spasm vm;
+    vm.SetExceptionHandlers(program.Handlers);
+    while (state.Loop())
+    {
+        vm.Initialize(program.Code.size(), program.Code.data(), input,
+                      output);
+        vm.run();
+    }
+}
+
+const size_t Count = 100000;
+
+//! The same loop without a try range, for reference
+void TryLoop_None(SpasmBench::State& state)
+{
+    auto source = SpasmBench::Substitute(CountLoop, "$COUNT",
+                                         std::to_string(Count));
+    source = SpasmBench::Substitute(source, "$BEGIN", "");
+    source = SpasmBench::Substitute(source, "$END", "");
+    source = SpasmBench::Substitute(source, "$LABELS",
+                                    "label begin\nlabel end");
+    RunProgram(state, Assemble(source));
+    state.SetItemsPerIteration(Count);
+}
+SPASM_BENCHMARK(TryLoop_None);
+
+//! Entering and leaving the try range in every iteration costs nothing
+void TryLoop_InLoop(SpasmBench::State& state)
+{
+    auto source = SpasmBench::Substitute(CountLoop, "$COUNT",
+                                         std::to_string(Count));
+    source = SpasmBench::Substitute(source, "$BEGIN", "label begin");
+    source = SpasmBench::Substitute(source, "$END", "label end");
+    source = SpasmBench::Substitute(source, "$LABELS", "");
+    RunProgram(state, Assemble(source));
+    state.SetItemsPerIteration(Count);
+}
+SPASM_BENCHMARK(TryLoop_InLoop);
+
+void RunThrowLoop(SpasmBench::State& state, size_t depth)
+{
+    const size_t count = 10000;
+    auto source = SpasmBench::Substitute(ThrowLoop, "$COUNT",
+                                         std::to_string(count));
+    source = SpasmBench::Substitute(source, "$DEPTH", std::to_string(depth));
+    RunProgram(state, Assemble(source));
+    state.SetItemsPerIteration(count);
+}
+
+void ThrowCatch_Depth1(SpasmBench::State& state)
+{
+    RunThrowLoop(state, 1);
+}
+SPASM_BENCHMARK(ThrowCatch_Depth1);
+
+void ThrowCatch_Depth16(SpasmBench::State& state)
+{
+    RunThrowLoop(state, 16);
+}
+SPASM_BENCHMARK(ThrowCatch_Depth16);
+}  // namespace
@@ -0,0 +1,80 @@
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! The root fiber and a worker yield to each other $COUNT times each
+const char* PingPong =
+    "push 6"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 3 1"         "\n"
+    "spawn 4 worker 2"  "\n"
+    "label loop"        "\n"
+    "yield 1"           "\n"
+    "add 1 1 3"         "\n"
+    "less 5 1 2"        "\n"
+    "jmpt 5 loop"       "\n"
+    "halt"              "\n"
+    "label worker"      "\n"
+    "push 4"            "\n"
+    "const 1 0"         "\n"
+    "const 2 1"         "\n"
+    "label wloop"       "\n"
+    "yield 1"           "\n"
+    "add 1 1 2"         "\n"
+    "less 3 1 0"        "\n"
+    "jmpt 3 wloop"      "\n"
+    "ret 1"             "\n";
+
+//! Spawns $COUNT fibers and lets each of them run once, so they are all
+//! alive at the same time
+const char* SpawnMany =
+    "push 6"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 3 1"         "\n"
+    "label loop"        "\n"
+    "spawn 4 worker 1"  "\n"
+    "add 1 1 3"         "\n"
+    "less 5 1 2"        "\n"
+    "jmpt 5 loop"       "\n"
+    "yield 1"           "\n"
+    "halt"              "\n"
+    "label worker"      "\n"
+    "yield 0"           "\n"
+    "ret 0"             "\n";
+
+void RunProgram(SpasmBench::State& state, const char* program, size_t count)
+{
+    const auto bytecode = SpasmBench::Assemble(
+        SpasmBench::Substitute(program, "$COUNT", std::to_string(count)));
+
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+}
+
+void Fiber_Switch(SpasmBench::State& state)
+{
+    const size_t count = 1 << 20;
+    RunProgram(state, PingPong, count);
+    state.SetItemsPerIteration(2 * count);
+}
+SPASM_BENCHMARK(Fiber_Switch);
+
+void Fiber_Spawn100k(SpasmBench::State& state)
+{
+    const size_t count = 100000;
+    RunProgram(state, SpawnMany, count);
+    state.SetItemsPerIteration(count);
+    state.SetCounter("live", double(count));
+}
+SPASM_BENCHMARK(Fiber_Spawn100k);
+}  // namespace
@@ -0,0 +1,103 @@
+#include <deque>
+#include <sstream>
+
+#include "assembler.hpp"
+#include "bench.hpp"
+#include "linker.hpp"
+
+namespace
+{
+//! Calls the function of the first library module
+const char* Entry =
+    "push 3"        "\n"
+    "const 2 1"     "\n"
+    "pushr 2"       "\n"
+    "pushr 2"       "\n"
+    "pushr 2"       "\n"
+    "call f0"       "\n"
+    "popr 3"        "\n"
+    "halt"          "\n";
+
+//! A library module with a single function f<index> of about 500 bytes
+std::string Library(size_t index)
+{
+    std::ostringstream source;
+    source << "export f" << index << "\n"
+           << "label f" << index << "\n"
+           << "push 2\n";
+    for (int i = 0; i < 32; ++i)
+    {
+        source << "const 2 " << i << "\n"
+               << "add 1 1 2\n"
+               << "setg g" << index % 8 << " 1\n";
+    }
+    source << "ret 1\n";
+    return source.str();
+}
+
+//! The entry and count library modules, assembled once
+struct Modules
+{
+    explicit Modules(size_t count)
+    {
+        Compile(Entry);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Compile(Library(i));
+        }
+    }
+
+    void Compile(const std::string& source)
+    {
+        std::istringstream input(source);
+        All.emplace_back();
+        SpasmImpl::ASM::compile(input, All.back());
+    }
+
+    std::deque<SpasmImpl::ASM::Object_Module> All;
+};
+
+//! Links the modules and runs the program that uses only one of them
+void RunLinked(SpasmBench::State& state, size_t count, bool lazy)
+{
+    const Modules modules(count);
+    std::istringstream input;
+    std::ostream output(nullptr);
+    size_t placed = 0;
+    while (state.Loop())
+    {
+        SpasmImpl::ASM::Linker linker;
+        for (const auto& module : modules.All)
+        {
+            linker.add(module);
+        }
+        lazy ? linker.link_lazy() : linker.link();
+        const auto& code = linker.program().bytecode();
+
+        Spasm::Spasm vm;
+        vm.Initialize(code.size(), code.data(), input, output);
+        vm.SetGlobals(linker.program().globals());
+        vm.SetCallBinder([&linker](Spasm::PC_t address,
+                                   Spasm::PC_t position) {
+            const auto location = linker.bind(address, position);
+            return Spasm::Spasm::CallBinding{location, linker.image(),
+                                             linker.program().size()};
+        });
+        vm.run();
+        placed = linker.program().size();
+    }
+    state.SetCounter("KB", double(placed) / 1024);
+}
+
+void Link_Eager_256Modules(SpasmBench::State& state)
+{
+    RunLinked(state, 256, false);
+}
+SPASM_BENCHMARK(Link_Eager_256Modules);
+
+void Link_Lazy_256Modules(SpasmBench::State& state)
+{
+    RunLinked(state, 256, true);
+}
+SPASM_BENCHMARK(Link_Lazy_256Modules);
+}  // namespace
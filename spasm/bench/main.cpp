@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "assembler.hpp"
+#include "bench.hpp"
+
+namespace SpasmBench
+{
+State::State(size_t iterations)
+    : m_Iterations(iterations), m_Remaining(iterations)
+{
+}
+
+void State::SetCounter(const char* name, double value)
+{
+    for (auto& counter : m_Counters)
+    {
+        if (counter.Name == name)
+        {
+            counter.Value = value;
+            return;
+        }
+    }
+    m_Counters.push_back(Counter{name, value});
+}
+
+double State::ElapsedNs() const
+{
+    return double(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(m_Elapsed)
+            .count());
+}
+
+struct Benchmark
+{
+    const char* Name;
+    BenchmarkFunction Function;
+};
+
+static std::vector<Benchmark>& Benchmarks()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+bool Register(const char* name, BenchmarkFunction function)
+{
+    Benchmarks().push_back(Benchmark{name, function});
+    return true;
+}
+
+std::vector<Spasm::byte> Assemble(const std::string& source)
+{
+    SpasmImpl::ASM::Bytecode_Memory bytecode;
+    std::istringstream input(source);
+    SpasmImpl::ASM::compile(input, bytecode);
+    return bytecode.bytecode();
+}
+
+std::string Substitute(std::string source,
+                       const std::string& name,
+                       const std::string& value)
+{
+    for (auto position = source.find(name); position != std::string::npos;
+         position = source.find(name, position + value.size()))
+    {
+        source.replace(position, name.size(), value);
+    }
+    return source;
+}
+
+//! Minimal duration of a single timed run
+static const double MinRunNs = 1e8;
+//! Number of timed runs, the median is reported
+static const int Repetitions = 5;
+
+static void RunBenchmark(const Benchmark& benchmark)
+{
+    size_t iterations = 1;
+    for (;;)
+    {
+        State state(iterations);
+        benchmark.Function(state);
+        if (state.ElapsedNs() >= MinRunNs || iterations >= (1u << 30))
+        {
+            break;
+        }
+        const auto scale = state.ElapsedNs() > 0
+                               ? MinRunNs / state.ElapsedNs() * 1.2
+                               : 10.0;
+        iterations = size_t(double(iterations) * std::min(scale, 10.0)) + 1;
+    }
+
+    std::vector<double> runs;
+    size_t items = 0;
+    std::vector<State::Counter> counters;
+    for (int i = 0; i < Repetitions; ++i)
+    {
+        State state(iterations);
+        benchmark.Function(state);
+        runs.push_back(state.ElapsedNs() / double(iterations));
+        items = state.ItemsPerIteration();
+        counters = state.Counters();
+    }
+    std::sort(runs.begin(), runs.end());
+    const auto median = runs[runs.size() / 2];
+
+    std::cout << std::left << std::setw(40) << benchmark.Name << std::right
+              << std::setw(16) << std::fixed << std::setprecision(1)
+              << median << " ns/iter";
+    if (items)
+    {
+        std::cout << std::setw(12) << std::setprecision(3)
+                  << median / double(items) << " ns/item";
+    }
+    for (const auto& counter : counters)
+    {
+        std::cout << "  " << counter.Name << '=' << std::setprecision(3)
+                  << counter.Value;
+    }
+    std::cout << std::endl;
+}
+}  // namespace SpasmBench
+
+int main(int argc, const char* argv[])
+{
+    if (argc > 1 && !std::strcmp(argv[1], "--corpus"))
+    {
+        return SpasmBench::RunCorpus(argc - 2, argv + 2);
+    }
+    const char* filter = argc > 1 ? argv[1] : "";
+    for (const auto& benchmark : SpasmBench::Benchmarks())
+    {
+        if (std::strstr(benchmark.Name, filter))
+        {
+            SpasmBench::RunBenchmark(benchmark);
+        }
+    }
+    return 0;
+}
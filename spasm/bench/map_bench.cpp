@@ -0,0 +1,153 @@
+#include <sstream>
+#include <unordered_map>
+
+#include "bench.hpp"
+#include "spasm_impl.hpp"
+#include "value_map.hpp"
+
+namespace
+{
+using SpasmImpl::data_t;
+
+typedef SpasmImpl::ValueMap::Table FlatMap;
+typedef std::unordered_map<data_t,
+                           data_t,
+                           SpasmImpl::ValueMapHash,
+                           SpasmImpl::ValueMapEqual>
+    NodeMap;
+
+const size_t Count = 1 << 16;
+
+std::vector<data_t> NumberKeys()
+{
+    std::vector<data_t> keys;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        // spread the keys, so they are not consecutive integers
+        keys.push_back(data_t(double((i * 2654435761u) % (Count * 16))));
+    }
+    return keys;
+}
+
+//! The keys as the machine gives them - pointers to interned strings
+std::vector<data_t> StringKeys(SpasmImpl::StringTable& strings)
+{
+    std::vector<data_t> keys;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        keys.push_back(data_t(Spasm::ValueType::String,
+                              (void*)strings.Get("key number " +
+                                                 std::to_string(i))));
+    }
+    return keys;
+}
+
+template <typename Map>
+void Insert(SpasmBench::State& state, const std::vector<data_t>& keys)
+{
+    while (state.Loop())
+    {
+        Map map;
+        for (const auto& key : keys)
+        {
+            map[key] = key;
+        }
+        SpasmBench::DoNotOptimize(map.size());
+    }
+    state.SetItemsPerIteration(keys.size());
+}
+
+template <typename Map>
+void Lookup(SpasmBench::State& state, const std::vector<data_t>& keys)
+{
+    Map map;
+    for (const auto& key : keys)
+    {
+        map[key] = key;
+    }
+    while (state.Loop())
+    {
+        size_t found = 0;
+        for (auto it = keys.rbegin(); it != keys.rend(); ++it)
+        {
+            found += map.find(*it) != map.end();
+        }
+        SpasmBench::DoNotOptimize(found);
+    }
+    state.SetItemsPerIteration(keys.size());
+}
+
+void Map_InsertNumbers_Flat(SpasmBench::State& state)
+{
+    Insert<FlatMap>(state, NumberKeys());
+}
+SPASM_BENCHMARK(Map_InsertNumbers_Flat);
+
+void Map_InsertNumbers_Unordered(SpasmBench::State& state)
+{
+    Insert<NodeMap>(state, NumberKeys());
+}
+SPASM_BENCHMARK(Map_InsertNumbers_Unordered);
+
+void Map_LookupNumbers_Flat(SpasmBench::State& state)
+{
+    Lookup<FlatMap>(state, NumberKeys());
+}
+SPASM_BENCHMARK(Map_LookupNumbers_Flat);
+
+void Map_LookupNumbers_Unordered(SpasmBench::State& state)
+{
+    Lookup<NodeMap>(state, NumberKeys());
+}
+SPASM_BENCHMARK(Map_LookupNumbers_Unordered);
+
+void Map_LookupStrings_Flat(SpasmBench::State& state)
+{
+    SpasmImpl::StringTable strings;
+    Lookup<FlatMap>(state, StringKeys(strings));
+}
+SPASM_BENCHMARK(Map_LookupStrings_Flat);
+
+void Map_LookupStrings_Unordered(SpasmBench::State& state)
+{
+    SpasmImpl::StringTable strings;
+    Lookup<NodeMap>(state, StringKeys(strings));
+}
+SPASM_BENCHMARK(Map_LookupStrings_Unordered);
+
+//! Sets and gets $COUNT number keys with the map opcodes
+const char* MapLoop =
+    "push 7"            "\n"
+    "mnew 1"            "\n"
+    "const 2 0"         "\n"
+    "const 3 $COUNT"    "\n"
+    "const 4 1"         "\n"
+    "label fill"        "\n"
+    "mset 1 2 2"        "\n"
+    "add 2 2 4"         "\n"
+    "less 5 2 3"        "\n"
+    "jmpt 5 fill"       "\n"
+    "const 2 0"         "\n"
+    "label lookup"      "\n"
+    "mget 6 1 2"        "\n"
+    "add 2 2 4"         "\n"
+    "less 5 2 3"        "\n"
+    "jmpt 5 lookup"     "\n"
+    "halt"              "\n";
+
+void Map_Opcodes(SpasmBench::State& state)
+{
+    const auto bytecode = SpasmBench::Assemble(
+        SpasmBench::Substitute(MapLoop, "$COUNT", std::to_string(Count)));
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+    state.SetItemsPerIteration(2 * Count);
+}
+SPASM_BENCHMARK(Map_Opcodes);
+}  // namespace
@@ -0,0 +1,87 @@
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Calls a two argument function $COUNT times, $CALL is the call sequence
+const char* CallLoop =
+    "push 9"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 3 1"         "\n"
+    "const 4 2"         "\n"
+    "const 6 2"         "\n"
+    "const 7 1"         "\n"
+    "label loop"        "\n"
+    "$CALL"
+    "add 1 1 7"         "\n"
+    "less 8 1 2"        "\n"
+    "jmpt 8 loop"       "\n"
+    "halt"              "\n"
+    "label sum"         "\n"
+    "push 2"            "\n"
+    "add 1 -2 -1"       "\n"
+    "ret 1"             "\n";
+
+const char* NoCall = "";
+
+const char* NativeCall =
+    "callnative 5 0 3"  "\n";
+
+//! Reserves a slot for the result, pushes the arguments and their count
+const char* BytecodeCall =
+    "push 1"            "\n"
+    "pushr 3"           "\n"
+    "pushr 4"           "\n"
+    "pushr 6"           "\n"
+    "call sum"          "\n"
+    "popr 5"            "\n";
+
+Spasm::Value Sum(Spasm::Value* args, size_t)
+{
+    return args[0] + args[1];
+}
+
+void RunCallLoop(SpasmBench::State& state, const char* call)
+{
+    const size_t count = 1 << 20;
+    auto source = SpasmBench::Substitute(CallLoop, "$COUNT",
+                                         std::to_string(count));
+    source = SpasmBench::Substitute(source, "$CALL", call);
+    const auto bytecode = SpasmBench::Assemble(source);
+
+    Spasm::NativeRegistry natives;
+    natives.Register("sum", &Sum, 2);
+
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.SetNatives(natives);
+        vm.run();
+    }
+    state.SetItemsPerIteration(count);
+}
+
+//! The cost of the loop alone, subtract it from the calls
+void CallLoop_Empty(SpasmBench::State& state)
+{
+    RunCallLoop(state, NoCall);
+}
+SPASM_BENCHMARK(CallLoop_Empty);
+
+void CallLoop_Native(SpasmBench::State& state)
+{
+    RunCallLoop(state, NativeCall);
+}
+SPASM_BENCHMARK(CallLoop_Native);
+
+void CallLoop_Bytecode(SpasmBench::State& state)
+{
+    RunCallLoop(state, BytecodeCall);
+}
+SPASM_BENCHMARK(CallLoop_Bytecode);
+}  // namespace
@@ -0,0 +1,61 @@
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Appends $PIECE to a string $COUNT times and prints the result
+const char* AppendLoop =
+    "push 7"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 4 1"         "\n"
+    "string 3 '$PIECE'" "\n"
+    "string 5 ''"       "\n"
+    "label loop"        "\n"
+    "add 5 5 3"         "\n"
+    "add 1 1 4"         "\n"
+    "less 6 1 2"        "\n"
+    "jmpt 6 loop"       "\n"
+    "print 5"           "\n"
+    "halt"              "\n";
+
+void RunAppendLoop(SpasmBench::State& state,
+                   size_t count,
+                   const std::string& piece)
+{
+    auto source = SpasmBench::Substitute(AppendLoop, "$COUNT",
+                                         std::to_string(count));
+    source = SpasmBench::Substitute(source, "$PIECE", piece);
+    const auto bytecode = SpasmBench::Assemble(source);
+
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+    state.SetItemsPerIteration(count);
+    state.SetCounter("MB", double(count * piece.size()) / (1 << 20));
+}
+
+void RopeAppendByte_1MB(SpasmBench::State& state)
+{
+    RunAppendLoop(state, 1 << 20, "x");
+}
+SPASM_BENCHMARK(RopeAppendByte_1MB);
+
+void RopeAppendByte_4MB(SpasmBench::State& state)
+{
+    RunAppendLoop(state, 4 << 20, "x");
+}
+SPASM_BENCHMARK(RopeAppendByte_4MB);
+
+void RopeAppendChunk_4MB(SpasmBench::State& state)
+{
+    RunAppendLoop(state, 1 << 18, "0123456789abcdef");
+}
+SPASM_BENCHMARK(RopeAppendChunk_4MB);
+}  // namespace
@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Builds a long string as the "lookup table" and halts when it is ready
+const char* Initialization =
+    "push 7"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 4 1"         "\n"
+    "string 3 '0123456789abcdef'" "\n"
+    "string 5 ''"       "\n"
+    "label loop"        "\n"
+    "add 5 5 3"         "\n"
+    "add 1 1 4"         "\n"
+    "less 6 1 2"        "\n"
+    "jmpt 6 loop"       "\n"
+    "halt"              "\n"
+    "print 1"           "\n"
+    "halt"              "\n";
+
+const size_t Count = 1 << 16;
+
+std::vector<Spasm::byte> Program()
+{
+    return SpasmBench::Assemble(SpasmBench::Substitute(
+        Initialization, "$COUNT", std::to_string(Count)));
+}
+
+void ColdStart(SpasmBench::State& state)
+{
+    const auto bytecode = Program();
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+        vm.run();
+    }
+}
+SPASM_BENCHMARK(ColdStart);
+
+void WarmStartFromSnapshot(SpasmBench::State& state)
+{
+    const auto bytecode = Program();
+    std::istringstream input;
+    std::ostream output(nullptr);
+    const std::string path = "spasm_bench.snapshot";
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+        vm.SaveSnapshot(path);
+    }
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.LoadSnapshot(path, input, output);
+        vm.run();
+    }
+    std::remove(path.c_str());
+}
+SPASM_BENCHMARK(WarmStartFromSnapshot);
+}  // namespace
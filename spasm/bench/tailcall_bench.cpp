@@ -0,0 +1,90 @@
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Sums $COUNT..1 with a loop
+const char* WhileLoop =
+    "push 3"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 3 0"         "\n"
+    "label loop"        "\n"
+    "add 1 1 2"         "\n"
+    "const 3 1"         "\n"
+    "sub 2 2 3"         "\n"
+    "const 3 0"         "\n"
+    "greater 3 2 3"     "\n"
+    "jmpt 3 loop"       "\n"
+    "print 1"           "\n"
+    "halt"              "\n";
+
+//! Sums $COUNT..1 with a recursive function, $CALL is call or tcall
+const char* Recursion =
+    "push 3"            "\n"
+    "const 1 0"         "\n"
+    "const 2 $COUNT"    "\n"
+    "const 3 2"         "\n"
+    "pushr 1"           "\n"
+    "pushr 1"           "\n"
+    "pushr 2"           "\n"
+    "pushr 3"           "\n"
+    "call sum"          "\n"
+    "popr 1"            "\n"
+    "print 1"           "\n"
+    "halt"              "\n"
+    "label sum"         "\n"
+    "push 3"            "\n"
+    "const 3 0"         "\n"
+    "equal 1 -1 3"      "\n"
+    "jmpf 1 more"       "\n"
+    "ret -2"            "\n"
+    "label more"        "\n"
+    "add 2 -2 -1"       "\n"
+    "const 3 1"         "\n"
+    "sub 3 -1 3"        "\n"
+    "pushr 2"           "\n"
+    "pushr 2"           "\n"
+    "pushr 3"           "\n"
+    "const 1 2"         "\n"
+    "pushr 1"           "\n"
+    "$CALL sum"         "\n"
+    "popr 1"            "\n"
+    "ret 1"             "\n";
+
+const size_t Count = 1 << 16;
+
+void Run(SpasmBench::State& state, std::string source)
+{
+    source = SpasmBench::Substitute(source, "$COUNT", std::to_string(Count));
+    const auto bytecode = SpasmBench::Assemble(source);
+    std::istringstream input;
+    std::ostream output(nullptr);
+    Spasm::Spasm vm;
+    while (state.Loop())
+    {
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+void Sum_WhileLoop(SpasmBench::State& state)
+{
+    Run(state, WhileLoop);
+}
+SPASM_BENCHMARK(Sum_WhileLoop);
+
+void Sum_Recursion(SpasmBench::State& state)
+{
+    Run(state, SpasmBench::Substitute(Recursion, "$CALL", "call"));
+}
+SPASM_BENCHMARK(Sum_Recursion);
+
+void Sum_TailRecursion(SpasmBench::State& state)
+{
+    Run(state, SpasmBench::Substitute(Recursion, "$CALL", "tcall"));
+}
+SPASM_BENCHMARK(Sum_TailRecursion);
+}  // namespace
@@ -0,0 +1,107 @@
+#include <sstream>
+
+#include "bench.hpp"
+
+namespace
+{
+//! Computes fib($N) forking both calls down to $CUTOFF, then sequentially
+const char* ParallelFib =
+    "push 3"            "\n"
+    "const 1 $N"        "\n"
+    "fork 2 pfib 1"     "\n"
+    "join 2 2"          "\n"
+    "print 2"           "\n"
+    "halt"              "\n"
+    // task: register 0 is n
+    "label pfib"        "\n"
+    "push 7"            "\n"
+    "const 1 $CUTOFF"   "\n"
+    "less 2 0 1"        "\n"
+    "jmpt 2 sequential" "\n"
+    "const 3 1"         "\n"
+    "sub 4 0 3"         "\n"
+    "fork 5 pfib 4"     "\n"
+    "const 3 2"         "\n"
+    "sub 4 0 3"         "\n"
+    "fork 6 pfib 4"     "\n"
+    "join 5 5"          "\n"
+    "join 6 6"          "\n"
+    "add 5 5 6"         "\n"
+    "ret 5"             "\n"
+    "label sequential"  "\n"
+    "push 1"            "\n"
+    "pushr 0"           "\n"
+    "const 3 1"         "\n"
+    "pushr 3"           "\n"
+    "call fib"          "\n"
+    "popr 7"            "\n"
+    "ret 7"             "\n"
+    // function: register -1 is n
+    "label fib"         "\n"
+    "push 6"            "\n"
+    "const 1 2"         "\n"
+    "less 2 -1 1"       "\n"
+    "jmpt 2 base"       "\n"
+    "const 3 1"         "\n"
+    "sub 4 -1 3"        "\n"
+    "push 1"            "\n"
+    "pushr 4"           "\n"
+    "pushr 3"           "\n"
+    "call fib"          "\n"
+    "popr 5"            "\n"
+    "const 3 2"         "\n"
+    "sub 4 -1 3"        "\n"
+    "push 1"            "\n"
+    "pushr 4"           "\n"
+    "const 3 1"         "\n"
+    "pushr 3"           "\n"
+    "call fib"          "\n"
+    "popr 6"            "\n"
+    "add 5 5 6"         "\n"
+    "ret 5"             "\n"
+    "label base"        "\n"
+    "ret -1"            "\n";
+
+void RunParallelFib(SpasmBench::State& state, size_t workers)
+{
+    auto source = SpasmBench::Substitute(ParallelFib, "$N", "27");
+    source = SpasmBench::Substitute(source, "$CUTOFF", "15");
+    const auto bytecode = SpasmBench::Assemble(source);
+
+    Spasm::TaskPool tasks(workers);
+    std::istringstream input;
+    std::ostringstream output;
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.SetTaskPool(tasks);
+        vm.run();
+    }
+    state.SetCounter("workers", double(workers));
+}
+
+void ParallelFib_1(SpasmBench::State& state)
+{
+    RunParallelFib(state, 1);
+}
+SPASM_BENCHMARK(ParallelFib_1);
+
+void ParallelFib_2(SpasmBench::State& state)
+{
+    RunParallelFib(state, 2);
+}
+SPASM_BENCHMARK(ParallelFib_2);
+
+void ParallelFib_4(SpasmBench::State& state)
+{
+    RunParallelFib(state, 4);
+}
+SPASM_BENCHMARK(ParallelFib_4);
+
+void ParallelFib_8(SpasmBench::State& state)
+{
+    RunParallelFib(state, 8);
+}
+SPASM_BENCHMARK(ParallelFib_8);
+}  // namespace
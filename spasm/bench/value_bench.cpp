@@ -0,0 +1,262 @@
+#include <cstring>
+
+#include "bench.hpp"
+#include "nanbox_value.hpp"
+
+//! Keeps a function out of line, so its code can be found in the binary
+#if defined(_MSC_VER)
+#define SPASM_ASM_HOOK extern "C" __declspec(noinline)
+#else
+#define SPASM_ASM_HOOK extern "C" __attribute__((noinline))
+#endif
+
+namespace
+{
+using Spasm::ValueType;
+
+//! Spasm::NanBoxValue with explicit masks and shifts instead of bit fields
+/*!
+** The bits are exactly the same, so the two can be compared operation by
+** operation. A type is a double when its top 16 bits are at most 0xfff8.
+*/
+struct MaskedValue
+{
+    static const uint64_t NanBits = uint64_t(0x1fff) << 51;
+    static const int TagShift = 48;
+    static const uint64_t TagMask = uint64_t(0x7) << TagShift;
+    static const uint64_t PayloadMask = (uint64_t(1) << TagShift) - 1;
+
+    MaskedValue() : Bits(0) {}
+
+    explicit MaskedValue(double v) { std::memcpy(&Bits, &v, sizeof(v)); }
+
+    explicit MaskedValue(bool v) : MaskedValue(ValueType::Boolean, uint64_t(v))
+    {
+    }
+
+    MaskedValue(ValueType tag, uint64_t payload)
+        : Bits(NanBits | (uint64_t(tag) << TagShift) | payload)
+    {
+    }
+
+    bool is_double() const { return (Bits >> TagShift) <= 0xfff8; }
+
+    double get_double() const
+    {
+        double v;
+        std::memcpy(&v, &Bits, sizeof(v));
+        return v;
+    }
+
+    ValueType get_type() const
+    {
+        return is_double() ? ValueType::Number
+                           : ValueType((Bits & TagMask) >> TagShift);
+    }
+
+    void* get_pointer() const { return (void*)(Bits & PayloadMask); }
+
+    bool get_boolean() const { return (Bits & PayloadMask) != 0; }
+
+    explicit operator bool() const
+    {
+        return (get_type() != ValueType::Boolean && Bits != 0) ||
+               get_boolean();
+    }
+
+    uint64_t Bits;
+};
+
+//! Values of all kinds, so the type checks are not perfectly predicted
+template <typename V>
+std::vector<V> MixedValues(size_t count)
+{
+    std::vector<V> values;
+    uint32_t seed = 2463534242u;
+    for (size_t i = 0; i < count; ++i)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        switch (seed % 4)
+        {
+            case 0:
+                values.emplace_back(double(seed));
+                break;
+            case 1:
+                values.emplace_back(bool(seed & 8));
+                break;
+            case 2:
+                values.emplace_back(ValueType::String, uint64_t(seed) << 4);
+                break;
+            default:
+                values.emplace_back(ValueType::Null, uint64_t(0));
+                break;
+        }
+    }
+    return values;
+}
+
+const size_t Count = 4096;
+
+template <typename V>
+void Construction(SpasmBench::State& state)
+{
+    std::vector<V> values(Count);
+    while (state.Loop())
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            values[i] = (i & 1) ? V(double(i))
+                                : V(ValueType::Object, uint64_t(i) << 3);
+        }
+        SpasmBench::DoNotOptimize(values);
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+template <typename V>
+void TypeCheck(SpasmBench::State& state)
+{
+    const auto values = MixedValues<V>(Count);
+    while (state.Loop())
+    {
+        size_t strings = 0;
+        size_t doubles = 0;
+        for (const auto& value : values)
+        {
+            doubles += value.is_double();
+            strings += value.get_type() == ValueType::String;
+        }
+        SpasmBench::DoNotOptimize(doubles);
+        SpasmBench::DoNotOptimize(strings);
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+template <typename V>
+void Arithmetic(SpasmBench::State& state)
+{
+    std::vector<V> values;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        values.emplace_back(double(i) * 0.5);
+    }
+    while (state.Loop())
+    {
+        V sum(0.0);
+        for (const auto& value : values)
+        {
+            sum = V(sum.get_double() + value.get_double());
+        }
+        SpasmBench::DoNotOptimize(sum);
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+template <typename V>
+void Truthiness(SpasmBench::State& state)
+{
+    const auto values = MixedValues<V>(Count);
+    while (state.Loop())
+    {
+        size_t truthy = 0;
+        for (const auto& value : values)
+        {
+            truthy += bool(value);
+        }
+        SpasmBench::DoNotOptimize(truthy);
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+template <typename V>
+void TagRoundTrip(SpasmBench::State& state)
+{
+    std::vector<uint64_t> payloads;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        payloads.push_back(uint64_t(i) * 4096 + 0x7f0000000000);
+    }
+    while (state.Loop())
+    {
+        uint64_t checksum = 0;
+        for (auto payload : payloads)
+        {
+            const V value(ValueType::Object, payload);
+            checksum += uint64_t(value.get_pointer()) ^
+                        uint64_t(value.get_type());
+        }
+        SpasmBench::DoNotOptimize(checksum);
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+#define VALUE_BENCHMARK(operation)                          \
+    void Value##operation##_Bitfield(SpasmBench::State& s)  \
+    {                                                       \
+        operation<Spasm::NanBoxValue>(s);                   \
+    }                                                       \
+    SPASM_BENCHMARK(Value##operation##_Bitfield);           \
+    void Value##operation##_MaskShift(SpasmBench::State& s) \
+    {                                                       \
+        operation<MaskedValue>(s);                          \
+    }                                                       \
+    SPASM_BENCHMARK(Value##operation##_MaskShift)
+
+VALUE_BENCHMARK(Construction);
+VALUE_BENCHMARK(TypeCheck);
+VALUE_BENCHMARK(Arithmetic);
+VALUE_BENCHMARK(Truthiness);
+VALUE_BENCHMARK(TagRoundTrip);
+}  // namespace
+
+// Out of line copies of the operations to read the code the compiler makes
+// for each layout, e.g.
+//   objdump -d --no-show-raw-insn spasm_bench | grep -A12 '<spasm_asm_'
+// or run the MSVC disassembler on the same names.
+
+SPASM_ASM_HOOK bool spasm_asm_is_double_bitfield(
+    const Spasm::NanBoxValue& value)
+{
+    return value.is_double();
+}
+
+SPASM_ASM_HOOK bool spasm_asm_is_double_maskshift(const MaskedValue& value)
+{
+    return value.is_double();
+}
+
+SPASM_ASM_HOOK int spasm_asm_get_type_bitfield(
+    const Spasm::NanBoxValue& value)
+{
+    return int(value.get_type());
+}
+
+SPASM_ASM_HOOK int spasm_asm_get_type_maskshift(const MaskedValue& value)
+{
+    return int(value.get_type());
+}
+
+SPASM_ASM_HOOK bool spasm_asm_truthy_bitfield(
+    const Spasm::NanBoxValue& value)
+{
+    return bool(value);
+}
+
+SPASM_ASM_HOOK bool spasm_asm_truthy_maskshift(const MaskedValue& value)
+{
+    return bool(value);
+}
+
+SPASM_ASM_HOOK void spasm_asm_make_object_bitfield(Spasm::NanBoxValue* value,
+                                                   uint64_t payload)
+{
+    *value = Spasm::NanBoxValue(ValueType::Object, payload);
+}
+
+SPASM_ASM_HOOK void spasm_asm_make_object_maskshift(MaskedValue* value,
+                                                   uint64_t payload)
+{
+    *value = MaskedValue(ValueType::Object, payload);
+}
@@ -0,0 +1,160 @@
+#include <cstring>
+#include <sstream>
+
+#include "bench.hpp"
+#include "vector_kernels.hpp"
+
+namespace
+{
+using SpasmImpl::VectorKernels;
+
+const char* KernelNames[] = {"scalar", "sse2", "avx2"};
+
+//! The kernels of the instruction set, nullptr if the CPU lacks it
+const VectorKernels* Find(const char* name)
+{
+    for (auto kernels : VectorKernels::Supported())
+    {
+        if (!std::strcmp(kernels->Name, name))
+        {
+            return kernels;
+        }
+    }
+    return nullptr;
+}
+
+template <int Kernels, size_t Count>
+void KernelAdd(SpasmBench::State& state)
+{
+    const auto kernels = Find(KernelNames[Kernels]);
+    std::vector<double> a(Count, 1.5), b(Count, 2.5), out(Count);
+    while (state.Loop())
+    {
+        if (kernels)
+        {
+            kernels->Add(out.data(), a.data(), b.data(), Count);
+        }
+        SpasmBench::DoNotOptimize(out);
+    }
+    state.SetItemsPerIteration(Count);
+    state.SetCounter("supported", kernels ? 1 : 0);
+}
+
+template <int Kernels, size_t Count>
+void KernelDot(SpasmBench::State& state)
+{
+    const auto kernels = Find(KernelNames[Kernels]);
+    std::vector<double> a(Count, 1.5), b(Count, 2.5);
+    while (state.Loop())
+    {
+        const auto dot = kernels ? kernels->Dot(a.data(), b.data(), Count) : 0;
+        SpasmBench::DoNotOptimize(dot);
+    }
+    state.SetItemsPerIteration(Count);
+    state.SetCounter("supported", kernels ? 1 : 0);
+}
+
+#define KERNEL_BENCHMARK(operation, kernels, count)                   \
+    void operation##_##kernels##_##count(SpasmBench::State& s)        \
+    {                                                                 \
+        operation<kernels, count>(s);                                 \
+    }                                                                 \
+    SPASM_BENCHMARK(operation##_##kernels##_##count)
+
+const int Scalar = 0;
+const int Sse2 = 1;
+const int Avx2 = 2;
+
+KERNEL_BENCHMARK(KernelAdd, Scalar, 64);
+KERNEL_BENCHMARK(KernelAdd, Sse2, 64);
+KERNEL_BENCHMARK(KernelAdd, Avx2, 64);
+KERNEL_BENCHMARK(KernelAdd, Scalar, 4096);
+KERNEL_BENCHMARK(KernelAdd, Sse2, 4096);
+KERNEL_BENCHMARK(KernelAdd, Avx2, 4096);
+KERNEL_BENCHMARK(KernelAdd, Scalar, 262144);
+KERNEL_BENCHMARK(KernelAdd, Sse2, 262144);
+KERNEL_BENCHMARK(KernelAdd, Avx2, 262144);
+KERNEL_BENCHMARK(KernelDot, Scalar, 64);
+KERNEL_BENCHMARK(KernelDot, Sse2, 64);
+KERNEL_BENCHMARK(KernelDot, Avx2, 64);
+KERNEL_BENCHMARK(KernelDot, Scalar, 4096);
+KERNEL_BENCHMARK(KernelDot, Sse2, 4096);
+KERNEL_BENCHMARK(KernelDot, Avx2, 4096);
+KERNEL_BENCHMARK(KernelDot, Scalar, 262144);
+KERNEL_BENCHMARK(KernelDot, Sse2, 262144);
+KERNEL_BENCHMARK(KernelDot, Avx2, 262144);
+
+//! Adds two arrays of $COUNT elements one element at a time
+const char* InterpretedAdd =
+    "push 10"           "\n"
+    "const 1 $COUNT"    "\n"
+    "vnew 2 1"          "\n"
+    "vnew 3 1"          "\n"
+    "const 4 0"         "\n"
+    "const 5 1"         "\n"
+    "label loop"        "\n"
+    "vget 6 2 4"        "\n"
+    "vget 7 3 4"        "\n"
+    "add 8 6 7"         "\n"
+    "vset 2 4 8"        "\n"
+    "add 4 4 5"         "\n"
+    "less 9 4 1"        "\n"
+    "jmpt 9 loop"       "\n"
+    "halt"              "\n";
+
+//! The same with the vector opcode
+const char* VectorAdd =
+    "push 4"            "\n"
+    "const 1 $COUNT"    "\n"
+    "vnew 2 1"          "\n"
+    "vnew 3 1"          "\n"
+    "vadd 2 2 3"        "\n"
+    "halt"              "\n";
+
+template <size_t Count>
+void RunAdd(SpasmBench::State& state, const char* program)
+{
+    const auto bytecode = SpasmBench::Assemble(
+        SpasmBench::Substitute(program, "$COUNT", std::to_string(Count)));
+    std::istringstream input;
+    std::ostream output(nullptr);
+    while (state.Loop())
+    {
+        Spasm::Spasm vm;
+        vm.Initialize(bytecode.size(), bytecode.data(), input, output);
+        vm.run();
+    }
+    state.SetItemsPerIteration(Count);
+}
+
+template <size_t Count>
+void VmAddInterpreted(SpasmBench::State& state)
+{
+    RunAdd<Count>(state, InterpretedAdd);
+}
+
+template <size_t Count>
+void VmAddOpcode(SpasmBench::State& state)
+{
+    RunAdd<Count>(state, VectorAdd);
+}
+
+void VmAddInterpreted_64(SpasmBench::State& s) { VmAddInterpreted<64>(s); }
+SPASM_BENCHMARK(VmAddInterpreted_64);
+void VmAddOpcode_64(SpasmBench::State& s) { VmAddOpcode<64>(s); }
+SPASM_BENCHMARK(VmAddOpcode_64);
+void VmAddInterpreted_4096(SpasmBench::State& s)
+{
+    VmAddInterpreted<4096>(s);
+}
+SPASM_BENCHMARK(VmAddInterpreted_4096);
+void VmAddOpcode_4096(SpasmBench::State& s) { VmAddOpcode<4096>(s); }
+SPASM_BENCHMARK(VmAddOpcode_4096);
+void VmAddInterpreted_262144(SpasmBench::State& s)
+{
+    VmAddInterpreted<262144>(s);
+}
+SPASM_BENCHMARK(VmAddInterpreted_262144);
+void VmAddOpcode_262144(SpasmBench::State& s) { VmAddOpcode<262144>(s); }
+SPASM_BENCHMARK(VmAddOpcode_262144);
+}  // namespace
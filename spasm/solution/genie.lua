@@ -73,6 +73,28 @@ end
         location(solution().location)
         files '../src/main.cpp'
         links 'sprt'
+        configuration 'Linux'
+            links 'pthread'
+        configuration '*'
+
+    project 'spasm_bench'
+        kind 'ConsoleApp'
+        language 'C++'
+        uuid(os.uuid('spasm_bench'))
+        location(solution().location)
+        files '../bench/*.cpp'
+        files '../bench/*.hpp'
+        includedirs {
+            '../src',
+            '../src/asm',
+        }
+        links {
+            'sprt',
+            'spasm_lib',
+        }
+        configuration 'Linux'
+            links 'pthread'
+        configuration '*'
 
     -- include '../test'
     startproject 'sprun'
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <memory>
 
 #include "assembler.hpp"
 #include "bytecode.hpp"
@@ -14,40 +17,35 @@ Assembler::Assembler(Lexer::Tokenizer& tokenizer, Bytecode_Stream& bytecode)
 {
 }
 
+//! Returns the log2 of the bytes needed for a signed argument
+static int get_value_size(int64_t value)
+{
+    if (value > 0x7fffffffLL || value < -0x80000000LL)
+    {
+        return 3;
+    }
+    if (value > 0x7fff || value < -0x8000)
+    {
+        return 2;
+    }
+    if (value > 0x7f || value < -0x80)
+    {
+        return 1;
+    }
+    return 0;
+}
+
 int get_arg_size(const Lexer::Token args[])
 {
     int size = 0;
-    for (int i = 0; i < 3; ++i)
+    for (int i = 0; i < 4; ++i)
     {
         switch (args[i].type())
         {
             case Lexer::Token::Integer:
             case Lexer::Token::XInteger:
             {
-                if (args[i].value_int() > 0xffffffff)
-                {
-                    size = std::max(size, 3);
-                }
-                else if (args[i].value_int() > 0xffff)
-                {
-                    size = std::max(size, 2);
-                }
-                else if (args[i].value_int() > 0xff)
-                {
-                    size = std::max(size, 1);
-                }
-                else if (args[i].value_int() < -0xffffffffLL)
-                {
-                    size = std::max(size, 3);
-                }
-                else if (args[i].value_int() < -0xffff)
-                {
-                    size = std::max(size, 2);
-                }
-                else if (args[i].value_int() < -0xff)
-                {
-                    size = std::max(size, 1);
-                }
+                size = std::max(size, get_value_size(args[i].value_int()));
                 break;
             }
             case Lexer::Token::FloatingPoint:
@@ -57,19 +55,8 @@ int get_arg_size(const Lexer::Token args[])
             }
             case Lexer::Token::StringValue:
             {
-                const auto length = args[i].value_str().size();
-                if (length > 0xffffffff)
-                {
-                    size = std::max(size, 3);
-                }
-                else if (length > 0xffff)
-                {
-                    size = std::max(size, 2);
-                }
-                else if (length > 0xff)
-                {
-                    size = std::max(size, 1);
-                }
+                const auto length = int64_t(args[i].value_str().size());
+                size = std::max(size, get_value_size(length));
                 break;
             }
             default:
@@ -79,6 +66,92 @@ int get_arg_size(const Lexer::Token args[])
     return size;
 }
 
+//! Returns the number of arguments of the instruction
+static int get_arg_count(Lexer::Token::Token_type type)
+{
+    switch (type)
+    {
+        case Lexer::Token::Halt:
+        case Lexer::Token::Dup:
+            return 0;
+        case Lexer::Token::Pop:
+        case Lexer::Token::PopTo:
+        case Lexer::Token::PushFrom:
+        case Lexer::Token::Push:
+        case Lexer::Token::Print:
+        case Lexer::Token::Read:
+        case Lexer::Token::Call:
+        case Lexer::Token::TailCall:
+        case Lexer::Token::Ret:
+        case Lexer::Token::Jump:
+        case Lexer::Token::Yield:
+        case Lexer::Token::Throw:
+        case Lexer::Token::Catch:
+        case Lexer::Token::MapNew:
+            return 1;
+        case Lexer::Token::JumpT:
+        case Lexer::Token::JumpF:
+        case Lexer::Token::Const:
+        case Lexer::Token::String:
+        case Lexer::Token::Resume:
+        case Lexer::Token::Join:
+        case Lexer::Token::LoadChannel:
+        case Lexer::Token::Send:
+        case Lexer::Token::Receive:
+        case Lexer::Token::VNew:
+        case Lexer::Token::VSum:
+        case Lexer::Token::GetG:
+        case Lexer::Token::SetG:
+        case Lexer::Token::BOpen:
+        case Lexer::Token::BNew:
+        case Lexer::Token::BSize:
+            return 2;
+        case Lexer::Token::BSlice:
+        case Lexer::Token::BGet:
+        case Lexer::Token::BSet:
+            return 4;
+        default:
+            return 3;
+    }
+}
+
+//! Returns the code of a format of the buffer opcodes
+/*!
+** The codes must match ByteBuffer::Format of the machine.
+*/
+static Lexer::Token buffer_format(const Lexer::Token& name)
+{
+    static const struct
+    {
+        const char* Name;
+        int Format;
+    } Formats[] = {
+        {"u8", 0},  {"u16", 1}, {"u32", 2},  {"u64", 3},  {"i8", 4},
+        {"i16", 5}, {"i32", 6}, {"i64", 7},  {"f32", 10}, {"f64", 11},
+    };
+    assert(name.type() == Lexer::Token::Ident);
+    for (const auto& format : Formats)
+    {
+        if (name.value_str() == format.Name)
+        {
+            Lexer::Token code(Lexer::Token::Integer);
+            code.set_int(int64_t(format.Format));
+            return code;
+        }
+    }
+    assert(false && "Unknown buffer format");
+    return name;
+}
+
+//! Whether the instruction refers to a label
+static bool has_location(Lexer::Token::Token_type type)
+{
+    return type == Lexer::Token::Call || type == Lexer::Token::TailCall ||
+           type == Lexer::Token::Jump ||
+           type == Lexer::Token::JumpT || type == Lexer::Token::JumpF ||
+           type == Lexer::Token::Spawn || type == Lexer::Token::Fork;
+}
+
 void Assembler::assemble()
 {
     Lexer::Token token = _tokenizer->next_token();
@@ -98,33 +171,56 @@ void Assembler::assemble()
                     assert(token.type() == Lexer::Token::Ident);
                     _symbols.define(token.value_str(), _bytecode->size());
                     break;
+                case Lexer::Token::Try:
+                    assemble_try();
+                    break;
+                case Lexer::Token::Export:
+                    assemble_export();
+                    break;
                 default:
                     break;
             }
         }
         else
         {
-            Lexer::Token args[3];
-            if (type >= Lexer::Token::_OneArgBegin)
+            Lexer::Token args[4];
+            for (int i = 0; i < get_arg_count(type); ++i)
             {
-                args[0] = _tokenizer->next_token();
+                args[i] = _tokenizer->next_token();
             }
-            if (type >= Lexer::Token::_TwoArgBegin)
+            if (type == Lexer::Token::GetG)
             {
-                args[1] = _tokenizer->next_token();
+                args[1] = global_slot(args[1]);
             }
-            if (type >= Lexer::Token::_ThreeArgBegin)
+            else if (type == Lexer::Token::SetG)
             {
-                args[2] = _tokenizer->next_token();
+                args[0] = global_slot(args[0]);
+            }
+            else if (type == Lexer::Token::BGet || type == Lexer::Token::BSet)
+            {
+                args[3] = buffer_format(args[3]);
+            }
+            auto size = get_arg_size(args);
+            if (has_location(type))
+            {
+                // labels may be defined later, so their size is fixed
+                assert(size <= Bytecode_Stream::LocationSize);
+                size = Bytecode_Stream::LocationSize;
+            }
+            else if (type == Lexer::Token::GetG || type == Lexer::Token::SetG)
+            {
+                // the linker renumbers the slots of the modules
+                size = std::max(size, int(Bytecode_Stream::LocationSize));
             }
-            const auto size = get_arg_size(args);
             _bytecode->push_opcode(
                 (Bytecode_Stream::Opcode_t)((size << 6) | token.type()));
             const auto arg_size = 1 << size;
 
             if (args[0].type() != Lexer::Token::NotUsed)
             {
-                if (type == Lexer::Token::Call || type == Lexer::Token::Jump)
+                if (type == Lexer::Token::Call ||
+                    type == Lexer::Token::TailCall ||
+                    type == Lexer::Token::Jump)
                 {
                     assert(args[0].type() == Lexer::Token::Ident);
                     assemble_identifier(args[0]);
@@ -132,12 +228,16 @@ void Assembler::assemble()
                 else
                 {
                     assert(args[0].type() == Lexer::Token::Integer);
+                    if (type == Lexer::Token::SetG)
+                    {
+                        _bytecode->push_global_reference(_bytecode->size());
+                    }
                     _bytecode->push_integer(args[0].value_int(), arg_size);
                 }
             }
             if (args[1].type() != Lexer::Token::NotUsed)
             {
-                if (type == Lexer::Token::JumpF || type == Lexer::Token::JumpT)
+                if (has_location(type))
                 {
                     assert(args[1].type() == Lexer::Token::Ident);
                     assemble_identifier(args[1]);
@@ -152,6 +252,11 @@ void Assembler::assemble()
                 {
                     if (args[1].type() == Lexer::Token::Integer)
                     {
+                        if (type == Lexer::Token::GetG)
+                        {
+                            _bytecode->push_global_reference(
+                                _bytecode->size());
+                        }
                         _bytecode->push_integer(args[1].value_int(), arg_size);
                     }
                     else if (args[1].type() == Lexer::Token::FloatingPoint)
@@ -164,31 +269,109 @@ void Assembler::assemble()
                     }
                 }
             }
-            if (args[2].type() != Lexer::Token::NotUsed)
+            for (int i = 2; i < 4; ++i)
             {
-                assert(args[2].type() == Lexer::Token::Integer);
-                _bytecode->push_integer(args[2].value_int(), arg_size);
+                if (args[i].type() != Lexer::Token::NotUsed)
+                {
+                    assert(args[i].type() == Lexer::Token::Integer);
+                    _bytecode->push_integer(args[i].value_int(), arg_size);
+                }
             }
         }
 
         token = _tokenizer->next_token();
     }
 
-    Symbol_Table::const_iterator i = _symbols.begin();
-    while (i != _symbols.end())
+    backpatch();
+
+    for (const auto& label : _exports)
     {
-        backpatch(i->second);
-        ++i;
+        _bytecode->push_export(label, definition(label));
+    }
+
+    for (const auto& range : _try_ranges)
+    {
+        Bytecode_Stream::Handler handler;
+        handler.begin = definition(range[0]);
+        handler.end = definition(range[1]);
+        handler.handler = definition(range[2]);
+        _bytecode->push_handler(handler);
     }
 }
 
-void Assembler::backpatch(const Symbol* symbol)
+/*!
+** 'try begin end handler' - the exceptions thrown by the instructions
+** from label begin up to label end go to label handler. The range is only
+** recorded, it emits no code.
+*/
+void Assembler::assemble_try()
 {
-    Symbol::Positions_t::const_iterator i = symbol->positions_begin();
-    while (i != symbol->positions_end())
+    std::array<std::string, 3> labels;
+    for (auto& label : labels)
     {
-        _bytecode->set_location(*i, symbol->definition());
-        ++i;
+        const auto token = _tokenizer->next_token();
+        assert(token.type() == Lexer::Token::Ident);
+        label = token.value_str();
+    }
+    _try_ranges.push_back(labels);
+}
+
+/*!
+** 'export label' - other modules may call label, see Object_Module.
+*/
+void Assembler::assemble_export()
+{
+    const auto token = _tokenizer->next_token();
+    assert(token.type() == Lexer::Token::Ident);
+    _exports.emplace_back(token.value_str());
+}
+
+/*!
+** Globals are named in the source, each name gets the next slot when it
+** is first used.
+** \return the slot of the global as an integer token
+*/
+Lexer::Token Assembler::global_slot(const Lexer::Token& name)
+{
+    assert(name.type() == Lexer::Token::Ident);
+    auto position = _globals.find(name.value_str());
+    if (position == _globals.end())
+    {
+        position = _globals.emplace(name.value_str(), _globals.size()).first;
+        _bytecode->push_global(position->first);
+    }
+    Lexer::Token slot(Lexer::Token::Integer);
+    slot.set_int(int64_t(position->second));
+    return slot;
+}
+
+size_t Assembler::definition(const std::string& label) const
+{
+    const auto symbol = _symbols.find(label);
+    assert(symbol && symbol->definition() != Symbol::notdefined &&
+           "Undefined label");
+    return symbol->definition();
+}
+
+/*!
+** One pass over the uses of the labels, in the order of the code. Labels
+** that are not defined are left to the linker as imports.
+*/
+void Assembler::backpatch()
+{
+    for (const auto& fixup : _symbols.fixups())
+    {
+        const auto& symbol = _symbols.symbol(fixup.symbol);
+        _bytecode->set_location(fixup.position, symbol.definition());
+        if (symbol.definition() != Symbol::notdefined)
+        {
+            _bytecode->push_relocation(fixup.position);
+        }
+        else
+        {
+            _bytecode->push_import(std::string(symbol.identifier()),
+                                   fixup.position);
+        }
     }
 }
 
@@ -208,5 +391,20 @@ bool compile(std::istream& istr, Bytecode_Stream& bytecode)
     return true;
 }
 
+bool compile_file(const std::string& path, Bytecode_Stream& bytecode)
+{
+    std::unique_ptr<Lexer::Lexer> lexer(new Lexer::Lexer);
+    if (!lexer->map_file(path))
+    {
+        return false;
+    }
+    Lexer::Tokenizer tokenizer(std::move(lexer));
+    Assembler assembler(tokenizer, bytecode);
+
+    assembler.assemble();
+
+    return true;
+}
+
 }  // namespace ASM
 }  // namespace SpasmImpl
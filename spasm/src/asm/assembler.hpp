@@ -1,7 +1,11 @@
 #ifndef ASSEMBPLER_HPP
 #define ASSEMBPLER_HPP
 
+#include <array>
 #include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "bytecode.hpp"
 #include "symbol.hpp"
@@ -19,17 +23,32 @@ class Assembler
     void assemble();
 
    private:
-    void backpatch(const Symbol*);
+    void backpatch();
     void assemble_identifier(const Lexer::Token&);
+    void assemble_try();
+    void assemble_export();
+    Lexer::Token global_slot(const Lexer::Token& name);
+    size_t definition(const std::string& label) const;
 
     Lexer::Tokenizer* _tokenizer;
     Bytecode_Stream* _bytecode;
 
     Symbol_Table _symbols;
 
+    //! The labels of the try ranges, resolved after the code is assembled
+    std::vector<std::array<std::string, 3>> _try_ranges;
+
+    //! The slots of the globals by name, looked up by the view of a token
+    std::map<std::string, size_t, std::less<>> _globals;
+
+    //! The labels that other modules may call
+    std::vector<std::string> _exports;
+
 };  // class Assembler
 
 bool compile(std::istream&, Bytecode_Stream& bytecode);
+//! Assembles the file mapped in memory, false if it can not be mapped
+bool compile_file(const std::string& path, Bytecode_Stream& bytecode);
 }  // namespace ASM
 }  // namespace SpasmImpl
 
@@ -1,54 +1,291 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <new>
 #include <string>
+#include <system_error>
 #include <vector>
 
 #include "bytecode.hpp"
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 namespace SpasmImpl
 {
 namespace ASM
 {
 Bytecode_Stream::~Bytecode_Stream() {}
 
+union DoubleToBits {
+    double as_double;
+    int64_t as_bits;
+};
+
+int64_t to_bits(double d)
+{
+    DoubleToBits v;
+    v.as_double = d;
+    return v.as_bits;
+};
+
+const size_t Bytecode_File::HeaderSize;
+
 Bytecode_File::Bytecode_File(const std::string& filename)
-    : _bytecode(filename.c_str(), std::ios_base::out | std::ios_base::binary)
+    : _image(NULL),
+      _capacity(0),
+      _end(HeaderSize),
+#if defined(_WIN32)
+      _bytecode(filename.c_str(), std::ios_base::out | std::ios_base::binary),
+#else
+      _bytecode(open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)),
+#endif
+      _filename(filename)
 {
+    if (is_open())
+    {
+        try
+        {
+            reserve(0);
+        }
+        catch (const std::system_error&)
+        {
+            discard();
+        }
+        catch (const std::bad_alloc&)
+        {
+            discard();
+        }
+    }
 }
 
-void Bytecode_File::push_byte(Bytecode_Stream::byte byte)
+Bytecode_File::~Bytecode_File()
 {
-    _bytecode.put(byte);
+    discard();
 }
 
-void Bytecode_File::push_opcode(Bytecode_Stream::Opcode_t opcode)
+bool Bytecode_File::is_open() const
 {
-    push_byte(opcode);
+#if defined(_WIN32)
+    return _bytecode.is_open();
+#else
+    return _bytecode >= 0;
+#endif
 }
 
-union DoubleToBits {
-    double as_double;
-    int64_t as_bits;
-};
+/*!
+** Makes room for count more bytes after the end, the mapping is made
+** again over the longer file, so nothing is copied.
+** \return where the bytes go
+** \throw std::system_error if the file can not grow
+*/
+Bytecode_Stream::byte* Bytecode_File::reserve(size_t count)
+{
+    if (_end + count <= _capacity)
+    {
+        return _image + _end;
+    }
+    auto capacity = std::max(_capacity, size_t(1) << 20);
+    while (capacity < _end + count)
+    {
+        capacity *= 2;
+    }
+#if defined(_WIN32)
+    _buffer.resize(capacity);
+    _image = _buffer.data();
+#else
+    if (_image)
+    {
+        munmap(_image, _capacity);
+        _image = NULL;
+    }
+    // the blocks are allocated now, a full disk fails here and not with
+    // a SIGBUS on a store to a hole of the mapping
+    const auto error = posix_fallocate(_bytecode, off_t(_capacity),
+                                       off_t(capacity - _capacity));
+    if (error != 0)
+    {
+        throw std::system_error(error, std::generic_category(),
+                                "Can not grow " + _filename);
+    }
+    auto image = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      _bytecode, 0);
+    if (image == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::generic_category(),
+                                "Can not map " + _filename);
+    }
+    _image = static_cast<byte*>(image);
+#endif
+    _capacity = capacity;
+    return _image + _end;
+}
 
-int64_t to_bits(double d)
+void Bytecode_File::push_byte(Bytecode_Stream::byte byte)
 {
-    DoubleToBits v;
-    v.as_double = d;
-    return v.as_bits;
-};
+    *reserve(1) = byte;
+    ++_end;
+}
+
+void Bytecode_File::push_bytes(const void* bytes, size_t count)
+{
+    std::memcpy(reserve(count), bytes, count);
+    _end += count;
+}
+
+void Bytecode_File::push_opcode(Bytecode_Stream::Opcode_t opcode)
+{
+    push_byte(opcode);
+}
 
 void Bytecode_File::push_integer(int64_t number, int size)
 {
+    auto bytes = reserve(size_t(size));
     for (int i = 0; i < size; ++i)
-        push_byte((number >> (i << 3)) & 0xff);
+        bytes[i] = (number >> (i << 3)) & 0xff;
+    _end += size_t(size);
 }
 
 void Bytecode_File::push_double(double number)
 {
-    auto bits = to_bits(number);
-    for (size_t i = 0; i < sizeof(size_t); ++i)
-        push_byte((bits >> (i << 3)) & 0xff);
+    push_integer(to_bits(number), sizeof(size_t));
+}
+
+void Bytecode_File::push_location(size_t location)
+{
+    push_integer(int64_t(location), 1 << LocationSize);
+}
+
+void Bytecode_File::set_location(size_t index, size_t location)
+{
+    assert(index + (1 << LocationSize) <= size());
+    auto bytes = _image + HeaderSize + index;
+    for (int i = 0; i < (1 << LocationSize); ++i)
+        bytes[i] = ((location >> (i << 3)) & 0xff);
+}
+
+void Bytecode_File::push_string(const char* s, size_t length, int size)
+{
+    push_integer(int64_t(length), size);
+    push_bytes(s, length);
+}
+
+size_t Bytecode_File::size() const
+{
+    return _end - HeaderSize;
+}
+
+void Bytecode_File::push_handler(const Handler& handler)
+{
+    _handlers.push_back(handler);
+}
+
+void Bytecode_File::push_global(const std::string& name)
+{
+    _globals.push_back(name);
+}
+
+/*!
+** The tables need the file to grow as the code does, a file that can not
+** grow is discarded and close fails without throwing.
+*/
+bool Bytecode_File::close()
+{
+    if (!is_open())
+    {
+        return false;
+    }
+    if (!_image)
+    {
+        // the file could not grow
+        discard();
+        return false;
+    }
+    const auto code_size = size();
+    std::memcpy(_image, &code_size, sizeof(code_size));
+
+    try
+    {
+        push_tables();
+    }
+    catch (const std::system_error&)
+    {
+        discard();
+        return false;
+    }
+    catch (const std::bad_alloc&)
+    {
+        discard();
+        return false;
+    }
+
+#if defined(_WIN32)
+    const auto written = bool(
+        _bytecode.write(reinterpret_cast<const char*>(_image), _end));
+#else
+    munmap(_image, _capacity);
+    const auto written = ftruncate(_bytecode, off_t(_end)) == 0;
+#endif
+    close_file();
+    return written;
+}
+
+//! The handler table follows the code, the names of the global slots
+//! follow the handlers
+void Bytecode_File::push_tables()
+{
+    auto count = _handlers.size();
+    push_bytes(&count, sizeof(count));
+    for (const auto& handler : _handlers)
+    {
+        const size_t entry[] = {handler.begin, handler.end, handler.handler};
+        push_bytes(entry, sizeof(entry));
+    }
+
+    count = _globals.size();
+    push_bytes(&count, sizeof(count));
+    for (const auto& name : _globals)
+    {
+        const auto length = name.size();
+        push_bytes(&length, sizeof(length));
+        push_bytes(name.data(), length);
+    }
+}
+
+void Bytecode_File::discard()
+{
+    if (!is_open())
+    {
+        return;
+    }
+#if !defined(_WIN32)
+    if (_image)
+    {
+        munmap(_image, _capacity);
+    }
+#endif
+    close_file();
+    std::remove(_filename.c_str());
+}
+
+void Bytecode_File::close_file()
+{
+#if defined(_WIN32)
+    _bytecode.close();
+    _buffer = std::vector<byte>();
+#else
+    ::close(_bytecode);
+    _bytecode = -1;
+#endif
+    _image = NULL;
+    _capacity = 0;
 }
 
 void Bytecode_Memory::push_byte(Bytecode_Stream::byte byte)
@@ -76,28 +313,13 @@ void Bytecode_Memory::push_double(double number)
 
 void Bytecode_Memory::set_location(size_t index, size_t location)
 {
-    if (location <= 0xff)
-    {
-        _bytecode[index] = (byte)location;
-    }
-    else
-    {
-        for (size_t i = 0; i < sizeof(size_t); ++i)
-            _bytecode.at(index + i) = ((location >> (i << 3)) & 0xff);
-    }
+    for (int i = 0; i < (1 << LocationSize); ++i)
+        _bytecode.at(index + i) = ((location >> (i << 3)) & 0xff);
 }
 
 void Bytecode_Memory::push_location(size_t location)
 {
-    if (location <= 0xff)
-    {
-        push_byte((byte)location);
-    }
-    else
-    {
-        for (size_t i = 0; i < sizeof(size_t); ++i)
-            _bytecode.push_back((location >> (i << 3)) & 0xff);
-    }
+    push_integer(int64_t(location), 1 << LocationSize);
 }
 
 void Bytecode_Memory::push_string(const char* s, size_t length, int size)
@@ -116,5 +338,35 @@ size_t Bytecode_Memory::size() const
     return _bytecode.size();
 }
 
+void Bytecode_Memory::push_handler(const Handler& handler)
+{
+    _handlers.push_back(handler);
+}
+
+const Bytecode_Memory::Handlers& Bytecode_Memory::handlers() const
+{
+    return _handlers;
+}
+
+void Bytecode_Memory::push_global(const std::string& name)
+{
+    _globals.push_back(name);
+}
+
+const Bytecode_Memory::Globals& Bytecode_Memory::globals() const
+{
+    return _globals;
+}
+
+void Bytecode_Memory::push_export(const std::string& name, size_t location)
+{
+    _exports.push_back(Export{name, location});
+}
+
+const Bytecode_Memory::Exports& Bytecode_Memory::exports() const
+{
+    return _exports;
+}
+
 }  // namespace ASM
 }  // namespace SpasmImpl
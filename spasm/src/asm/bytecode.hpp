@@ -16,6 +16,9 @@ class Bytecode_Stream
     typedef uint8_t byte;
     typedef byte Opcode_t;
 
+    //! Size of the arguments of instructions with a location (4 bytes)
+    static const int LocationSize = 2;
+
     virtual ~Bytecode_Stream();
     virtual void push_opcode(Opcode_t) = 0;
     virtual void push_integer(int64_t, int size) = 0;
@@ -24,24 +27,102 @@ class Bytecode_Stream
     virtual void push_string(const char* s, size_t length, int size) = 0;
     virtual void set_location(size_t, size_t) = 0;
     virtual size_t size() const = 0;
+
+    //! An exception handler - the code in [begin, end) throws to handler
+    struct Handler
+    {
+        size_t begin;
+        size_t end;
+        size_t handler;
+    };
+    //! Adds an entry to the handler table that is kept beside the code
+    virtual void push_handler(const Handler&) = 0;
+
+    //! Adds the name of the next global slot
+    virtual void push_global(const std::string& name) = 0;
+
+    /*!
+    ** The references of the code, only a relocatable module keeps them,
+    ** see Object_Module. The positions are of the 4 byte arguments.
+    */
+    //! A location that is relative to the start of the code
+    virtual void push_relocation(size_t /*position*/) {}
+    //! A location of a label that is not defined in the code
+    virtual void push_import(const std::string& /*name*/, size_t /*position*/)
+    {
+    }
+    //! A label that other code may refer to
+    virtual void push_export(const std::string& /*name*/, size_t /*location*/)
+    {
+    }
+    //! A global slot
+    virtual void push_global_reference(size_t /*position*/) {}
 };  // class Bytecode_Stream
 
+//! Assembles a program straight into its file
+/*!
+** The file is the size of the code, the code, the handler table and the
+** names of the global slots, the layout that sprun loads. The file is
+** mapped and grows by doubling, so the locations are backpatched in place
+** and the image is never held in the memory of the process. Windows keeps
+** the image in a buffer and writes it once. The pushes throw
+** std::system_error when the file can not grow, close reports it.
+*/
 class Bytecode_File : public Bytecode_Stream
 {
    public:
-    Bytecode_File(const std::string&);
+    explicit Bytecode_File(const std::string&);
+    ~Bytecode_File() override;
+
+    //! Whether the file could be created
+    bool is_open() const;
+    //! Writes the tables after the code and gives the file its final size
+    bool close();
+    //! Closes the file without the tables and removes it
+    /*!
+    ** A file that is neither closed nor discarded is discarded when it is
+    ** destroyed, so a failed assembly leaves no program behind.
+    */
+    void discard();
 
     void push_opcode(Opcode_t) override;
     void push_integer(int64_t, int size) override;
     void push_double(double) override;
+    void push_location(size_t) override;
+    void set_location(size_t, size_t) override;
+    void push_string(const char* s, size_t length, int size) override;
+    size_t size() const override;
+    void push_handler(const Handler&) override;
+    void push_global(const std::string& name) override;
+    //! Appends count raw bytes to the code
+    void push_bytes(const void*, size_t);
 
    private:
     Bytecode_File(const Bytecode_File&);
     Bytecode_File& operator=(const Bytecode_File&);
     void push_byte(Bytecode_Stream::byte);
+    byte* reserve(size_t);
+    void push_tables();
+    void close_file();
+
+    //! The size of the code before it
+    static const size_t HeaderSize = sizeof(size_t);
 
+    //! the mapping or the buffer, with the header
+    byte* _image;
+    size_t _capacity;
+    size_t _end;
+
+#if defined(_WIN32)
     std::ofstream _bytecode;
+    std::vector<byte> _buffer;
+#else
+    int _bytecode;
+#endif
 
+    std::string _filename;
+    std::vector<Handler> _handlers;
+    std::vector<std::string> _globals;
 };  // class Bytecode_File
 
 class Bytecode_Memory : public Bytecode_Stream
@@ -54,14 +135,36 @@ class Bytecode_Memory : public Bytecode_Stream
     void set_location(size_t, size_t) override;
     void push_string(const char* s, size_t length, int size) override;
     size_t size() const override;
+    void push_handler(const Handler&) override;
+    void push_global(const std::string& name) override;
+    void push_export(const std::string& name, size_t location) override;
 
     typedef std::vector<Bytecode_Stream::byte> Bytecode;
     const Bytecode& bytecode() const;
 
-   private:
+    typedef std::vector<Handler> Handlers;
+    const Handlers& handlers() const;
+
+    typedef std::vector<std::string> Globals;
+    //! The names of the global slots, in slot order
+    const Globals& globals() const;
+
+    //! A label that the embedder or other modules may call
+    struct Export
+    {
+        std::string name;
+        size_t location;
+    };
+    typedef std::vector<Export> Exports;
+    const Exports& exports() const;
+
+   protected:
     void push_byte(Bytecode_Stream::byte);
 
     std::vector<Bytecode_Stream::byte> _bytecode;
+    Handlers _handlers;
+    Globals _globals;
+    Exports _exports;
 };  // class Bytecode_Memory
 }  // namespace ASM
 }  // namespace SpasmImpl
@@ -1,3 +1,5 @@
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 
@@ -35,9 +37,16 @@ using namespace SpasmImpl::ASM::Lexer;
 class TokenDumper : public TokenStream
 {
    public:
-    TokenDumper() : end_reached(false) {}
+    explicit TokenDumper(bool dump) : end_reached(false), dump(dump), count(0)
+    {
+    }
     void push_token(const Token& token)
     {
+        ++count;
+        if (token.type() == Token::EndInput)
+            end_reached = true;
+        if (!dump)
+            return;
         Token::Token_type ttype = token.type();
         std::cout.width(8);
         std::cout << token.lineno();
@@ -47,14 +56,15 @@ class TokenDumper : public TokenStream
         else if (ttype == Token::Ident)
             std::cout << '|' << token.value_str() << '|';
         std::cout << std::endl;
-        if (token.type() == Token::EndInput)
-            end_reached = true;
     }
 
     bool input_end() const { return end_reached; }
+    size_t tokens() const { return count; }
 
    private:
     bool end_reached;
+    bool dump;
+    size_t count;
 
     static const char* token_name[24];
 };
@@ -65,13 +75,33 @@ const char* TokenDumper::token_name[24] = {"halt",
 #undef TOK
                                            "notused!!!"};
 
-int main()
+/*!
+** lexdump [-c] [file] - dumps the tokens of the file or of the standard
+** input, the file is mapped. -c only counts the tokens and prints the
+** tokens per second.
+*/
+int main(int argc, const char* argv[])
 {
-    Lexer lex(std::cin);
-    TokenDumper td;
-    Token token;
+    const bool count = argc > 1 && !std::strcmp(argv[1], "-c");
+    const char* path = argc > 1 + count ? argv[1 + count] : nullptr;
+    Lexer mapped;
+    Lexer streamed(std::cin);
+    Lexer& lex = path ? mapped : streamed;
+    TokenDumper td(!count);
 
-    lex.buffer_init();
+    const auto start = std::chrono::steady_clock::now();
+    if (path)
+    {
+        if (!lex.map_file(path))
+        {
+            std::cerr << "Can not map " << path << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        lex.buffer_init();
+    }
 
     while (!td.input_end())
     {
@@ -79,5 +109,13 @@ int main()
         lex.tokenize(td);
     }
 
+    if (count)
+    {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << td.tokens() << " tokens in " << elapsed.count()
+                  << " s, " << td.tokens() / elapsed.count() << " tokens/s"
+                  << std::endl;
+    }
     return 0;
 }
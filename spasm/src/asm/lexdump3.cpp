@@ -1,5 +1,8 @@
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 
 #include <cassert>
 
@@ -38,15 +41,42 @@ const char* token_name[24] = {"halt",
 #undef TOK
                               "notused!!!"};
 
-int main()
+/*!
+** lexdump3 [-c] [file] - dumps the tokens of the file or of the standard
+** input through the tokenizer, the file is mapped. -c only counts the
+** tokens and prints the tokens per second.
+*/
+int main(int argc, const char* argv[])
 {
-    Tokenizer td(std::cin);
+    const bool count = argc > 1 && !std::strcmp(argv[1], "-c");
+    const char* path = argc > 1 + count ? argv[1 + count] : nullptr;
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Tokenizer> tokenizer;
+    if (path)
+    {
+        std::unique_ptr<Lexer> lexer(new Lexer);
+        if (!lexer->map_file(path))
+        {
+            std::cerr << "Can not map " << path << std::endl;
+            return 1;
+        }
+        tokenizer.reset(new Tokenizer(std::move(lexer)));
+    }
+    else
+    {
+        tokenizer.reset(new Tokenizer(std::cin));
+    }
+    Tokenizer& td = *tokenizer;
     Token token;
+    size_t tokens = 1;
 
     token = td.next_token();
     while (token.type() != Token::EndInput)
     {
         token = td.next_token();
+        ++tokens;
+        if (count)
+            continue;
         Token::Token_type ttype = token.type();
         std::cout.width(8);
         std::cout << token.lineno();
@@ -58,5 +88,12 @@ int main()
         std::cout << std::endl;
     }
 
+    if (count)
+    {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << tokens << " tokens in " << elapsed.count() << " s, "
+                  << tokens / elapsed.count() << " tokens/s" << std::endl;
+    }
     return 0;
 }
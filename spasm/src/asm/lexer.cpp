@@ -22,7 +22,7 @@ Lexer::Lexer(std::istream& _file, size_t _buffer_size)
 
 Lexer::~Lexer()
 {
-    delete[] buffer;
+    release();
 }
 
 bool Lexer::tokenize(TokenStream& ts)
@@ -372,7 +372,8 @@ bool Lexer::tokenize(TokenStream& ts)
         yy26:
 #line 252 "lexer.re"
         {
-            ts.push_token(Token(Token::Ident, lineno, token_start, cursor));
+            ts.push_token(Token(Token::keyword(token_start, cursor), lineno,
+                                token_start, cursor));
             token_start = cursor;
 
             continue;
@@ -3059,7 +3060,7 @@ void Lexer::buffer_grow(size_t new_size)
 
     token_start = new_buffer + (token_start - buffer);
     cursor = new_buffer + (cursor - buffer);
-    limit = new_buffer + new_size;
+    limit = new_buffer + (limit - buffer);
 
     buffer_size = new_size;
 
@@ -3069,15 +3070,23 @@ void Lexer::buffer_grow(size_t new_size)
 
 void Lexer::read(size_t nbytes)
 {
-    if (token_start + nbytes > limit)
-    {  // we need larger buffer
-        buffer_grow(token_start - buffer + nbytes);
+    if (mapped)
+    {  // the whole input is there, only the limit moves
+        advance_window();
+        return;
+    }
+
+    if (size_t(token_start - buffer) < nbytes)
+    {  // the token fills the buffer, we need larger buffer
+        buffer_grow(buffer_size * 2 + nbytes);
     }
 
     std::copy(token_start, limit, buffer);
-    cursor -= token_start - buffer;
+    // the scanner keeps no state, so a cut token is scanned again
+    cursor = marker = buffer;
     char* old_limit = limit - (token_start - buffer);
     token_start = buffer;
+    limit = buffer + buffer_size;
 
     file->read(old_limit, limit - old_limit);
     if (file->eof())
@@ -2,6 +2,7 @@
 #define LEXER_HPP
 
 #include <iostream>
+#include <string>
 
 #include "token.hpp"
 
@@ -20,6 +21,8 @@ class Lexer
 {
    public:
     Lexer(std::istream&, size_t = 4096);
+    //! A lexer for map_file
+    Lexer();
     ~Lexer();
     bool tokenize(TokenStream&);
 
@@ -27,11 +30,34 @@ class Lexer
     void read(size_t = 1);
     void buffer_init();
 
+    //! Lexes the whole file in place instead of a stream
+    /*!
+    ** The file is mapped and followed by zero bytes, the first of them is
+    ** the sentinel that ends the input. The scanner never copies or reads
+    ** the input, read only moves the limit along the mapping a window at a
+    ** time, which keeps the batches of tokens small. Returns false if the
+    ** file can not be mapped.
+    */
+    bool map_file(const std::string& path);
+
+    //! Whether the lexer scans a mapped file
+    bool is_mapped() const { return mapped; }
+
+    //! Whether the token cut by the limit runs into the end of the input
+    bool exhausted() const;
+
    private:
     Lexer(const Lexer&);
     Lexer& operator=(const Lexer&);
 
     void buffer_grow(size_t);
+    void advance_window();
+    void release();
+
+    //! The zero bytes after a mapped file, at least the longest lookahead
+    static const size_t Padding = 8;
+    //! The bytes between the cursor and the limit of a mapped file
+    static const size_t Window = 1 << 16;
 
     //! input stream for the lexer
     std::istream* file;
@@ -59,6 +85,12 @@ class Lexer
 
     //! number of current line
     size_t lineno;
+
+    //! whether the buffer is a mapped file, see map_file
+    bool mapped = false;
+
+    //! the bytes of the mapping, a multiple of the page
+    size_t mapping_size = 0;
 };
 }  // namespace Lexer
 }  // namespace ASM
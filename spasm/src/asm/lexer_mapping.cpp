@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <fstream>
+
+#include "lexer.hpp"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+namespace Lexer
+{
+const size_t Lexer::Padding;
+const size_t Lexer::Window;
+
+Lexer::Lexer()
+    : file(NULL),
+      buffer(NULL),
+      buffer_size(0),
+      cursor(NULL),
+      limit(NULL),
+      marker(NULL),
+      token_start(NULL),
+      state(unsigned(-1)),
+      lineno(0)
+{
+}
+
+/*!
+** The file is mapped over the start of zero pages, so the padding after it
+** is mapped as well, even when the file ends on a page boundary. Windows
+** can not map a file over other pages, so there the file is read once.
+*/
+bool Lexer::map_file(const std::string& path)
+{
+    release();
+#if defined(_WIN32)
+    std::ifstream input(path, std::ios_base::in | std::ios_base::binary);
+    if (!input)
+    {
+        return false;
+    }
+    input.seekg(0, std::ios_base::end);
+    const auto size = size_t(input.tellg());
+    input.seekg(0, std::ios_base::beg);
+    buffer = new char[size + Padding]();
+    if (!input.read(buffer, std::streamsize(size)))
+    {
+        release();
+        return false;
+    }
+#else
+    const auto input = open(path.c_str(), O_RDONLY);
+    if (input < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    if (fstat(input, &status) != 0)
+    {
+        close(input);
+        return false;
+    }
+    const auto size = size_t(status.st_size);
+    const auto page = size_t(sysconf(_SC_PAGESIZE));
+    const auto length = (size + Padding + page - 1) / page * page;
+    auto region = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+    if (region == MAP_FAILED)
+    {
+        close(input);
+        return false;
+    }
+    if (size && mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, input,
+                     0) == MAP_FAILED)
+    {
+        munmap(region, length);
+        close(input);
+        return false;
+    }
+    // the mapping stays valid after the file is closed
+    close(input);
+    madvise(region, length, MADV_SEQUENTIAL);
+    buffer = static_cast<char*>(region);
+    mapping_size = length;
+#endif
+    mapped = true;
+    buffer_size = size + Padding;
+    cursor = marker = token_start = limit = buffer;
+    state = unsigned(-1);
+    lineno = 0;
+    return true;
+}
+
+bool Lexer::exhausted() const
+{
+    if (mapped)
+    {
+        return limit == buffer + buffer_size;
+    }
+    // the stream has ended and the token is already at the start of the
+    // buffer, but it still runs over the zeros after the input
+    return file->eof() && token_start == buffer &&
+           std::find(buffer, limit, '\0') != limit;
+}
+
+//! Moves the limit of a mapped file a window further, up to the padding
+void Lexer::advance_window()
+{
+    limit += std::min(Window, size_t(buffer + buffer_size - limit));
+    // the scanner keeps no state, so a cut token is scanned again
+    cursor = marker = token_start;
+}
+
+void Lexer::release()
+{
+#if !defined(_WIN32)
+    if (mapping_size)
+    {
+        munmap(buffer, mapping_size);
+    }
+    else
+#endif
+    {
+        delete[] buffer;
+    }
+    buffer = NULL;
+    mapping_size = 0;
+    mapped = false;
+}
+}  // namespace Lexer
+}  // namespace ASM
+}  // namespace SpasmImpl
@@ -0,0 +1,248 @@
+#include <cassert>
+#include <cstring>
+
+#include "linker.hpp"
+#include "token.hpp"
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+const size_t Linker::Unbound;
+const size_t Linker::NotPlaced;
+
+void Linker::Program::append(const Bytecode& code)
+{
+    _bytecode.insert(_bytecode.end(), code.begin(), code.end());
+}
+
+void Linker::add(const Object_Module& module)
+{
+    const auto index = _modules.size();
+    _modules.push_back(&module);
+    _bases.push_back(NotPlaced);
+    for (const auto& symbol : module.exports())
+    {
+        if (!_exports.emplace(symbol.name, Export{index, symbol.location})
+                 .second)
+        {
+            _duplicates.push_back(symbol.name);
+        }
+    }
+}
+
+/*!
+** The globals of all the modules are known before any is placed, so the
+** slots of the program do not depend on the order the modules are placed.
+*/
+static void merge_globals(
+    const std::vector<const Object_Module*>& modules,
+    std::unordered_map<std::string, size_t>& slots,
+    Bytecode_Memory& program)
+{
+    for (const auto module : modules)
+    {
+        for (const auto& name : module->globals())
+        {
+            if (slots.emplace(name, slots.size()).second)
+            {
+                program.push_global(name);
+            }
+        }
+    }
+}
+
+bool Linker::link()
+{
+    assert(_program.size() == 0 && "The program is already linked");
+    if (!_duplicates.empty())
+    {
+        return false;
+    }
+    _lazy = false;
+    merge_globals(_modules, _global_slots, _program);
+    for (size_t i = 0; i < _modules.size(); ++i)
+    {
+        place(i);
+    }
+    bool resolved = true;
+    for (size_t i = 0; i < _modules.size(); ++i)
+    {
+        resolved = resolve_imports(i) && resolved;
+    }
+    return resolved;
+}
+
+bool Linker::link_lazy()
+{
+    assert(_program.size() == 0 && "The program is already linked");
+    if (!_duplicates.empty())
+    {
+        return false;
+    }
+    _lazy = true;
+    merge_globals(_modules, _global_slots, _program);
+    if (_modules.empty())
+    {
+        return true;
+    }
+    place(0);
+    return resolve_imports(0);
+}
+
+size_t Linker::bind(size_t target, size_t site)
+{
+    if (target < Unbound || target - Unbound >= _unbound.size())
+    {
+        return Unbound;
+    }
+    const auto& name = _unbound[target - Unbound];
+    const auto symbol = _exports.find(name);
+    if (symbol == _exports.end())
+    {
+        _unresolved.push_back(name);
+        return Unbound;
+    }
+    const auto module = symbol->second.module;
+    if (_bases[module] == NotPlaced)
+    {
+        place(module);
+        if (!resolve_imports(module))
+        {
+            return Unbound;
+        }
+    }
+    const auto location = _bases[module] + symbol->second.location;
+    _program.set_location(site, location);
+    return location;
+}
+
+const Bytecode_Memory& Linker::program() const
+{
+    return _program;
+}
+
+bool Linker::is_placed(size_t module) const
+{
+    return _bases.at(module) != NotPlaced;
+}
+
+std::shared_ptr<const Bytecode_Stream::byte> Linker::image() const
+{
+    const auto& code = _program.bytecode();
+    std::shared_ptr<Bytecode_Stream::byte> image(
+        new Bytecode_Stream::byte[code.size()],
+        std::default_delete<Bytecode_Stream::byte[]>());
+    if (!code.empty())
+    {
+        std::memcpy(image.get(), code.data(), code.size());
+    }
+    return image;
+}
+
+const std::vector<std::string>& Linker::unresolved() const
+{
+    return _unresolved;
+}
+
+const std::vector<std::string>& Linker::duplicates() const
+{
+    return _duplicates;
+}
+
+//! Appends the code of the module and moves its references into the program
+void Linker::place(size_t index)
+{
+    const auto& module = *_modules[index];
+    const auto& code = module.bytecode();
+    const auto base = _program.size();
+    _bases[index] = base;
+    _program.append(code);
+
+    for (auto position : module.relocations())
+    {
+        _program.set_location(base + position,
+                              base + read_location(code, position));
+    }
+    for (auto position : module.global_references())
+    {
+        const auto& name = module.globals().at(read_location(code, position));
+        _program.set_location(base + position, _global_slots.at(name));
+    }
+    for (auto handler : module.handlers())
+    {
+        handler.begin += base;
+        handler.end += base;
+        handler.handler += base;
+        _program.push_handler(handler);
+    }
+    for (const auto& symbol : module.exports())
+    {
+        _program.push_export(symbol.name, base + symbol.location);
+    }
+}
+
+//! Whether the location at position is the target of a call instruction
+static bool is_call(const Bytecode_Memory::Bytecode& code, size_t position)
+{
+    // the location of a call is the only argument, so it follows the opcode
+    const auto size = Bytecode_Stream::LocationSize << 6;
+    return position > 0 &&
+           (code[position - 1] == (size | Lexer::Token::Call) ||
+            code[position - 1] == (size | Lexer::Token::TailCall));
+}
+
+/*!
+** In a lazy link the calls to the modules that are not placed stay unbound,
+** the other references place the module of the symbol.
+*/
+bool Linker::resolve_imports(size_t index)
+{
+    const auto& module = *_modules[index];
+    const auto base = _bases[index];
+    bool resolved = true;
+    for (const auto& import : module.imports())
+    {
+        const auto position = base + import.position;
+        const auto symbol = _exports.find(import.name);
+        if (symbol == _exports.end())
+        {
+            if (_lazy && is_call(module.bytecode(), import.position))
+            {
+                // fails when called
+                _program.set_location(position, unbound(import.name));
+                continue;
+            }
+            _unresolved.push_back(import.name);
+            resolved = false;
+            continue;
+        }
+        const auto target = symbol->second.module;
+        if (_bases[target] == NotPlaced)
+        {
+            if (is_call(module.bytecode(), import.position))
+            {
+                _program.set_location(position, unbound(import.name));
+                continue;
+            }
+            place(target);
+            resolved = resolve_imports(target) && resolved;
+        }
+        _program.set_location(position,
+                              _bases[target] + symbol->second.location);
+    }
+    return resolved;
+}
+
+size_t Linker::unbound(const std::string& name)
+{
+    auto index = _unbound_index.find(name);
+    if (index == _unbound_index.end())
+    {
+        index = _unbound_index.emplace(name, _unbound.size()).first;
+        _unbound.push_back(name);
+    }
+    return Unbound + index->second;
+}
+}  // namespace ASM
+}  // namespace SpasmImpl
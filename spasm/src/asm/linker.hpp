@@ -0,0 +1,116 @@
+#ifndef LINKER_HPP
+#define LINKER_HPP
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "object_module.hpp"
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+//! Places object modules in a single program
+/*!
+** Each placed module is appended to the code of the program, its locations
+** are moved by its start, its imports get the locations of the exports of
+** the other modules and its global slots are renumbered by name into the
+** globals of the program. The first module is the entry of the program.
+**
+** A lazy link places only the entry module. The calls to the modules that
+** are not placed go to Unbound + the index of the called symbol, which is
+** past the end of the code. The VM hands such calls to bind, which places
+** the module of the symbol and patches the call, so a module that is never
+** called is never placed. The other references to a module, e.g. jumps or
+** spawns, place it right away.
+**
+** A symbol exported by two modules fails both links, see duplicates.
+*/
+class Linker
+{
+   public:
+    //! The modules must outlive the linker
+    void add(const Object_Module& module);
+
+    //! Places all the modules
+    /*!
+    ** \return false if a module imports a symbol that is not exported or
+    ** a symbol is exported twice
+    */
+    bool link();
+
+    //! Places the entry module and the modules it refers to but not calls
+    /*!
+    ** \return false if a module refers to a symbol that is not exported or
+    ** a symbol is exported twice
+    */
+    bool link_lazy();
+
+    //! The locations of the calls that are not bound start here
+    static const size_t Unbound = 0x40000000;
+
+    //! Places the module of an unbound call and patches the call
+    /*!
+    ** \param target - the location of the call
+    ** \param site - the position of the location in the code
+    ** \return the location of the symbol or Unbound if it is not exported
+    */
+    size_t bind(size_t target, size_t site);
+
+    //! The code, handlers, globals and exports of the program
+    const Bytecode_Memory& program() const;
+
+    //! A copy of the code of the program that a machine can own
+    /*!
+    ** The code of program() moves when a module is placed, so a lazily
+    ** linked program is handed to the machine by a new image per bind.
+    */
+    std::shared_ptr<const Bytecode_Stream::byte> image() const;
+
+    //! Whether the module with the index (in the order of add) is placed
+    bool is_placed(size_t module) const;
+
+    //! The symbols that were not found by the last link or bind
+    const std::vector<std::string>& unresolved() const;
+
+    //! The symbols exported by more than one module
+    const std::vector<std::string>& duplicates() const;
+
+   private:
+    struct Export
+    {
+        size_t module;
+        size_t location;
+    };
+
+    void place(size_t module);
+    bool resolve_imports(size_t module);
+    size_t unbound(const std::string& name);
+
+    static const size_t NotPlaced = ~size_t(0);
+
+    class Program : public Bytecode_Memory
+    {
+       public:
+        void append(const Bytecode& code);
+    };
+
+    std::vector<const Object_Module*> _modules;
+    //! The starts of the modules in the program or NotPlaced
+    std::vector<size_t> _bases;
+    std::unordered_map<std::string, Export> _exports;
+    std::unordered_map<std::string, size_t> _global_slots;
+    //! The symbols of the unbound calls by index
+    std::vector<std::string> _unbound;
+    std::unordered_map<std::string, size_t> _unbound_index;
+    std::vector<std::string> _unresolved;
+    std::vector<std::string> _duplicates;
+    bool _lazy = false;
+    Program _program;
+};  // class Linker
+}  // namespace ASM
+}  // namespace SpasmImpl
+
+#endif  // LINKER_HPP
@@ -1,22 +1,135 @@
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <new>
+#include <system_error>
 #include "assembler.hpp"
+#include "linker.hpp"
+#include "object_module.hpp"
 
+static bool write_program(const char* path,
+                          const SpasmImpl::ASM::Bytecode_Memory& bytecode)
+{
+    SpasmImpl::ASM::Bytecode_File output(path);
+    if (!output.is_open())
+    {
+        return false;
+    }
+    try
+    {
+        const auto& code = bytecode.bytecode();
+        output.push_bytes(code.data(), code.size());
+    }
+    catch (const std::system_error&)
+    {
+        return false;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return false;
+    }
+    for (const auto& handler : bytecode.handlers())
+    {
+        output.push_handler(handler);
+    }
+    for (const auto& name : bytecode.globals())
+    {
+        output.push_global(name);
+    }
+    return output.close();
+}
+
+/*!
+** spasm source program - assembles a program
+** spasm -c source module - assembles a module to link later
+** spasm -l program module... - links the modules, the first is the entry
+*/
 int main(int argc, const char* argv[])
 {
+    if (argc > 2 && !std::strcmp(argv[1], "-l"))
+    {
+        std::deque<SpasmImpl::ASM::Object_Module> modules;
+        SpasmImpl::ASM::Linker linker;
+        for (int i = 3; i < argc; ++i)
+        {
+            std::ifstream input(argv[i], std::ios_base::binary);
+            modules.emplace_back();
+            if (!modules.back().load(input))
+            {
+                std::cerr << "Not a module: " << argv[i] << std::endl;
+                return 1;
+            }
+            linker.add(modules.back());
+        }
+        if (!linker.link())
+        {
+            for (const auto& name : linker.duplicates())
+                std::cerr << "Duplicate symbol: " << name << std::endl;
+            for (const auto& name : linker.unresolved())
+                std::cerr << "Unresolved symbol: " << name << std::endl;
+            return 1;
+        }
+        if (!write_program(argv[2], linker.program()))
+        {
+            std::cerr << "Can not write: " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc == 4 && !std::strcmp(argv[1], "-c"))
+    {
+        SpasmImpl::ASM::Object_Module module;
+        if (!SpasmImpl::ASM::compile_file(argv[2], module))
+        {
+            std::cerr << "Can not read: " << argv[2] << std::endl;
+            return 1;
+        }
+        std::ofstream output(argv[3],
+                             std::ios_base::out | std::ios_base::binary);
+        module.save(output);
+        return 0;
+    }
     if (argc != 3)
         return 1;
-    SpasmImpl::ASM::Bytecode_Memory bytecode;
-    std::ifstream input(argv[1]);
-    SpasmImpl::ASM::compile(input, bytecode);
-
-    std::ofstream output(argv[2], std::ios_base::out | std::ios_base::binary);
-
-    // output.write ("SPASM", 5);
-    auto& bc = bytecode.bytecode();
-    auto size = bc.size();
-    output.write(reinterpret_cast<const char*>(&size), sizeof(size));
-    output.write(reinterpret_cast<const char*>(bc.data()), size);
-
+    // the output is truncated when it is opened, so the source goes first
+    if (!std::ifstream(argv[1]))
+    {
+        std::cerr << "Can not read: " << argv[1] << std::endl;
+        return 1;
+    }
+    SpasmImpl::ASM::Bytecode_File bytecode(argv[2]);
+    if (!bytecode.is_open())
+    {
+        std::cerr << "Can not write: " << argv[2] << std::endl;
+        return 1;
+    }
+    // a failed program is discarded with its file
+    try
+    {
+        if (!SpasmImpl::ASM::compile_file(argv[1], bytecode))
+        {
+            std::cerr << "Can not read: " << argv[1] << std::endl;
+            bytecode.discard();
+            return 1;
+        }
+    }
+    catch (const std::system_error& error)
+    {
+        std::cerr << error.what() << std::endl;
+        bytecode.discard();
+        return 1;
+    }
+    catch (const std::bad_alloc&)
+    {
+        std::cerr << "Out of memory: " << argv[1] << std::endl;
+        bytecode.discard();
+        return 1;
+    }
+    if (!bytecode.close())
+    {
+        std::cerr << "Can not write: " << argv[2] << std::endl;
+        return 1;
+    }
     return 0;
 }
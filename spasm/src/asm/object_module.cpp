@@ -0,0 +1,241 @@
+#include <cstring>
+
+#include "object_module.hpp"
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+void Object_Module::push_relocation(size_t position)
+{
+    _relocations.push_back(position);
+}
+
+void Object_Module::push_import(const std::string& name, size_t position)
+{
+    _imports.push_back(Symbol_Reference{name, position});
+}
+
+void Object_Module::push_global_reference(size_t position)
+{
+    _global_references.push_back(position);
+}
+
+const Object_Module::Positions& Object_Module::relocations() const
+{
+    return _relocations;
+}
+
+const Object_Module::Symbols& Object_Module::imports() const
+{
+    return _imports;
+}
+
+const Object_Module::Positions& Object_Module::global_references() const
+{
+    return _global_references;
+}
+
+namespace
+{
+const char Magic[] = "SPOBJ";
+const size_t MagicSize = sizeof(Magic) - 1;
+
+void write_size(std::ostream& output, size_t value)
+{
+    output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void write_string(std::ostream& output, const std::string& s)
+{
+    write_size(output, s.size());
+    output.write(s.data(), s.size());
+}
+
+void write_positions(std::ostream& output,
+                     const Object_Module::Positions& positions)
+{
+    write_size(output, positions.size());
+    for (auto position : positions)
+    {
+        write_size(output, position);
+    }
+}
+
+void write_symbols(std::ostream& output, const Object_Module::Symbols& symbols)
+{
+    write_size(output, symbols.size());
+    for (const auto& symbol : symbols)
+    {
+        write_string(output, symbol.name);
+        write_size(output, symbol.position);
+    }
+}
+
+bool read_size(std::istream& input, size_t& value)
+{
+    return bool(input.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+bool read_string(std::istream& input, std::string& s)
+{
+    size_t length;
+    if (!read_size(input, length))
+    {
+        return false;
+    }
+    s.resize(length);
+    return bool(input.read(&s[0], length));
+}
+
+bool read_positions(std::istream& input, Object_Module::Positions& positions)
+{
+    size_t count;
+    if (!read_size(input, count))
+    {
+        return false;
+    }
+    positions.resize(count);
+    for (auto& position : positions)
+    {
+        if (!read_size(input, position))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool read_symbols(std::istream& input, Object_Module::Symbols& symbols)
+{
+    size_t count;
+    if (!read_size(input, count))
+    {
+        return false;
+    }
+    symbols.resize(count);
+    for (auto& symbol : symbols)
+    {
+        if (!read_string(input, symbol.name) ||
+            !read_size(input, symbol.position))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+/*!
+** The module is the code, the handlers and the globals as in an assembled
+** program, followed by the tables of the references.
+*/
+void Object_Module::save(std::ostream& output) const
+{
+    output.write(Magic, MagicSize);
+    write_size(output, _bytecode.size());
+    output.write(reinterpret_cast<const char*>(_bytecode.data()),
+                 _bytecode.size());
+
+    write_size(output, _handlers.size());
+    for (const auto& handler : _handlers)
+    {
+        write_size(output, handler.begin);
+        write_size(output, handler.end);
+        write_size(output, handler.handler);
+    }
+
+    write_size(output, _globals.size());
+    for (const auto& name : _globals)
+    {
+        write_string(output, name);
+    }
+
+    write_positions(output, _relocations);
+    write_symbols(output, _imports);
+    write_size(output, _exports.size());
+    for (const auto& symbol : _exports)
+    {
+        write_string(output, symbol.name);
+        write_size(output, symbol.location);
+    }
+    write_positions(output, _global_references);
+}
+
+bool Object_Module::load(std::istream& input)
+{
+    char magic[MagicSize];
+    if (!input.read(magic, MagicSize) ||
+        std::memcmp(magic, Magic, MagicSize) != 0)
+    {
+        return false;
+    }
+
+    size_t size;
+    if (!read_size(input, size))
+    {
+        return false;
+    }
+    _bytecode.resize(size);
+    if (!input.read(reinterpret_cast<char*>(_bytecode.data()), size))
+    {
+        return false;
+    }
+
+    size_t count;
+    if (!read_size(input, count))
+    {
+        return false;
+    }
+    _handlers.resize(count);
+    for (auto& handler : _handlers)
+    {
+        if (!read_size(input, handler.begin) ||
+            !read_size(input, handler.end) ||
+            !read_size(input, handler.handler))
+        {
+            return false;
+        }
+    }
+
+    if (!read_size(input, count))
+    {
+        return false;
+    }
+    _globals.resize(count);
+    for (auto& name : _globals)
+    {
+        if (!read_string(input, name))
+        {
+            return false;
+        }
+    }
+
+    if (!read_positions(input, _relocations) ||
+        !read_symbols(input, _imports) || !read_size(input, count))
+    {
+        return false;
+    }
+    _exports.resize(count);
+    for (auto& symbol : _exports)
+    {
+        if (!read_string(input, symbol.name) ||
+            !read_size(input, symbol.location))
+        {
+            return false;
+        }
+    }
+    return read_positions(input, _global_references);
+}
+
+size_t read_location(const Bytecode_Memory::Bytecode& code, size_t position)
+{
+    size_t location = 0;
+    for (int i = 0; i < (1 << Bytecode_Stream::LocationSize); ++i)
+    {
+        location |= size_t(code.at(position + i)) << (i << 3);
+    }
+    return location;
+}
+}  // namespace ASM
+}  // namespace SpasmImpl
@@ -0,0 +1,59 @@
+#ifndef OBJECT_MODULE_HPP
+#define OBJECT_MODULE_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bytecode.hpp"
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+//! Relocatable code of a separately compiled module
+/*!
+** The locations in the code are relative to the start of the module, the
+** global slots are numbered in the module and the labels that are not
+** defined are left for the other modules. The tables of the module tell
+** the linker where these references are, see Linker.
+*/
+class Object_Module : public Bytecode_Memory
+{
+   public:
+    void push_relocation(size_t position) override;
+    void push_import(const std::string& name, size_t position) override;
+    void push_global_reference(size_t position) override;
+
+    //! A reference to a label of another module
+    struct Symbol_Reference
+    {
+        std::string name;
+        size_t position;
+    };
+
+    typedef std::vector<size_t> Positions;
+    typedef std::vector<Symbol_Reference> Symbols;
+
+    const Positions& relocations() const;
+    const Symbols& imports() const;
+    const Positions& global_references() const;
+
+    //! Writes the module so it can be linked later
+    void save(std::ostream& output) const;
+    //! Reads a module written by save
+    /*! \return false if the input is not a module */
+    bool load(std::istream& input);
+
+   private:
+    Positions _relocations;
+    Symbols _imports;
+    Positions _global_references;
+};  // class Object_Module
+
+//! Reads the 4 byte location at position of the code
+size_t read_location(const Bytecode_Memory::Bytecode& code, size_t position);
+}  // namespace ASM
+}  // namespace SpasmImpl
+
+#endif  // OBJECT_MODULE_HPP
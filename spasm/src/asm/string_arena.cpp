@@ -0,0 +1,43 @@
+#include <algorithm>
+#include <cstring>
+
+#include "string_arena.hpp"
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+const size_t String_Arena::BlockSize;
+
+String_Arena::String_Arena() : _free(NULL), _left(0), _size(0) {}
+
+std::string_view String_Arena::copy(std::string_view s)
+{
+    if (s.size() > _left)
+    {
+        const auto size = std::max(BlockSize, s.size());
+        _blocks.emplace_back(new char[size]);
+        _free = _blocks.back().get();
+        _left = size;
+        _size = size;
+    }
+    std::memcpy(_free, s.data(), s.size());
+    const std::string_view copied(_free, s.size());
+    _free += s.size();
+    _left -= s.size();
+    return copied;
+}
+
+void String_Arena::clear()
+{
+    if (_blocks.empty())
+    {
+        return;
+    }
+    std::swap(_blocks.front(), _blocks.back());
+    _blocks.resize(1);
+    _free = _blocks.front().get();
+    _left = _size;
+}
+}  // namespace ASM
+}  // namespace SpasmImpl
@@ -0,0 +1,41 @@
+#ifndef STRING_ARENA_HPP
+#define STRING_ARENA_HPP
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace SpasmImpl
+{
+namespace ASM
+{
+//! Stable copies of strings in large blocks
+/*!
+** The copies live until the arena is cleared or freed and are never moved,
+** so views of them stay valid until then.
+*/
+class String_Arena
+{
+   public:
+    String_Arena();
+
+    std::string_view copy(std::string_view);
+    //! Drops all copies and keeps the last block for the next ones
+    void clear();
+
+   private:
+    String_Arena(const String_Arena&);
+    String_Arena& operator=(const String_Arena&);
+
+    static const size_t BlockSize = 1 << 16;
+
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    char* _free;
+    size_t _left;
+    //! the size of the last block
+    size_t _size;
+};
+}  // namespace ASM
+}  // namespace SpasmImpl
+
+#endif  // STRING_ARENA_HPP
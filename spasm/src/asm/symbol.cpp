@@ -1,5 +1,5 @@
-#include <list>
-#include <string>
+#include <cstdint>
+#include <string_view>
 
 #include "symbol.hpp"
 
@@ -7,17 +7,14 @@ namespace SpasmImpl
 {
 namespace ASM
 {
-const size_t Symbol::notdefined = 0xff;
-// const size_t Symbol::notdefined = ~0ull;
+const size_t Symbol::notdefined = ~size_t(0);
 
-Symbol::Symbol() : _definition(notdefined) {}
-
-Symbol::Symbol(const std::string& identifier, size_t definition)
-    : _identifier(identifier), _definition(definition)
+Symbol::Symbol(std::string_view identifier, size_t hash)
+    : _identifier(identifier), _hash(hash), _definition(notdefined)
 {
 }
 
-const std::string& Symbol::identifier() const
+std::string_view Symbol::identifier() const
 {
     return _identifier;
 }
@@ -32,25 +29,40 @@ void Symbol::define(size_t definition)
     _definition = definition;
 }
 
-size_t Symbol::add_position(size_t position)
-{
-    _positions.push_back(position);
-
-    return _definition;
-}
+Symbol_Table::Symbol_Table() : _slots(64, 0) {}
 
-Symbol::Positions_t::const_iterator Symbol::positions_begin() const
+//! FNV-1a, the labels are short
+size_t Symbol_Table::hash(std::string_view identifier)
 {
-    return _positions.begin();
+    uint64_t h = 14695981039346656037ull;
+    for (const auto c : identifier)
+    {
+        h = (h ^ uint8_t(c)) * 1099511628211ull;
+    }
+    return size_t(h);
 }
 
-Symbol::Positions_t::const_iterator Symbol::positions_end() const
+/*!
+** Probes the slots linearly from the hash.
+**
+** \return the slot of the identifier or the empty slot where it belongs
+*/
+size_t Symbol_Table::slot(std::string_view identifier, size_t hash) const
 {
-    return _positions.end();
+    const auto mask = _slots.size() - 1;
+    auto i = hash & mask;
+    while (_slots[i])
+    {
+        const auto& symbol = _symbols[_slots[i] - 1];
+        if (symbol._hash == hash && symbol._identifier == identifier)
+        {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
 }
 
-Symbol_Table::Symbol_Table() {}
-
 /*!
 ** Search the table for symbol by identifier
 **
@@ -58,31 +70,64 @@ Symbol_Table::Symbol_Table() {}
 **
 ** \return pointer to the symbol if it exists or NULL otherwise.
 */
-Symbol* Symbol_Table::find(const std::string& identifier) const
+const Symbol* Symbol_Table::find(std::string_view identifier) const
 {
-    const_iterator i = _table.find(identifier);
-    return (i != _table.end()) ? i->second : NULL;
+    const auto i = slot(identifier, hash(identifier));
+    return _slots[i] ? &_symbols[_slots[i] - 1] : NULL;
 }
 
 /*!
-** Insert symbol with identifier indentifier on position position
-** of just add new position for symbol.
-** \param identifier - identifer of the symbol
-** \param position - position of the symbol
+** Finds the symbol or adds it with a copy of the identifier.
 **
-** \return pointer to the symbol
+** \return the index of the symbol
 */
-Symbol* Symbol_Table::insert(const std::string& identifier, size_t position)
+size_t Symbol_Table::intern(std::string_view identifier)
 {
-    Symbol* psymbol = find(identifier);
-    if (psymbol == NULL)
+    const auto h = hash(identifier);
+    auto i = slot(identifier, h);
+    if (_slots[i])
+    {
+        return _slots[i] - 1;
+    }
+    // at most half of the slots are used, so the probes stay short
+    if (2 * (_symbols.size() + 1) > _slots.size())
     {
-        psymbol = new Symbol(identifier);
-        _table.insert(std::make_pair(identifier, psymbol));
+        grow();
+        i = slot(identifier, h);
     }
-    psymbol->add_position(position);
+    _symbols.emplace_back(_identifiers.copy(identifier), h);
+    _slots[i] = _symbols.size();
+    return _symbols.size() - 1;
+}
 
-    return psymbol;
+void Symbol_Table::grow()
+{
+    std::vector<size_t> slots(_slots.size() * 2, 0);
+    const auto mask = slots.size() - 1;
+    for (size_t index = 0; index < _symbols.size(); ++index)
+    {
+        auto i = _symbols[index]._hash & mask;
+        while (slots[i])
+        {
+            i = (i + 1) & mask;
+        }
+        slots[i] = index + 1;
+    }
+    _slots.swap(slots);
+}
+
+/*!
+** Records a use of symbol with identifier identifier on position position.
+** \param identifier - identifer of the symbol
+** \param position - position of the symbol
+**
+** \return pointer to the symbol
+*/
+Symbol* Symbol_Table::insert(std::string_view identifier, size_t position)
+{
+    const auto index = intern(identifier);
+    _fixups.push_back(Fixup{index, position});
+    return &_symbols[index];
 }
 
 /*!
@@ -93,29 +138,21 @@ Symbol* Symbol_Table::insert(const std::string& identifier, size_t position)
 **
 ** \return pointer to the symbol
 */
-Symbol* Symbol_Table::define(const std::string& identifier, size_t definition)
+Symbol* Symbol_Table::define(std::string_view identifier, size_t definition)
 {
-    Symbol* psymbol = find(identifier);
-    if (psymbol == NULL)
-    {
-        psymbol = new Symbol(identifier, definition);
-        _table.insert(std::make_pair(identifier, psymbol));
-    }
-    else
-        psymbol->define(definition);
-
-    return psymbol;
+    const auto index = intern(identifier);
+    _symbols[index].define(definition);
+    return &_symbols[index];
 }
 
-Symbol_Table::const_iterator Symbol_Table::begin() const
+const Symbol& Symbol_Table::symbol(size_t index) const
 {
-    return _table.begin();
+    return _symbols[index];
 }
 
-Symbol_Table::const_iterator Symbol_Table::end() const
+const Symbol_Table::Fixups_t& Symbol_Table::fixups() const
 {
-    return _table.end();
+    return _fixups;
 }
-
 }  // namespace ASM
 }  // namespace SpasmImpl
@@ -1,9 +1,10 @@
 #ifndef SYMBOL_HPP
 #define SYMBOL_HPP
 
-#include <list>
-#include <map>
-#include <string>
+#include <string_view>
+#include <vector>
+
+#include "string_arena.hpp"
 
 namespace SpasmImpl
 {
@@ -13,55 +14,74 @@ namespace ASM
 class Symbol
 {
    public:
-    typedef std::list<size_t> Positions_t;
     static const size_t notdefined;
-    Symbol();
-    Symbol(const std::string&, size_t = 0);
+    Symbol(std::string_view, size_t hash);
 
-    const std::string& identifier() const;
+    //! the interned identifier, it lives as long as the table
+    std::string_view identifier() const;
     size_t definition() const;
 
     void define(size_t);
 
-    size_t add_position(size_t);
-
-    Positions_t::const_iterator positions_begin() const;
-    Positions_t::const_iterator positions_end() const;
-
    private:
+    friend class Symbol_Table;
+
     //! identifier of the symbol
-    std::string _identifier;
+    std::string_view _identifier;
+
+    //! hash of the identifier, so the table grows without hashing again
+    size_t _hash;
 
     //! position of definition of the identifier
     size_t _definition;
+};
 
-    //! list of uses of the identifier (positions)
-    Positions_t _positions;
+//! A use of a symbol, its location is patched with the definition
+struct Fixup
+{
+    //! index of the symbol in the table
+    size_t symbol;
+    //! position of the location in the bytecode
+    size_t position;
 };
 
 //! This is the symbol table of the assembler
+/*!
+** An open addressing table of indices into a vector of symbols. The uses of
+** all symbols are in one vector in the order of the code, so they are
+** backpatched in a single pass.
+*/
 class Symbol_Table
 {
-   private:
-    typedef std::map<std::string, Symbol*> Table_t;
-    typedef Table_t::iterator iterator;
-
    public:
+    typedef std::vector<Fixup> Fixups_t;
+
     Symbol_Table();
-    typedef Table_t::const_iterator const_iterator;
 
-    Symbol* find(const std::string&) const;
-    Symbol* insert(const std::string&, size_t);
-    Symbol* define(const std::string&, size_t);
+    const Symbol* find(std::string_view) const;
+    Symbol* insert(std::string_view, size_t);
+    Symbol* define(std::string_view, size_t);
 
-    const_iterator begin() const;
-    const_iterator end() const;
+    const Symbol& symbol(size_t index) const;
+    const Fixups_t& fixups() const;
 
    private:
     Symbol_Table(const Symbol_Table&);
     Symbol_Table& operator=(const Symbol_Table&);
 
-    Table_t _table;
+    static size_t hash(std::string_view);
+    size_t slot(std::string_view, size_t hash) const;
+    size_t intern(std::string_view);
+    void grow();
+
+    std::vector<Symbol> _symbols;
+
+    //! a power of two slots with the index of a symbol plus one, 0 is empty
+    std::vector<size_t> _slots;
+
+    Fixups_t _fixups;
+
+    String_Arena _identifiers;
 };
 }  // namespace ASM
 }  // namespace SpasmImpl
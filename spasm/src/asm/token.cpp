@@ -1,3 +1,4 @@
+#include <cstring>
 #include <memory>
 #include <new>
 #include <queue>
@@ -12,7 +13,7 @@ namespace ASM
 namespace Lexer
 {
 Token::Token(Token_type type)
-    : _type(type), _lineno(0), _value_int(0), _value_str("")
+    : _type(type), _lineno(0), _value_int(0)
 {
 }
 
@@ -40,11 +41,11 @@ Token::Token(Token::Token_type type,
         {
             if (end)
             {
-                _value_str = std::string(start, end);
+                _value_str = std::string_view(start, size_t(end - start));
             }
             else
             {
-                _value_str = std::string(start);
+                _value_str = std::string_view(start);
             }
             break;
         }
@@ -53,6 +54,66 @@ Token::Token(Token::Token_type type,
     }
 }
 
+Token::Token_type Token::keyword(const char* start, const char* end)
+{
+    static const struct
+    {
+        const char* Name;
+        Token_type Type;
+    } Keywords[] = {
+        {"halt", Halt},
+        {"greater", Greater},
+        {"geq", GreaterEq},
+        {"equal", Equal},
+        {"neq", NotEqual},
+        {"callnative", CallNative},
+        {"spawn", Spawn},
+        {"yield", Yield},
+        {"resume", Resume},
+        {"fork", Fork},
+        {"join", Join},
+        {"channel", LoadChannel},
+        {"send", Send},
+        {"recv", Receive},
+        {"vnew", VNew},
+        {"vget", VGet},
+        {"vset", VSet},
+        {"vadd", VAdd},
+        {"vmul", VMul},
+        {"vscale", VScale},
+        {"vsum", VSum},
+        {"vdot", VDot},
+        {"throw", Throw},
+        {"catch", Catch},
+        {"getg", GetG},
+        {"setg", SetG},
+        {"tcall", TailCall},
+        {"mnew", MapNew},
+        {"mget", MapGet},
+        {"mset", MapSet},
+        {"mhas", MapHas},
+        {"mdel", MapDelete},
+        {"bopen", BOpen},
+        {"bnew", BNew},
+        {"bsize", BSize},
+        {"bslice", BSlice},
+        {"bget", BGet},
+        {"bset", BSet},
+        {"try", Try},
+        {"export", Export},
+    };
+    const auto length = size_t(end - start);
+    for (const auto& keyword : Keywords)
+    {
+        if (std::strlen(keyword.Name) == length &&
+            std::memcmp(keyword.Name, start, length) == 0)
+        {
+            return keyword.Type;
+        }
+    }
+    return Ident;
+}
+
 Token::Token_type Token::type() const
 {
     return _type;
@@ -63,7 +124,7 @@ int64_t Token::value_int() const
     return _value_int;
 }
 
-const std::string& Token::value_str() const
+std::string_view Token::value_str() const
 {
     return _value_str;
 }
@@ -1,7 +1,7 @@
 #ifndef TOKEN_HPP
 #define TOKEN_HPP
 
-#include <string>
+#include <string_view>
 
 namespace SpasmImpl
 {
@@ -12,14 +12,13 @@ namespace Lexer
 class Token
 {
    public:
+    //! The opcode tokens have the value of their opcode
     enum Token_type
     {
-        _NoArgBegin,
-        Halt = _NoArgBegin,
+        Halt,
         Dup,
         Pop,
-        _OneArgBegin,
-        PopTo = _OneArgBegin,
+        PopTo,
         PushFrom,
         Push,
         Print,
@@ -27,21 +26,58 @@ class Token
         Call,
         Ret,
         Jump,
-        _TwoArgBegin,
-        JumpT = _TwoArgBegin,
+        JumpT,
         JumpF,
         Const,
         String,
-        _ThreeArgBegin,
-        Add = _ThreeArgBegin,
+        Add,
         Sub,
         Mul,
         Div,
         Mod,
         Less,
         LessEq,
+        Greater,
+        GreaterEq,
+        Equal,
+        NotEqual,
+        CallNative,
+        Spawn,
+        Yield,
+        Resume,
+        Fork,
+        Join,
+        LoadChannel,
+        Send,
+        Receive,
+        VNew,
+        VGet,
+        VSet,
+        VAdd,
+        VMul,
+        VScale,
+        VSum,
+        VDot,
+        Throw,
+        Catch,
+        GetG,
+        SetG,
+        TailCall,
+        MapNew,
+        MapGet,
+        MapSet,
+        MapHas,
+        MapDelete,
+        BOpen,
+        BNew,
+        BSize,
+        BSlice,
+        BGet,
+        BSet,
         _NotOpCodeBegin,
         Label = _NotOpCodeBegin,
+        Try,
+        Export,
         Ident,
         // Register,
         Integer,
@@ -56,6 +92,12 @@ class Token
 
     Token(Token_type, size_t, const char* = NULL, const char* = NULL);
 
+    //! Returns the mnemonic spelled by [start, end) or Ident if there is none
+    /*!
+    ** Used for the mnemonics that have no rule of their own in the lexer.
+    */
+    static Token_type keyword(const char* start, const char* end);
+
     Token_type type() const;
 
     size_t lineno() const;
@@ -65,7 +107,13 @@ class Token
 
     double value_double() const { return _value_double; }
 
-    const std::string& value_str() const;
+    //! The characters of an identifier or a string, without the quotes
+    /*!
+    ** A view into the input of the lexer, or into the arena of the
+    ** tokenizer when the input is a stream, so a token is never allocated.
+    */
+    std::string_view value_str() const;
+    void set_str(std::string_view v) { _value_str = v; }
 
    private:
     Token_type _type;
@@ -75,7 +123,7 @@ class Token
     int64_t _value_int;
     double _value_double;
 
-    std::string _value_str;
+    std::string_view _value_str;
 };
 
 class TokenStream
@@ -12,15 +12,66 @@ namespace ASM
 {
 namespace Lexer
 {
+Token_Ring::Token_Ring() : _slots(64), _head(0), _count(0) {}
+
+void Token_Ring::push(const Token& token)
+{
+    if (_count == _slots.size())
+    {
+        grow();
+    }
+    _slots[(_head + _count) & (_slots.size() - 1)] = token;
+    ++_count;
+}
+
+Token Token_Ring::pop()
+{
+    const auto token = _slots[_head];
+    _head = (_head + 1) & (_slots.size() - 1);
+    --_count;
+    return token;
+}
+
+//! Doubles the slots and moves the tokens to the front, in order
+void Token_Ring::grow()
+{
+    std::vector<Token> slots(_slots.size() * 2);
+    for (size_t i = 0; i < _count; ++i)
+    {
+        slots[i] = _slots[(_head + i) & (_slots.size() - 1)];
+    }
+    _slots.swap(slots);
+    _head = 0;
+}
+
+const size_t Tokenizer::Held;
+
 Tokenizer::Tokenizer(std::istream& istr)
-    : _lexer(new Lexer(istr, 1024)), end_input(false)
+    : _lexer(new Lexer(istr, 1024)), _current(0), _returned(0),
+      end_input(false)
 {
     _lexer->buffer_init();
 }
 
+Tokenizer::Tokenizer(std::unique_ptr<Lexer> lexer)
+    : _lexer(std::move(lexer)), _current(0), _returned(0), end_input(false)
+{
+}
+
 void Tokenizer::push_token(const Token& token)
 {
-    _tokens.push(token);
+    if (!_lexer->is_mapped() &&
+        (token.type() == Token::Ident || token.type() == Token::StringValue))
+    {
+        // the buffer of the stream is refilled before the token is used
+        Token copy = token;
+        copy.set_str(_strings[_current].copy(token.value_str()));
+        _tokens.push(copy);
+    }
+    else
+    {
+        _tokens.push(token);
+    }
     if (token.type() == Token::EndInput)
         end_input = true;
 }
@@ -30,22 +81,50 @@ Token Tokenizer::next_token()
     Token t(Token::EndInput);
     if (!_tokens.empty())
     {
-        t = _tokens.front();
-        _tokens.pop();
+        t = _tokens.pop();
     }
     else if (!end_input)
     {
         while (_tokens.empty())
         {
-            _lexer->read();
-            _lexer->tokenize(*this);
+            // a failed match goes on from the cursor, which is how "-1"
+            // is scanned, while a token cut by the limit is scanned again
+            if (!_lexer->tokenize(*this) || !_tokens.empty())
+            {
+                continue;
+            }
+            if (_lexer->exhausted())
+            {
+                push_token(Token(Token::EndInput));
+            }
+            else
+            {
+                refill();
+            }
         }
-        t = _tokens.front();
-        _tokens.pop();
+        t = _tokens.pop();
     }
+    ++_returned;
     return t;
 }
 
+/*!
+** Reads more of the stream. The queue is empty, so the strings of the
+** other arena were all returned before those of the current one. Once
+** Held tokens are returned from the current arena, no token of the other
+** one is still held and it is cleared for the next strings.
+*/
+void Tokenizer::refill()
+{
+    if (_returned >= Held)
+    {
+        _current ^= 1;
+        _strings[_current].clear();
+        _returned = 0;
+    }
+    _lexer->read();
+}
+
 }  // namespace Lexer
 }  // namespace ASM
 }  // namespace SpasmImpl
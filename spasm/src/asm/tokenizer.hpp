@@ -3,9 +3,10 @@
 
 #include <iostream>
 #include <memory>
-#include <queue>
+#include <vector>
 
 #include "lexer.hpp"
+#include "string_arena.hpp"
 #include "token.hpp"
 
 namespace SpasmImpl
@@ -14,17 +15,60 @@ namespace ASM
 {
 namespace Lexer
 {
+//! A queue of tokens over a ring of slots
+/*!
+** The lexer pushes a batch of tokens at a time and the assembler pops them
+** one by one, so the slots are reused and only grow for a larger batch.
+*/
+class Token_Ring
+{
+   public:
+    Token_Ring();
+
+    bool empty() const { return _count == 0; }
+    void push(const Token&);
+    Token pop();
+
+   private:
+    void grow();
+
+    //! a power of two slots, so the positions wrap with a mask
+    std::vector<Token> _slots;
+    size_t _head;
+    size_t _count;
+};
+
 class Tokenizer : public TokenStream
 {
    public:
     Tokenizer(std::istream&);
+    //! Tokenizes the input of a lexer that is ready, e.g. a mapped file
+    explicit Tokenizer(std::unique_ptr<Lexer> lexer);
 
     void push_token(const Token&) override;
+    //! The next token, its string stays valid until Held more are returned
     Token next_token();
 
+    //! The tokens an assembler holds at most, an instruction and its
+    //! arguments
+    static const size_t Held = 5;
+
    private:
+    void refill();
+
     std::unique_ptr<Lexer> _lexer;
-    std::queue<Token> _tokens;
+    Token_Ring _tokens;
+    //! the strings of a stream, its buffer is refilled while the assembler
+    //! still holds a token
+    /*!
+    ** The strings go in the current arena. A refill clears the other one
+    ** and makes it current once Held tokens are returned from the current
+    ** one, so the memory does not grow with the input.
+    */
+    String_Arena _strings[2];
+    size_t _current;
+    //! the tokens returned since the arenas were swapped
+    size_t _returned;
     bool end_input;
 };  // class Tokenizer
 }  // namespace Lexer
@@ -0,0 +1,161 @@
+#ifndef BYTE_BUFFER_HPP
+#define BYTE_BUFFER_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include "object.hpp"
+
+namespace SpasmImpl
+{
+//! Bytes of a file or of the machine, the operand of the buffer opcodes
+/*!
+** A slice is another buffer over a part of the same bytes, it shares the
+** storage instead of copying. Mapped files are read-only, the buffers made
+** by BNew and their slices are writable.
+*/
+struct ByteBuffer : HeapObject
+{
+    ByteBuffer(std::shared_ptr<void> storage,
+               uint8_t* data,
+               size_t size,
+               bool writable)
+        : HeapObject(Kind::Buffer),
+          Storage(std::move(storage)),
+          Data(data),
+          Size(size),
+          Writable(writable)
+    {
+    }
+
+    //! Keeps the mapping or the memory alive while a slice uses it
+    std::shared_ptr<void> Storage;
+    uint8_t* Data;
+    size_t Size;
+    bool Writable;
+
+    //! The encoding of a number in a buffer, the last operand of BGet/BSet
+    /*!
+    ** The low two bits are the log2 of the width in bytes, the rest is the
+    ** kind. The numbers are in the byte order of the host.
+    */
+    enum Format : uint8_t
+    {
+        U8 = 0,
+        U16 = 1,
+        U32 = 2,
+        U64 = 3,
+        I8 = 4,
+        I16 = 5,
+        I32 = 6,
+        I64 = 7,
+        F32 = 10,
+        F64 = 11,
+    };
+
+    static size_t Width(Format format) { return size_t(1) << (format & 3); }
+
+    //! Reads the number at offset, 64 bit integers may lose precision
+    double Get(size_t offset, Format format) const
+    {
+        switch (format)
+        {
+            case U8:
+                return Load<uint8_t>(offset);
+            case U16:
+                return Load<uint16_t>(offset);
+            case U32:
+                return Load<uint32_t>(offset);
+            case U64:
+                return double(Load<uint64_t>(offset));
+            case I8:
+                return Load<int8_t>(offset);
+            case I16:
+                return Load<int16_t>(offset);
+            case I32:
+                return Load<int32_t>(offset);
+            case I64:
+                return double(Load<int64_t>(offset));
+            case F32:
+                return Load<float>(offset);
+            case F64:
+                return Load<double>(offset);
+        }
+        return 0;
+    }
+
+    //! Whether Set can write value in the format
+    /*!
+    ** The integers take the finite numbers from the least int64 to the
+    ** greatest uint64, a float takes the numbers that do not overflow it.
+    */
+    static bool Fits(Format format, double value)
+    {
+        switch (format)
+        {
+            case F32:
+                return !std::isfinite(value) ||
+                       std::fabs(value) <= std::numeric_limits<float>::max();
+            case F64:
+                return true;
+            default:
+                return value >= -9223372036854775808.0 &&
+                       value < 18446744073709551616.0;
+        }
+    }
+
+    //! Writes the number at offset, integers are truncated to the width
+    /*!
+    ** The number must fit the format, see Fits. The integers are written
+    ** in two's complement, so a negative number and its unsigned wrap are
+    ** the same bytes.
+    */
+    void Set(size_t offset, Format format, double value)
+    {
+        if (format == F32)
+        {
+            return Store(offset, float(value));
+        }
+        if (format == F64)
+        {
+            return Store(offset, value);
+        }
+        const auto bits = value < 9223372036854775808.0
+                              ? uint64_t(int64_t(value))
+                              : uint64_t(value);
+        switch (Width(format))
+        {
+            case 1:
+                return Store(offset, uint8_t(bits));
+            case 2:
+                return Store(offset, uint16_t(bits));
+            case 4:
+                return Store(offset, uint32_t(bits));
+            default:
+                return Store(offset, bits);
+        }
+    }
+
+   private:
+    //! The offsets need not be aligned, so the bytes are copied
+    template <typename T>
+    T Load(size_t offset) const
+    {
+        T value;
+        std::memcpy(&value, Data + offset, sizeof(value));
+        return value;
+    }
+
+    template <typename T>
+    void Store(size_t offset, T value)
+    {
+        std::memcpy(Data + offset, &value, sizeof(value));
+    }
+};
+}  // namespace SpasmImpl
+
+#endif  // BYTE_BUFFER_HPP
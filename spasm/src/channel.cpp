@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <thread>
+
+#include "channel.hpp"
+
+namespace SpasmImpl
+{
+static size_t round_up_to_power_of_2(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+Channel::Channel(size_t capacity, Mode mode)
+    : HeapObject(Kind::Channel),
+      m_Mode(mode),
+      m_Mask(round_up_to_power_of_2(std::max<size_t>(capacity, 2)) - 1),
+      m_Slots(new Slot[m_Mask + 1])
+{
+    for (size_t i = 0; i <= m_Mask; ++i)
+    {
+        m_Slots[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool Channel::TrySend(data_t value)
+{
+    return TrySendBatch(&value, 1) == 1;
+}
+
+bool Channel::TryReceive(data_t& value)
+{
+    return TryReceiveBatch(&value, 1) == 1;
+}
+
+size_t Channel::TrySendBatch(const data_t* values, size_t count)
+{
+    if (m_Mode == Mode::MultipleProducers)
+    {
+        size_t sent = 0;
+        while (sent < count && TrySendMultiple(values[sent]))
+        {
+            ++sent;
+        }
+        return sent;
+    }
+    const auto tail = m_Tail.load(std::memory_order_relaxed);
+    auto free = Capacity() - (tail - m_CachedHead);
+    if (free < count)
+    {
+        m_CachedHead = m_Head.load(std::memory_order_acquire);
+        free = Capacity() - (tail - m_CachedHead);
+    }
+    count = std::min(count, free);
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_Slots[(tail + i) & m_Mask].Value = values[i];
+    }
+    m_Tail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+size_t Channel::TryReceiveBatch(data_t* values, size_t count)
+{
+    if (m_Mode == Mode::MultipleProducers)
+    {
+        size_t received = 0;
+        while (received < count && TryReceiveMultiple(values[received]))
+        {
+            ++received;
+        }
+        return received;
+    }
+    const auto head = m_Head.load(std::memory_order_relaxed);
+    auto available = m_CachedTail - head;
+    if (available < count)
+    {
+        m_CachedTail = m_Tail.load(std::memory_order_acquire);
+        available = m_CachedTail - head;
+    }
+    count = std::min(count, available);
+    for (size_t i = 0; i < count; ++i)
+    {
+        values[i] = m_Slots[(head + i) & m_Mask].Value;
+    }
+    m_Head.store(head + count, std::memory_order_release);
+    return count;
+}
+
+/*!
+** The bounded queue of Vyukov. The sequence of a slot tells the senders
+** and the receiver whose turn it is to use the slot.
+*/
+bool Channel::TrySendMultiple(data_t value)
+{
+    auto position = m_Tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        auto& slot = m_Slots[position & m_Mask];
+        const auto sequence = slot.Sequence.load(std::memory_order_acquire);
+        const auto difference = intptr_t(sequence) - intptr_t(position);
+        if (difference == 0)
+        {
+            if (m_Tail.compare_exchange_weak(position, position + 1,
+                                             std::memory_order_relaxed))
+            {
+                slot.Value = value;
+                slot.Sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = m_Tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Channel::TryReceiveMultiple(data_t& value)
+{
+    const auto position = m_Head.load(std::memory_order_relaxed);
+    auto& slot = m_Slots[position & m_Mask];
+    const auto sequence = slot.Sequence.load(std::memory_order_acquire);
+    if (intptr_t(sequence) - intptr_t(position + 1) < 0)
+    {
+        return false;
+    }
+    value = slot.Value;
+    slot.Sequence.store(position + Capacity(), std::memory_order_release);
+    m_Head.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void Channel::Send(data_t value)
+{
+    while (!TrySend(value))
+    {
+        std::this_thread::yield();
+    }
+}
+
+data_t Channel::Receive()
+{
+    data_t value;
+    while (!TryReceive(value))
+    {
+        std::this_thread::yield();
+    }
+    return value;
+}
+}  // namespace SpasmImpl
@@ -0,0 +1,76 @@
+#ifndef CHANNEL_HPP
+#define CHANNEL_HPP
+
+#include <atomic>
+#include <memory>
+
+#include "object.hpp"
+#include "types.hpp"
+
+namespace SpasmImpl
+{
+//! Bounded lock-free queue of values between machines
+/*!
+** The embedder creates the channel and attaches it to the machines that
+** send and receive. There is one receiver and one or many senders. Each
+** side caches the position of the other one, so it touches the shared
+** cache lines only when the channel looks full or empty.
+**
+** Long strings refer to the string table of the sending machine, it has
+** to stay alive until they are received.
+*/
+class Channel : public HeapObject
+{
+   public:
+    enum class Mode
+    {
+        SingleProducer,
+        MultipleProducers,
+    };
+
+    //! The capacity is rounded up to a power of 2
+    explicit Channel(size_t capacity, Mode mode = Mode::SingleProducer);
+
+    bool TrySend(data_t value);
+    bool TryReceive(data_t& value);
+
+    //! Sends as many values as fit, returns their count
+    size_t TrySendBatch(const data_t* values, size_t count);
+    //! Receives at most count values, returns their count
+    size_t TryReceiveBatch(data_t* values, size_t count);
+
+    //! Waits while the channel is full
+    void Send(data_t value);
+    //! Waits while the channel is empty
+    data_t Receive();
+
+    size_t Capacity() const { return m_Mask + 1; }
+
+   private:
+    struct Slot
+    {
+        //! Used only by the multiple producers mode
+        std::atomic<size_t> Sequence;
+        data_t Value;
+    };
+
+    bool TrySendMultiple(data_t value);
+    bool TryReceiveMultiple(data_t& value);
+
+    const Mode m_Mode;
+    const size_t m_Mask;
+    std::unique_ptr<Slot[]> m_Slots;
+
+    //! Next position to receive from, written by the receiver
+    alignas(64) std::atomic<size_t> m_Head{0};
+    //! The last known end of the values, owned by the receiver
+    size_t m_CachedTail = 0;
+
+    //! Next position to send to, written by the senders
+    alignas(64) std::atomic<size_t> m_Tail{0};
+    //! The last known start of the values, owned by the single sender
+    size_t m_CachedHead = 0;
+};
+}  // namespace SpasmImpl
+
+#endif  // CHANNEL_HPP
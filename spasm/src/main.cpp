@@ -19,12 +19,37 @@ int main(int argc, const char* argv[])
 
     input.read((char*)bytecode.get(), len);
 
+    // files from older assemblers end with the code
+    size_t count = 0;
+    input.read((char*)&count, sizeof(count));
+    Spasm::Spasm::ExceptionHandlers handlers;
+    for (size_t i = 0; input && i < count; ++i)
+    {
+        size_t entry[3];
+        if (input.read((char*)entry, sizeof(entry)))
+            handlers.push_back({entry[0], entry[1], entry[2]});
+    }
+
+    count = 0;
+    input.read((char*)&count, sizeof(count));
+    std::vector<std::string> globals;
+    for (size_t i = 0; input && i < count; ++i)
+    {
+        size_t length = 0;
+        input.read((char*)&length, sizeof(length));
+        std::string name(length, '\0');
+        if (input.read(&name[0], length))
+            globals.push_back(std::move(name));
+    }
+
     for (size_t i = 0; i < len; ++i)
         std::cout << std::hex << (int)bytecode[i] << ' ';
     std::cout << std::endl;
 
     Spasm::Spasm vm;
     vm.Initialize(len, bytecode.get());
+    vm.SetExceptionHandlers(std::move(handlers));
+    vm.SetGlobals(std::move(globals));
 
     vm.run();
 
@@ -0,0 +1,234 @@
+#include <utility>
+
+#include "mapped_file.hpp"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace SpasmImpl
+{
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if (this != &other)
+    {
+        Close();
+        m_Data = other.m_Data;
+        m_Size = other.m_Size;
+        m_Writable = other.m_Writable;
+        m_Open = other.m_Open;
+        m_File = other.m_File;
+#if defined(_WIN32)
+        m_Mapping = other.m_Mapping;
+#endif
+        other.Reset();
+    }
+    return *this;
+}
+
+void MappedFile::Reset()
+{
+    m_Data = nullptr;
+    m_Size = 0;
+    m_Writable = false;
+    m_Open = false;
+#if defined(_WIN32)
+    m_File = nullptr;
+    m_Mapping = nullptr;
+#else
+    m_File = -1;
+#endif
+}
+
+void MappedFile::Close()
+{
+    Close(m_Size);
+}
+
+#if defined(_WIN32)
+static bool map_file(HANDLE file,
+                     size_t size,
+                     bool writable,
+                     HANDLE& mapping,
+                     uint8_t*& data)
+{
+    mapping = CreateFileMappingA(file, nullptr,
+                                 writable ? PAGE_READWRITE : PAGE_READONLY,
+                                 DWORD(uint64_t(size) >> 32), DWORD(size),
+                                 nullptr);
+    if (!mapping)
+    {
+        return false;
+    }
+    data = static_cast<uint8_t*>(MapViewOfFile(
+        mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+    return data != nullptr;
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+    auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    m_File = file;
+    m_Open = true;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        Close();
+        return false;
+    }
+    m_Size = size_t(size.QuadPart);
+    if (m_Size &&
+        !map_file(file, m_Size, false, m_Mapping, m_Data))
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::Create(const std::string& path, size_t size)
+{
+    Close();
+    auto file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    m_File = file;
+    m_Open = true;
+    m_Writable = true;
+    m_Size = size;
+    if (m_Size && !map_file(file, m_Size, true, m_Mapping, m_Data))
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close(size_t size)
+{
+    if (m_Data)
+    {
+        UnmapViewOfFile(m_Data);
+    }
+    if (m_Mapping)
+    {
+        CloseHandle(m_Mapping);
+    }
+    if (m_File)
+    {
+        if (m_Writable && size < m_Size)
+        {
+            LARGE_INTEGER end;
+            end.QuadPart = LONGLONG(size);
+            SetFilePointerEx(m_File, end, nullptr, FILE_BEGIN);
+            SetEndOfFile(m_File);
+        }
+        CloseHandle(m_File);
+    }
+    Reset();
+}
+#else
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+    m_File = open(path.c_str(), O_RDONLY);
+    if (m_File < 0)
+    {
+        return false;
+    }
+    m_Open = true;
+    struct stat status;
+    if (fstat(m_File, &status) != 0)
+    {
+        Close();
+        return false;
+    }
+    m_Size = size_t(status.st_size);
+    if (m_Size)
+    {
+        auto data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0);
+        if (data == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+        m_Data = static_cast<uint8_t*>(data);
+    }
+    return true;
+}
+
+bool MappedFile::Create(const std::string& path, size_t size)
+{
+    Close();
+    m_File = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_File < 0)
+    {
+        return false;
+    }
+    m_Open = true;
+    m_Writable = true;
+    if (ftruncate(m_File, off_t(size)) != 0)
+    {
+        Close();
+        return false;
+    }
+    m_Size = size;
+    if (m_Size)
+    {
+        auto data = mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         m_File, 0);
+        if (data == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+        m_Data = static_cast<uint8_t*>(data);
+    }
+    return true;
+}
+
+void MappedFile::Close(size_t size)
+{
+    if (m_Data)
+    {
+        munmap(m_Data, m_Size);
+    }
+    if (m_File >= 0)
+    {
+        if (m_Writable && size < m_Size)
+        {
+            (void)!ftruncate(m_File, off_t(size));
+        }
+        close(m_File);
+    }
+    Reset();
+}
+#endif
+}  // namespace SpasmImpl
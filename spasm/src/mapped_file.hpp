@@ -0,0 +1,51 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace SpasmImpl
+{
+//! A file mapped in memory
+class MappedFile
+{
+   public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    //! Maps the whole file for reading
+    bool Open(const std::string& path);
+    //! Creates or truncates the file to size bytes and maps it for writing
+    bool Create(const std::string& path, size_t size);
+    //! Unmaps the file, a created file is truncated to size bytes
+    void Close(size_t size);
+    void Close();
+
+    bool IsOpen() const { return m_Open; }
+    const uint8_t* Data() const { return m_Data; }
+    uint8_t* MutableData() { return m_Writable ? m_Data : nullptr; }
+    size_t Size() const { return m_Size; }
+
+   private:
+    void Reset();
+
+    uint8_t* m_Data = nullptr;
+    size_t m_Size = 0;
+    bool m_Writable = false;
+    //! An empty file is open, but has no mapping
+    bool m_Open = false;
+#if defined(_WIN32)
+    void* m_File = nullptr;
+    void* m_Mapping = nullptr;
+#else
+    int m_File = -1;
+#endif
+};
+}  // namespace SpasmImpl
+
+#endif  // MAPPED_FILE_HPP
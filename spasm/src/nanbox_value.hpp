@@ -0,0 +1,145 @@
+#ifndef NANBOX_VALUE_HPP
+#define NANBOX_VALUE_HPP
+
+#include <cassert>
+#include <cstdint>
+
+#include "value_type.hpp"
+
+namespace Spasm
+{
+//! A double or a tagged 48 bit payload in the bits of a quiet NaN
+/*!
+** Doubles are stored as they are. The other values set the 13 high bits,
+** which no double the machine makes has, and keep their type in the next
+** 3 bits.
+*/
+struct NanBoxValue
+{
+    NanBoxValue() { m_value.as_double = 0.0; }
+
+    explicit NanBoxValue(double v) { m_value.as_double = v; }
+
+    explicit NanBoxValue(bool v) : NanBoxValue(ValueType::Boolean, (uint64_t)v)
+    {
+    }
+
+    NanBoxValue(ValueType tag, uint64_t payload)
+    {
+        assert(tag != ValueType::Number && "Zero tag is plain double");
+        assert(!(payload >> 48) && "Use only pointers to the heap.");
+        m_value.as_pointer.pointer = payload;
+        m_value.as_pointer.tag = uint64_t(tag);
+        m_value.as_pointer.nan = 0x1fff;
+    }
+
+    NanBoxValue(ValueType tag, void* pointer)
+        : NanBoxValue(tag, (uint64_t)pointer)
+    {
+    }
+
+    //! Strings up to that length are stored inside the value
+    static const size_t ShortStringCapacity = 5;
+
+    //! Makes a string value that keeps the characters in the payload
+    /*!
+    ** The characters take the low 5 bytes, the length - the next 3 bits and
+    ** the highest payload bit marks the string as short. User space pointers
+    ** never have it set. The unused bits are zero, so two short strings are
+    ** equal exactly when their bits are equal.
+    */
+    static NanBoxValue short_string(const char* s, size_t length)
+    {
+        assert(length <= ShortStringCapacity);
+        uint64_t payload = ShortStringBit | (uint64_t(length) << 40);
+        for (size_t i = 0; i < length; ++i)
+        {
+            payload |= uint64_t(uint8_t(s[i])) << (i * 8);
+        }
+        return NanBoxValue(ValueType::String, payload);
+    }
+
+    bool is_short_string() const
+    {
+        return get_type() == ValueType::String &&
+               (m_value.as_pointer.pointer & ShortStringBit);
+    }
+
+    size_t short_string_length() const
+    {
+        assert(is_short_string());
+        return (m_value.as_pointer.pointer >> 40) & 0x7;
+    }
+
+    //! The characters of a short string, valid while the value is alive
+    const char* short_string_data() const
+    {
+        assert(is_short_string());
+        // the low payload bytes come first on little endian
+        return reinterpret_cast<const char*>(&m_value);
+    }
+
+    struct NanPointer
+    {
+        uint64_t pointer : 48;
+        uint64_t tag : 3;
+        uint64_t nan : 13;
+    };
+
+    struct CheckType
+    {
+        uint64_t payload : 48;
+        uint64_t check : 16;
+    };
+    union {
+        double as_double;
+        NanPointer as_pointer;
+        CheckType to_check;
+        uint64_t as_int64;
+    } m_value;
+
+    static_assert(sizeof(double) == 8, "unsupported arch");
+
+    static const uint64_t ShortStringBit = uint64_t(1) << 47;
+
+    bool is_double() const { return m_value.to_check.check <= 0xFFF8; }
+
+    double get_double() const
+    {
+        assert(is_double());
+        return m_value.as_double;
+    }
+
+    ValueType get_type() const
+    {
+        return is_double() ? ValueType::Number
+                           : ValueType(m_value.as_pointer.tag);
+    }
+
+    void* get_pointer() const
+    {
+        return (void*)(uint64_t)m_value.as_pointer.pointer;
+    }
+
+    bool get_boolean() const
+    {
+        assert(get_type() == ValueType::Boolean);
+        return m_value.as_pointer.pointer != 0;
+    }
+
+    explicit operator bool() const
+    {
+        // NaN will be true. Assume that is ok.
+        return (get_type() != ValueType::Boolean && m_value.as_int64 != 0) ||
+               get_boolean();
+    }
+
+    //! Whether the two values have the same bits
+    bool is_identical(const NanBoxValue& other) const
+    {
+        return m_value.as_int64 == other.m_value.as_int64;
+    }
+};
+}  // namespace Spasm
+
+#endif  // NANBOX_VALUE_HPP
@@ -0,0 +1,39 @@
+#ifndef OBJECT_HPP
+#define OBJECT_HPP
+
+#include <cstdint>
+
+namespace SpasmImpl
+{
+//! Base of the objects on the heap of the machine
+/*!
+** The objects are referenced by values with the Object tag and the kind
+** tells their actual type. The machine owns all of them.
+*/
+class HeapObject
+{
+   public:
+    enum class Kind : uint8_t
+    {
+        Fiber,
+        Task,
+        Channel,
+        Array,
+        Map,
+        Buffer,
+    };
+
+    explicit HeapObject(Kind kind) : m_Kind(kind) {}
+    virtual ~HeapObject() {}
+
+    HeapObject(const HeapObject&) = delete;
+    HeapObject& operator=(const HeapObject&) = delete;
+
+    Kind GetKind() const { return m_Kind; }
+
+   private:
+    Kind m_Kind;
+};
+}  // namespace SpasmImpl
+
+#endif  // OBJECT_HPP
@@ -0,0 +1,766 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#include "channel.hpp"
+#include "mapped_file.hpp"
+#include "spasm.hpp"
+#include "tasks.hpp"
+#include "value_map.hpp"
+#include "vector_kernels.hpp"
+
+namespace SpasmImpl
+{
+namespace
+{
+const char SnapshotMagic[8] = {'S', 'P', 'S', 'N', 'A', 'P', '\0', '\1'};
+const uint32_t SnapshotVersion = 3;
+
+//! A value takes a word with its type and flags and a word with its payload
+const size_t ValueWords = 2;
+const uint64_t ShortStringFlag = 0x100;
+//! Words of a fiber record before its stack, the last field is a value
+const size_t FiberFields = 9 + ValueWords - 1;
+static_assert(data_t::ShortStringCapacity <= sizeof(uint64_t),
+              "The short strings are saved in a single word");
+
+//! The image starts with the header and the sections follow, 8 byte aligned
+/*!
+** The values in the image have indices of strings and objects instead of
+** pointers, so the image can be loaded at any address and by a machine
+** with any value representation.
+*/
+struct SnapshotHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    uint64_t Size;
+    uint64_t CodeOffset;
+    uint64_t CodeSize;
+    uint64_t StringsOffset;
+    uint64_t StringCount;
+    //! The values of the globals start the objects section
+    uint64_t GlobalCount;
+    uint64_t ObjectsOffset;
+    uint64_t ObjectCount;
+    uint64_t RunQueueOffset;
+    uint64_t RunQueueCount;
+    uint64_t Root;
+    uint64_t Current;
+};
+
+size_t align(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+}  // namespace
+
+class Spasm::SnapshotWriter
+{
+   public:
+    explicit SnapshotWriter(Spasm& machine) : m_Machine(machine) {}
+
+    bool Write(const std::string& path)
+    {
+        for (const auto& object : m_Machine.m_Heap)
+        {
+            m_ObjectIndex.emplace(object.get(), m_Objects.size());
+            m_Objects.push_back(object.get());
+        }
+        for (const auto& global : m_Machine.m_Globals)
+        {
+            PutValue(global);
+        }
+        // channels referenced by the values are appended while writing
+        for (size_t i = 0; i < m_Objects.size(); ++i)
+        {
+            if (!WriteObject(*m_Objects[i]))
+            {
+                return false;
+            }
+        }
+
+        std::vector<uint64_t> runQueue;
+        for (auto fiber : m_Machine.m_RunQueue)
+        {
+            runQueue.push_back(m_ObjectIndex.at(fiber));
+        }
+
+        SnapshotHeader header;
+        std::memcpy(header.Magic, SnapshotMagic, sizeof(SnapshotMagic));
+        header.Version = SnapshotVersion;
+        header.CodeOffset = align(sizeof(SnapshotHeader));
+        header.CodeSize = m_Machine.m_CodeSize;
+        header.StringsOffset = align(header.CodeOffset + header.CodeSize);
+        header.StringCount = m_Strings.size();
+        header.GlobalCount = m_Machine.m_Globals.size();
+        header.ObjectsOffset = header.StringsOffset + m_StringsSection.size();
+        header.ObjectCount = m_Objects.size();
+        header.RunQueueOffset =
+            header.ObjectsOffset + m_ObjectsSection.size() * sizeof(uint64_t);
+        header.RunQueueCount = runQueue.size();
+        header.Root = m_ObjectIndex.at(m_Machine.m_Root);
+        header.Current = m_ObjectIndex.at(m_Machine.m_Current);
+        header.Size =
+            header.RunQueueOffset + runQueue.size() * sizeof(uint64_t);
+
+        std::vector<char> image(header.Size);
+        std::memcpy(&image[0], &header, sizeof(header));
+        std::memcpy(&image[header.CodeOffset], m_Machine.m_ByteCode,
+                    header.CodeSize);
+        std::memcpy(&image[header.StringsOffset], m_StringsSection.data(),
+                    m_StringsSection.size());
+        std::memcpy(&image[header.ObjectsOffset], m_ObjectsSection.data(),
+                    m_ObjectsSection.size() * sizeof(uint64_t));
+        std::memcpy(&image[header.RunQueueOffset], runQueue.data(),
+                    runQueue.size() * sizeof(uint64_t));
+
+        std::ofstream output(path, std::ios_base::out |
+                                       std::ios_base::binary |
+                                       std::ios_base::trunc);
+        output.write(image.data(), std::streamsize(image.size()));
+        return bool(output);
+    }
+
+   private:
+    void Put(uint64_t word) { m_ObjectsSection.push_back(word); }
+
+    //! Writes the type and the payload, they do not depend on the layout
+    void PutValue(data_t value)
+    {
+        const auto type = value.get_type();
+        if (value.is_double())
+        {
+            const auto number = value.get_double();
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof(number));
+            Put(uint64_t(type));
+            Put(bits);
+            return;
+        }
+        if (value.is_short_string())
+        {
+            const auto length = value.short_string_length();
+            uint64_t chars = 0;
+            std::memcpy(&chars, value.short_string_data(), length);
+            Put(uint64_t(type) | ShortStringFlag | (length << 16));
+            Put(chars);
+            return;
+        }
+        Put(uint64_t(type));
+        if (type == ::Spasm::ValueType::String)
+        {
+            const auto s = m_Machine.flatten(value);
+            auto position = m_StringIndex.find(s);
+            if (position == m_StringIndex.end())
+            {
+                position = m_StringIndex.emplace(s, m_Strings.size()).first;
+                m_Strings.push_back(s);
+                PutString(s->GetValue());
+            }
+            Put(position->second);
+            return;
+        }
+        if (type == ::Spasm::ValueType::Object ||
+            type == ::Spasm::ValueType::Array)
+        {
+            auto object = static_cast<HeapObject*>(value.get_pointer());
+            auto position = m_ObjectIndex.find(object);
+            if (position == m_ObjectIndex.end())
+            {
+                position =
+                    m_ObjectIndex.emplace(object, m_Objects.size()).first;
+                m_Objects.push_back(object);
+            }
+            Put(position->second);
+            return;
+        }
+        Put(uint64_t(value.get_pointer()));
+    }
+
+    void PutString(const SPString& s)
+    {
+        const uint64_t length = s.size();
+        const auto offset = m_StringsSection.size();
+        m_StringsSection.resize(align(offset + sizeof(length) + s.size()));
+        std::memcpy(&m_StringsSection[offset], &length, sizeof(length));
+        std::memcpy(&m_StringsSection[offset + sizeof(length)], s.data(),
+                    s.size());
+    }
+
+    bool WriteObject(const HeapObject& object)
+    {
+        Put(uint64_t(object.GetKind()));
+        switch (object.GetKind())
+        {
+            case HeapObject::Kind::Fiber:
+                WriteFiber(static_cast<const Fiber&>(object));
+                return true;
+            case HeapObject::Kind::Task:
+            {
+                const auto& task = static_cast<const Task&>(object);
+                if (!task.Done.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+                Put(task.Entry);
+                PutValue(task.Result);
+                return true;
+            }
+            case HeapObject::Kind::Channel:
+            {
+                const auto& channels = m_Machine.m_Channels;
+                auto position =
+                    std::find(channels.begin(), channels.end(), &object);
+                if (position == channels.end())
+                {
+                    return false;
+                }
+                Put(uint64_t(position - channels.begin()));
+                return true;
+            }
+            case HeapObject::Kind::Array:
+            {
+                const auto& elements =
+                    static_cast<const NumberArray&>(object).Elements;
+                Put(elements.size());
+                const auto offset = m_ObjectsSection.size();
+                m_ObjectsSection.resize(offset + elements.size());
+                std::memcpy(&m_ObjectsSection[offset], elements.data(),
+                            elements.size() * sizeof(double));
+                return true;
+            }
+            case HeapObject::Kind::Map:
+            {
+                const auto& entries =
+                    static_cast<const ValueMap&>(object).Entries;
+                Put(entries.size());
+                for (const auto& entry : entries)
+                {
+                    PutValue(entry.first);
+                    PutValue(entry.second);
+                }
+                return true;
+            }
+            case HeapObject::Kind::Buffer:
+                // the file of a buffer may be gone when the image is loaded
+                return false;
+        }
+        return false;
+    }
+
+    void WriteFiber(const Fiber& fiber)
+    {
+        // the running fiber keeps its registers and stacks in the machine
+        const auto running = &fiber == m_Machine.m_Current;
+        const auto& stack = running ? m_Machine.data_stack : fiber.Stack;
+        const auto& frames = running ? m_Machine.m_Frames : fiber.Frames;
+        const auto base = stack.empty() ? nullptr : &stack[0];
+        Put(running ? m_Machine.m_PC : fiber.PC);
+        const auto stackPointer =
+            running ? PC_t(m_Machine.m_SP - base) : fiber.StackPointer;
+        Put(stackPointer);
+        Put(running ? PC_t(m_Machine.m_FP - base) : fiber.FramePointer);
+        Put(stack.size());
+        Put(uint64_t(fiber.State));
+        Put(fiber.Queued);
+        Put(fiber.Resumer ? m_ObjectIndex.at(fiber.Resumer) + 1 : 0);
+        Put(uint64_t(fiber.ResumeRegister));
+        PutValue(fiber.Result);
+        for (PC_t i = 0; i < stackPointer; ++i)
+        {
+            PutValue(stack[i]);
+        }
+        // std::stack hides its container, copy it to walk the frames
+        auto copy = frames;
+        std::vector<Frame> bottomFirst;
+        while (!copy.empty())
+        {
+            bottomFirst.push_back(copy.top());
+            copy.pop();
+        }
+        Put(bottomFirst.size());
+        for (auto frame = bottomFirst.rbegin(); frame != bottomFirst.rend();
+             ++frame)
+        {
+            Put(frame->ReturnAddress);
+            Put(frame->FramePointer);
+            Put(frame->StackPointer);
+        }
+    }
+
+    Spasm& m_Machine;
+    std::vector<const HeapObject*> m_Objects;
+    std::unordered_map<const HeapObject*, uint64_t> m_ObjectIndex;
+    std::vector<const SPStringValue*> m_Strings;
+    std::unordered_map<const SPStringValue*, uint64_t> m_StringIndex;
+    std::vector<char> m_StringsSection;
+    std::vector<uint64_t> m_ObjectsSection;
+};
+
+class Spasm::SnapshotReader
+{
+   public:
+    explicit SnapshotReader(Spasm& machine) : m_Machine(machine) {}
+
+    /*!
+    ** Every offset, length and index of the image is checked before it is
+    ** used, a corrupt or truncated image fails the load and is not run.
+    */
+    bool Read(const std::string& path)
+    {
+        auto file = std::make_shared<MappedFile>();
+        if (!file->Open(path) || file->Size() < sizeof(SnapshotHeader))
+        {
+            return false;
+        }
+        SnapshotHeader header;
+        std::memcpy(&header, file->Data(), sizeof(header));
+        if (std::memcmp(header.Magic, SnapshotMagic, sizeof(SnapshotMagic)) ||
+            header.Version != SnapshotVersion || header.Size > file->Size())
+        {
+            return false;
+        }
+        const auto within = [&header](uint64_t offset, uint64_t size) {
+            return offset <= header.Size && size <= header.Size - offset;
+        };
+        if (!within(header.CodeOffset, header.CodeSize) ||
+            !within(header.StringsOffset, 0) ||
+            !within(header.ObjectsOffset, 0) ||
+            !within(header.RunQueueOffset, 0))
+        {
+            return false;
+        }
+        m_Image = file->Data();
+        m_End = m_Image + header.Size;
+        m_CodeSize = header.CodeSize;
+
+        m_Machine.reset();
+        m_Machine.m_Heap.clear();
+        const auto code = file->Data() + header.CodeOffset;
+        m_Machine.set_program(std::shared_ptr<const byte>(file, code),
+                              header.CodeSize);
+        m_Machine.m_ProgramImage.reset();
+
+        m_Cursor = m_Image + header.StringsOffset;
+        for (uint64_t i = 0; i < header.StringCount; ++i)
+        {
+            const auto length = Get();
+            if (m_Failed || length > Remaining())
+            {
+                return false;
+            }
+            const auto s = reinterpret_cast<const char*>(m_Cursor);
+            // a string that fits inline here is inline, whatever the
+            // representation of the machine that saved it
+            m_Strings.push_back(m_Machine.make_string(s, length));
+            m_Cursor += std::min<uint64_t>(align(length), Remaining());
+        }
+
+        // create the objects first, they refer to each other
+        m_Cursor = m_Image + header.ObjectsOffset;
+        const auto globals = m_Cursor;
+        if (!Advance(header.GlobalCount, ValueWords * sizeof(uint64_t)))
+        {
+            return false;
+        }
+        const auto objects = m_Cursor;
+        for (uint64_t i = 0; i < header.ObjectCount; ++i)
+        {
+            const auto kind = HeapObject::Kind(Get());
+            if (m_Failed)
+            {
+                return false;
+            }
+            m_Objects.push_back(Create(kind));
+            if (!m_Objects.back() || !Skip(kind))
+            {
+                return false;
+            }
+        }
+        m_Cursor = objects;
+        for (auto object : m_Objects)
+        {
+            Get();
+            Fill(*object);
+            if (m_Failed)
+            {
+                return false;
+            }
+        }
+        const auto end = m_Cursor;
+        m_Cursor = globals;
+        m_Machine.m_Globals.resize(header.GlobalCount);
+        for (auto& global : m_Machine.m_Globals)
+        {
+            global = GetValue();
+        }
+        if (m_Failed)
+        {
+            return false;
+        }
+        m_Cursor = end;
+
+        m_Cursor = m_Image + header.RunQueueOffset;
+        for (uint64_t i = 0; i < header.RunQueueCount && !m_Failed; ++i)
+        {
+            if (const auto fiber = GetFiber(Get()))
+            {
+                m_Machine.m_RunQueue.push_back(fiber);
+            }
+        }
+        const auto root = GetFiber(header.Root);
+        const auto current = GetFiber(header.Current);
+        if (m_Failed)
+        {
+            return false;
+        }
+        m_Machine.m_Root = root;
+        m_Machine.m_Current = current;
+        std::swap(current->Stack, m_Machine.data_stack);
+        std::swap(current->Frames, m_Machine.m_Frames);
+        const auto base = &m_Machine.data_stack[0];
+        m_Machine.m_PC = current->PC;
+        m_Machine.m_SP = base + current->StackPointer;
+        m_Machine.m_FP = base + current->FramePointer;
+        return true;
+    }
+
+   private:
+    uint64_t Remaining() const { return uint64_t(m_End - m_Cursor); }
+
+    //! Reads the next word, past the end of the image it fails the read
+    uint64_t Get()
+    {
+        uint64_t word = 0;
+        if (sizeof(word) > Remaining())
+        {
+            m_Failed = true;
+            return word;
+        }
+        std::memcpy(&word, m_Cursor, sizeof(word));
+        m_Cursor += sizeof(word);
+        return word;
+    }
+
+    //! Moves the cursor past count items of size bytes if they are there
+    bool Advance(uint64_t count, uint64_t size)
+    {
+        if (count > Remaining() / size)
+        {
+            m_Failed = true;
+            return false;
+        }
+        m_Cursor += count * size;
+        return true;
+    }
+
+    //! The object at index, if it is there and of the kind
+    HeapObject* GetObject(uint64_t index, HeapObject::Kind kind)
+    {
+        if (index >= m_Objects.size() || m_Objects[index]->GetKind() != kind)
+        {
+            m_Failed = true;
+            return nullptr;
+        }
+        return m_Objects[index];
+    }
+
+    Fiber* GetFiber(uint64_t index)
+    {
+        return static_cast<Fiber*>(GetObject(index, HeapObject::Kind::Fiber));
+    }
+
+    data_t GetValue()
+    {
+        const auto header = Get();
+        const auto payload = Get();
+        const auto type = ::Spasm::ValueType(header & 0xff);
+        if (type == ::Spasm::ValueType::Number)
+        {
+            double number;
+            std::memcpy(&number, &payload, sizeof(number));
+            return data_t(number);
+        }
+        if (header & ShortStringFlag)
+        {
+            // interned if the inline capacity here is smaller
+            const auto length =
+                std::min(size_t(header >> 16), sizeof(payload));
+            return m_Machine.make_string(
+                reinterpret_cast<const char*>(&payload), length);
+        }
+        switch (type)
+        {
+            case ::Spasm::ValueType::String:
+                if (payload < m_Strings.size())
+                {
+                    return m_Strings[payload];
+                }
+                break;
+            case ::Spasm::ValueType::Array:
+                if (const auto array =
+                        GetObject(payload, HeapObject::Kind::Array))
+                {
+                    return data_t(type, (void*)array);
+                }
+                break;
+            case ::Spasm::ValueType::Object:
+                // any object but an array
+                if (payload < m_Objects.size() &&
+                    m_Objects[payload]->GetKind() != HeapObject::Kind::Array)
+                {
+                    return data_t(type, (void*)m_Objects[payload]);
+                }
+                break;
+            case ::Spasm::ValueType::Null:
+            case ::Spasm::ValueType::Undefined:
+            case ::Spasm::ValueType::Boolean:
+            case ::Spasm::ValueType::Function:
+                // the payloads of all representations fit in 48 bits
+                if (!(payload >> 48))
+                {
+                    return data_t(type, payload);
+                }
+                break;
+            case ::Spasm::ValueType::Number:
+                break;
+        }
+        m_Failed = true;
+        return data_t{};
+    }
+
+    HeapObject* Create(HeapObject::Kind kind)
+    {
+        switch (kind)
+        {
+            case HeapObject::Kind::Fiber:
+            {
+                auto fiber = new Fiber;
+                m_Machine.m_Heap.emplace_back(fiber);
+                return fiber;
+            }
+            case HeapObject::Kind::Task:
+            {
+                // saved tasks have finished and they are never forked here,
+                // so a failed load must not wait for them
+                auto task = new Task;
+                task->Done.store(true, std::memory_order_relaxed);
+                m_Machine.m_Heap.emplace_back(task);
+                return task;
+            }
+            case HeapObject::Kind::Channel:
+            {
+                const auto index = PeekNext();
+                const auto& channels = m_Machine.m_Channels;
+                return index < channels.size() ? channels[index] : nullptr;
+            }
+            case HeapObject::Kind::Array:
+            {
+                const auto length = PeekNext();
+                if (m_Failed || length > Remaining() / sizeof(double))
+                {
+                    return nullptr;
+                }
+                auto array = new NumberArray(length);
+                m_Machine.m_Heap.emplace_back(array);
+                return array;
+            }
+            case HeapObject::Kind::Map:
+            {
+                auto map = new ValueMap;
+                m_Machine.m_Heap.emplace_back(map);
+                return map;
+            }
+            case HeapObject::Kind::Buffer:
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    //! Moves the cursor past the object, the values are not decoded yet
+    bool Skip(HeapObject::Kind kind)
+    {
+        switch (kind)
+        {
+            case HeapObject::Kind::Fiber:
+            {
+                if (!Advance(FiberFields, sizeof(uint64_t)))
+                {
+                    return false;
+                }
+                const auto stackPointer = Peek(1);
+                if (!Advance(stackPointer, ValueWords * sizeof(uint64_t)))
+                {
+                    return false;
+                }
+                const auto frames = Get();
+                return !m_Failed && Advance(frames, 3 * sizeof(uint64_t));
+            }
+            case HeapObject::Kind::Task:
+                return Advance(1 + ValueWords, sizeof(uint64_t));
+            case HeapObject::Kind::Channel:
+                return Advance(1, sizeof(uint64_t));
+            case HeapObject::Kind::Array:
+            {
+                const auto length = Get();
+                return !m_Failed && Advance(length, sizeof(double));
+            }
+            case HeapObject::Kind::Map:
+            {
+                const auto count = Get();
+                return !m_Failed &&
+                       Advance(count, 2 * ValueWords * sizeof(uint64_t));
+            }
+            case HeapObject::Kind::Buffer:
+                return false;
+        }
+        return false;
+    }
+
+    //! Reads the next word without moving past it
+    uint64_t PeekNext()
+    {
+        const auto word = Get();
+        if (!m_Failed)
+        {
+            m_Cursor -= sizeof(word);
+        }
+        return word;
+    }
+
+    //! Reads the word at index of the current fiber record
+    uint64_t Peek(size_t index)
+    {
+        const auto cursor = m_Cursor;
+        m_Cursor -= (FiberFields - index) * sizeof(uint64_t);
+        const auto word = Get();
+        m_Cursor = cursor;
+        return word;
+    }
+
+    void Fill(HeapObject& object)
+    {
+        switch (object.GetKind())
+        {
+            case HeapObject::Kind::Fiber:
+            {
+                auto& fiber = static_cast<Fiber&>(object);
+                fiber.PC = Get();
+                fiber.StackPointer = Get();
+                fiber.FramePointer = Get();
+                // only the used part of the stack is trusted, it grows
+                // again when it is needed
+                Get();
+                const auto state = Get();
+                fiber.State = Fiber::Status(state);
+                fiber.Queued = Get() != 0;
+                const auto resumer = Get();
+                fiber.Resumer = resumer ? GetFiber(resumer - 1) : nullptr;
+                fiber.ResumeRegister = reg_t(Get());
+                fiber.Result = GetValue();
+                if (fiber.PC > m_CodeSize ||
+                    fiber.FramePointer > fiber.StackPointer ||
+                    state > Fiber::Done)
+                {
+                    m_Failed = true;
+                    return;
+                }
+                fiber.Stack.resize(std::max<uint64_t>(
+                    uint64_t(Spasm::FiberStackSize), fiber.StackPointer + 1));
+                for (PC_t i = 0; i < fiber.StackPointer; ++i)
+                {
+                    fiber.Stack[i] = GetValue();
+                }
+                const auto frames = Get();
+                for (uint64_t i = 0; i < frames; ++i)
+                {
+                    Frame frame;
+                    frame.ReturnAddress = Get();
+                    frame.FramePointer = Get();
+                    frame.StackPointer = Get();
+                    // a return reads the slot below the stack pointer
+                    if (frame.ReturnAddress > m_CodeSize ||
+                        frame.StackPointer == 0 ||
+                        frame.StackPointer > fiber.StackPointer ||
+                        frame.FramePointer > frame.StackPointer)
+                    {
+                        m_Failed = true;
+                        return;
+                    }
+                    fiber.Frames.push(frame);
+                }
+                break;
+            }
+            case HeapObject::Kind::Task:
+            {
+                auto& task = static_cast<Task&>(object);
+                task.Owner = &m_Machine;
+                task.Entry = Get();
+                task.Result = GetValue();
+                if (task.Entry > m_CodeSize)
+                {
+                    m_Failed = true;
+                }
+                break;
+            }
+            case HeapObject::Kind::Channel:
+                Get();
+                break;
+            case HeapObject::Kind::Array:
+            {
+                auto& elements = static_cast<NumberArray&>(object).Elements;
+                Get();
+                std::memcpy(elements.data(), m_Cursor,
+                            elements.size() * sizeof(double));
+                m_Cursor += elements.size() * sizeof(double);
+                break;
+            }
+            case HeapObject::Kind::Map:
+            {
+                auto& entries = static_cast<ValueMap&>(object).Entries;
+                const auto count = Get();
+                entries.reserve(count);
+                for (uint64_t i = 0; i < count; ++i)
+                {
+                    const auto key = GetValue();
+                    entries[key] = GetValue();
+                }
+                break;
+            }
+            case HeapObject::Kind::Buffer:
+                break;
+        }
+    }
+
+    Spasm& m_Machine;
+    const uint8_t* m_Image = nullptr;
+    const uint8_t* m_End = nullptr;
+    const uint8_t* m_Cursor = nullptr;
+    uint64_t m_CodeSize = 0;
+    bool m_Failed = false;
+    std::vector<data_t> m_Strings;
+    std::vector<HeapObject*> m_Objects;
+};
+
+bool Spasm::SaveSnapshot(const std::string& path)
+{
+    return SnapshotWriter(*this).Write(path);
+}
+
+bool Spasm::LoadSnapshot(const std::string& path,
+                         std::istream& input,
+                         std::ostream& output)
+{
+    istr = &input;
+    ostr = &output;
+    if (!SnapshotReader(*this).Read(path))
+    {
+        reset();
+        return false;
+    }
+    return true;
+}
+}  // namespace SpasmImpl
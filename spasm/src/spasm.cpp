@@ -1,11 +1,108 @@
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <unordered_set>
 
+#include "byte_buffer.hpp"
+#include "channel.hpp"
+#include "mapped_file.hpp"
 #include "spasm.hpp"
+#include "tasks.hpp"
+#include "value_map.hpp"
+#include "vector_kernels.hpp"
 
 namespace SpasmImpl
 {
-Spasm::Spasm() {}
+/*!
+** Concatenates two strings. Short results are copied in a new interned
+** string, long ones become a rope that is flattened on first content access.
+*/
+const SPStringValue* StringTable::Concat(const SPStringValue* left,
+                                         const SPStringValue* right)
+{
+    if (left->GetLength() == 0)
+    {
+        return right;
+    }
+    if (right->GetLength() == 0)
+    {
+        return left;
+    }
+    if (left->GetLength() + right->GetLength() < MinRopeLength)
+    {
+        SPString result;
+        result.reserve(left->GetLength() + right->GetLength());
+        left->ForEachPiece(
+            [&result](const SPString& piece) { result += piece; });
+        right->ForEachPiece(
+            [&result](const SPString& piece) { result += piece; });
+        return Get(std::move(result));
+    }
+    m_Ropes.emplace_back(left, right);
+    return &m_Ropes.back();
+}
+
+/*!
+** Returns the interned flat string with the content of s. Ropes remember
+** their flat string, so they are flattened only once.
+*/
+const SPStringValue* StringTable::Flatten(const SPStringValue* s)
+{
+    if (!s->IsRope())
+    {
+        return s;
+    }
+    if (!s->GetFlat())
+    {
+        SPString result;
+        result.reserve(s->GetLength());
+        s->ForEachPiece([&result](const SPString& piece) { result += piece; });
+        s->SetFlat(Get(std::move(result)));
+    }
+    return s->GetFlat();
+}
+
+const size_t NativeRegistry::NotFound;
+
+size_t NativeRegistry::Find(const std::string& name) const
+{
+    for (size_t i = 0; i < m_Natives.size(); ++i)
+    {
+        if (m_Natives[i].Name == name)
+        {
+            return i;
+        }
+    }
+    return NotFound;
+}
+
+Spasm::Spasm() : m_Vectors(VectorKernels::Get()) {}
+
+const size_t Spasm::NoGlobal;
+const PC_t Spasm::NoExport;
+
+void Spasm::SetGlobals(std::vector<std::string> names)
+{
+    m_GlobalNames = std::move(names);
+    m_Globals.assign(m_GlobalNames.size(), data_t{});
+}
+
+size_t Spasm::FindGlobal(const std::string& name) const
+{
+    const auto position =
+        std::find(m_GlobalNames.begin(), m_GlobalNames.end(), name);
+    return position != m_GlobalNames.end()
+               ? size_t(position - m_GlobalNames.begin())
+               : NoGlobal;
+}
+
+const std::string& Spasm::GlobalName(size_t slot) const
+{
+    assert(slot < m_GlobalNames.size() && "Unknown global");
+    return m_GlobalNames[slot];
+}
 
 /*!
 ** Constructs new Spasm object
@@ -21,16 +118,161 @@ void Spasm::Initialize(PC_t _bc_size,
                        std::ostream& _ostr)
 
 {
-    m_PC = 0;
-    m_ByteCode.assign(_bytecode, _bytecode + _bc_size);
+    const auto program =
+        std::make_shared<const ByteCode>(_bytecode, _bytecode + _bc_size);
+    set_program(std::shared_ptr<const byte>(program, program->data()),
+                _bc_size);
+    m_ProgramImage.reset();
     istr = &_istr;
     ostr = &_ostr;
-    data_stack.resize(1024);
+    reset();
+}
+
+Spasm::~Spasm()
+{
+    join_tasks();
+}
+
+void Spasm::set_program(std::shared_ptr<const byte> program, PC_t size)
+{
+    m_Program = std::move(program);
+    m_ByteCode = m_Program.get();
+    m_CodeSize = size;
+}
+
+/*!
+** Rewinds the machine to the start of the program with empty stacks and
+** heap. The stacks keep their memory.
+*/
+void Spasm::reset()
+{
+    join_tasks();
+    m_PC = 0;
+    data_stack.resize(std::max<size_t>(data_stack.size(), 1024));
+    m_SP = &data_stack[0];
+    m_FP = &data_stack[0];
+    m_Frames = FrameStack();
+    std::fill(m_Globals.begin(), m_Globals.end(), data_t{});
+
+    m_Heap.clear();
+    m_RunQueue.clear();
+    m_Root = new Fiber;
+    m_Root->State = Fiber::Running;
+    m_Heap.emplace_back(m_Root);
+    m_Current = m_Root;
+}
+
+void Spasm::Reset()
+{
+    if (m_Current != m_Root || m_Heap.size() != 1)
+    {
+        // the fibers, tasks and vectors of the last run go with the heap,
+        // the other globals are kept as on the fast path
+        std::unordered_set<const void*> heap;
+        for (const auto& object : m_Heap)
+        {
+            heap.insert(object.get());
+        }
+        auto globals = m_Globals;
+        for (auto& global : globals)
+        {
+            if ((global.get_type() == ::Spasm::ValueType::Object ||
+                 global.get_type() == ::Spasm::ValueType::Array) &&
+                heap.count(global.get_pointer()))
+            {
+                global = data_t{};
+            }
+        }
+        reset();
+        m_Globals = std::move(globals);
+        return;
+    }
+    m_PC = 0;
     m_SP = &data_stack[0];
     m_FP = &data_stack[0];
+    while (!m_Frames.empty())
+    {
+        m_Frames.pop();
+    }
+    m_RunQueue.clear();
+    m_Root->State = Fiber::Running;
+    m_Root->Result = data_t{};
+    m_Exception = data_t{};
+}
+
+Spasm::ProgramImage::ProgramImage(const byte* code, PC_t size)
+    : CodeSize(size)
+{
+    const auto program = std::make_shared<const ByteCode>(code, code + size);
+    Code = std::shared_ptr<const byte>(program, program->data());
+}
+
+Spasm::ProgramImage::ProgramImage(std::shared_ptr<const byte> code,
+                                  PC_t size)
+    : Code(std::move(code)), CodeSize(size)
+{
+}
+
+void Spasm::Attach(std::shared_ptr<const ProgramImage> image,
+                   std::istream& input,
+                   std::ostream& output)
+{
+    m_ProgramImage = std::move(image);
+    const auto& program = *m_ProgramImage;
+    set_program(std::shared_ptr<const byte>(m_ProgramImage, program.Code.get()),
+                program.CodeSize);
+    m_Handlers = std::shared_ptr<const ExceptionHandlers>(m_ProgramImage,
+                                                          &program.Handlers);
+    SetGlobals(program.Globals);
+    istr = &input;
+    ostr = &output;
+    reset();
+}
+
+PC_t Spasm::FindExport(const std::string& name) const
+{
+    if (!m_ProgramImage)
+    {
+        return NoExport;
+    }
+    const auto& exports = m_ProgramImage->Exports;
+    const auto position = exports.find(name);
+    return position != exports.end() ? position->second : NoExport;
+}
+
+/*!
+** The arguments are laid out as by Call and the function runs in the
+** bottom frame, so its ret finishes the root fiber with the result.
+*/
+Spasm::RunResult Spasm::Call(PC_t address,
+                             const data_t* args,
+                             size_t count,
+                             data_t& result)
+{
+    Reset();
+    reserve_stack(count + 1);
+    std::copy(args, args + count, m_SP);
+    m_SP += count;
+    *m_SP = data_t(double(count));
+    m_FP = m_SP++;
+    m_PC = address;
+    const auto status = run();
+    result = m_Root->Result;
+    return status;
 }
 
-Spasm::~Spasm() {}
+Spasm::RunResult Spasm::Call(const std::string& name,
+                             const std::vector<data_t>& args,
+                             data_t& result)
+{
+    const auto address = FindExport(name);
+    if (address == NoExport)
+    {
+        std::cerr << "Unknown function: " << name << std::endl;
+        return RunResult::Exception;
+    }
+    return Call(address, args.data(), args.size(), result);
+}
 
 /*!
 ** Runs the machine. The machine stops if it reaches an invalid opcode
@@ -39,10 +281,36 @@ Spasm::~Spasm() {}
 */
 Spasm::RunResult Spasm::run()
 {
-    const auto codeSize = m_ByteCode.size();
+    return run(UINT64_MAX);
+}
+
+Spasm::RunResult Spasm::run(uint64_t budget)
+{
+    return execute<false>(budget);
+}
+
+Spasm::RunResult Spasm::RunCounted(uint64_t budget)
+{
+    return execute<true>(budget);
+}
+
+/*!
+** The counted loop is a copy of its own, so the runs that do not count pay
+** nothing for the counter.
+*/
+template <bool Counted>
+Spasm::RunResult Spasm::execute(uint64_t budget)
+{
+    assert(budget > 0 && "Nothing can run without a budget");
+    auto codeSize = m_CodeSize;
     while (m_PC < codeSize)
     {
+        const auto at = m_PC;
         const auto instruction = m_ByteCode[m_PC++];
+        if (Counted)
+        {
+            ++m_Executed;
+        }
         const auto opcode = OpCodes(instruction & 0x3f);
         const auto size = instruction >> 6;
         switch (opcode)
@@ -74,7 +342,7 @@ Spasm::RunResult Spasm::run()
             case OpCodes::Push:
             {
                 const auto count = PC_t(read_reg(size));
-                assert(m_SP + count <= &data_stack[data_stack.size() - 1]);
+                reserve_stack(count);
                 std::fill(m_SP, m_SP + count, data_t{});
                 m_SP += count;
                 break;
@@ -93,8 +361,20 @@ Spasm::RunResult Spasm::run()
             }
             case OpCodes::Call:
             {
-                const auto arg0 = read_reg(size);
+                auto arg0 = read_reg(size);
+                if (PC_t(arg0) >= codeSize)
+                {
+                    if (!bind_call(arg0, size))
+                    {
+                        return RunResult::Exception;
+                    }
+                    codeSize = m_CodeSize;
+                }
                 call(arg0);
+                if (--budget == 0)
+                {
+                    return RunResult::Suspended;
+                }
                 break;
             }
             case OpCodes::Ret:
@@ -106,21 +386,36 @@ Spasm::RunResult Spasm::run()
             case OpCodes::Jump:
             {
                 const auto arg0 = read_reg(size);
+                const auto next = m_PC;
                 go(arg0);
+                if (m_PC < next && --budget == 0)
+                {
+                    return RunResult::Suspended;
+                }
                 break;
             }
             case OpCodes::JumpT:
             {
                 const auto arg0 = read_reg(size);
                 const auto arg1 = read_reg(size);
+                const auto next = m_PC;
                 gotrue(arg0, arg1);
+                if (m_PC < next && --budget == 0)
+                {
+                    return RunResult::Suspended;
+                }
                 break;
             }
             case OpCodes::JumpF:
             {
                 const auto arg0 = read_reg(size);
                 const auto arg1 = read_reg(size);
+                const auto next = m_PC;
                 gofalse(arg0, arg1);
+                if (m_PC < next && --budget == 0)
+                {
+                    return RunResult::Suspended;
+                }
                 break;
             }
             case OpCodes::Const:
@@ -225,164 +520,1326 @@ Spasm::RunResult Spasm::run()
                 not_equal(arg0, arg1, arg2);
                 break;
             }
-            default:
+            case OpCodes::CallNative:
             {
-                std::cerr << opcode << ": not implemented" << std::endl;
-                return RunResult::NotImplemented;
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                call_native(arg0, arg1, arg2);
+                break;
             }
-        }
-    }
-    return RunResult::Success;
-}
-
-/*!
-** Pushes the next data_t object on the data stack
-*/
-void Spasm::push(reg_t reg)
-{
-    push_data(get_local(reg));
-}
-
-void Spasm::popto(reg_t reg)
-{
-    m_FP[reg] = *(--m_SP);
-}
-
-/*!
-** Dups the data_t object on top of the data stack.
-*/
-void Spasm::dup()
-{
-    push_data(*(m_SP - 1));
-}
-
-/*!
-** Reads a data_t object from the input stream and pushes it on the data
-** stack.
-*/
-void Spasm::read(reg_t reg)
-{
-    data_t x;
-    *istr >> x;
-    set_local(reg, x);
-}
-
-/*!
-** Pops a data_t object from the data stack and prints it on the output
-** stream.
-*/
-void Spasm::print(reg_t reg)
-{
-    *ostr << get_local(reg);
-}
-
-/*!
-** Pops two data objects from the data stack and pushes their sum on the
-** data stack.
-*/
-void Spasm::plus(reg_t a0, reg_t a1, reg_t a2)
-{
-    set_local(a0, get_local(a1) + get_local(a2));
-}
-
-/*!
-** Pops two data objects from the data stack and pushes their difference
-** on the data stack.
-*/
-void Spasm::minus(reg_t a0, reg_t a1, reg_t a2)
-{
-    set_local(a0, get_local(a1) - get_local(a2));
-}
-
-/*!
-** Pops two data objects from the data stack and pushes their product
-** on the data stack.
-*/
-void Spasm::multiply(reg_t a0, reg_t a1, reg_t a2)
-{
-    set_local(a0, get_local(a1) * get_local(a2));
-}
-
-/*!
-** Pops two data objects from the data stack and pushes their division
-** on the data stack.
-*/
-void Spasm::divide(reg_t a0, reg_t a1, reg_t a2)
-{
-    set_local(a0, get_local(a1) / get_local(a2));
-}
-
-/*!
-** Pops two data objects from the data stack and pushes their modulus
-** on the data stack.
-*/
-void Spasm::modulus(reg_t a0, reg_t a1, reg_t a2)
-{
-    set_local(a0, get_local(a1) % get_local(a2));
-}
-
-/*!
-** Conditional execution.
-** If the data_t object on top of the data stack evaluates to true
-** execution continues from the place pointed by number in the next bytes
-*/
-void Spasm::gotrue(reg_t a0, reg_t a1)
-{
-    if (get_local(a0))
-    {
-        go(a1);
-    }
-}
-
-/*!
-** Conditional execution.
-** If the data_t object on top of the data stack evaluates to false
-** execution continues from the place pointed by number in the next bytes
-*/
-void Spasm::gofalse(reg_t a0, reg_t a1)
-{
-    if (!get_local(a0))
-    {
-        go(a1);
-    }
-}
-
-/*!
-** Unconditional execution.
-** Execution continues from the opcode pointed by the next bytes
-*/
-void Spasm::go(reg_t a0)
-{
-    m_PC = PC_t(a0);
-}
-
-/*!
-** Function call. A new frame with the specified size is created, the
-** return address is saved in the return stack and the new pc is loaded.
-*/
-void Spasm::call(reg_t a0)
-{
-    Frame call{m_PC, PC_t(m_FP - &data_stack[0]),
-               m_SP - &data_stack[0] - PC_t((*(m_SP - 1)).get_double()) - 1};
-    m_Frames.push(std::move(call));
-    m_FP = m_SP - 1;
-    go(a0);
-}
-
-/*!
-** Function return. The frame of the current function is destroyed and the
-** saved return address is loaded in the pc
-*/
-void Spasm::ret(reg_t reg)
-{
-    Frame parent = m_Frames.top();
-    m_Frames.pop();
-    m_SP = &data_stack[parent.StackPointer];
+            case OpCodes::Spawn:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                spawn(arg0, arg1, arg2);
+                break;
+            }
+            case OpCodes::Yield:
+            {
+                const auto arg0 = read_reg(size);
+                yield(arg0);
+                break;
+            }
+            case OpCodes::Resume:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                resume(arg0, arg1);
+                break;
+            }
+            case OpCodes::Fork:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                fork(arg0, arg1, arg2);
+                break;
+            }
+            case OpCodes::Join:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                join(arg0, arg1);
+                break;
+            }
+            case OpCodes::LoadChannel:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                load_channel(arg0, arg1);
+                break;
+            }
+            case OpCodes::Send:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                send(arg0, arg1);
+                break;
+            }
+            case OpCodes::Receive:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                receive(arg0, arg1);
+                break;
+            }
+            case OpCodes::VNew:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                if (!vector_new(arg0, arg1))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::VGet:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                if (!vector_get(arg0, arg1, arg2))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::VSet:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                if (!vector_set(arg0, arg1, arg2))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::VAdd:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                if (!vector_add(arg0, arg1, arg2))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::VMul:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                if (!vector_mul(arg0, arg1, arg2))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::VScale:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                if (!vector_scale(arg0, arg1, arg2))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::VSum:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                vector_sum(arg0, arg1);
+                break;
+            }
+            case OpCodes::VDot:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                if (!vector_dot(arg0, arg1, arg2))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::Throw:
+            {
+                const auto arg0 = read_reg(size);
+                m_Exception = get_local(arg0);
+                goto thrown;
+            }
+            case OpCodes::Catch:
+            {
+                const auto arg0 = read_reg(size);
+                set_local(arg0, m_Exception);
+                break;
+            }
+            case OpCodes::GetG:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                get_global(arg0, arg1);
+                break;
+            }
+            case OpCodes::SetG:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                set_global(arg0, arg1);
+                break;
+            }
+            case OpCodes::TailCall:
+            {
+                auto arg0 = read_reg(size);
+                if (PC_t(arg0) >= codeSize)
+                {
+                    if (!bind_call(arg0, size))
+                    {
+                        return RunResult::Exception;
+                    }
+                    codeSize = m_CodeSize;
+                }
+                tail_call(arg0);
+                if (--budget == 0)
+                {
+                    return RunResult::Suspended;
+                }
+                break;
+            }
+            case OpCodes::MapNew:
+            {
+                const auto arg0 = read_reg(size);
+                map_new(arg0);
+                break;
+            }
+            case OpCodes::MapGet:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                map_get(arg0, arg1, arg2);
+                break;
+            }
+            case OpCodes::MapSet:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                map_set(arg0, arg1, arg2);
+                break;
+            }
+            case OpCodes::MapHas:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                map_has(arg0, arg1, arg2);
+                break;
+            }
+            case OpCodes::MapDelete:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                map_delete(arg0, arg1, arg2);
+                break;
+            }
+            case OpCodes::BOpen:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                buffer_open(arg0, arg1);
+                break;
+            }
+            case OpCodes::BNew:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                if (!buffer_new(arg0, arg1))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::BSize:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                buffer_size(arg0, arg1);
+                break;
+            }
+            case OpCodes::BSlice:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                const auto arg3 = read_reg(size);
+                if (!buffer_slice(arg0, arg1, arg2, arg3))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::BGet:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                const auto arg3 = read_reg(size);
+                if (!buffer_get(arg0, arg1, arg2, arg3))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            case OpCodes::BSet:
+            {
+                const auto arg0 = read_reg(size);
+                const auto arg1 = read_reg(size);
+                const auto arg2 = read_reg(size);
+                const auto arg3 = read_reg(size);
+                if (!buffer_set(arg0, arg1, arg2, arg3))
+                {
+                    goto thrown;
+                }
+                break;
+            }
+            default:
+            {
+                std::cerr << opcode << ": not implemented" << std::endl;
+                return RunResult::NotImplemented;
+            }
+        }
+        continue;
+
+    thrown:
+        // the instructions that throw come here with m_Exception set, a
+        // handler can throw again, so a throw pays like a jump
+        if (!raise(at))
+        {
+            return RunResult::Exception;
+        }
+        if (--budget == 0)
+        {
+            return RunResult::Suspended;
+        }
+    }
+    return RunResult::Success;
+}
+
+/*!
+** Pushes the next data_t object on the data stack
+*/
+void Spasm::push(reg_t reg)
+{
+    push_data(get_local(reg));
+}
+
+void Spasm::popto(reg_t reg)
+{
+    m_FP[reg] = *(--m_SP);
+}
+
+/*!
+** Dups the data_t object on top of the data stack.
+*/
+void Spasm::dup()
+{
+    push_data(*(m_SP - 1));
+}
+
+/*!
+** Reads a data_t object from the input stream and pushes it on the data
+** stack.
+*/
+void Spasm::read(reg_t reg)
+{
+    data_t x;
+    *istr >> x;
+    set_local(reg, x);
+}
+
+/*!
+** Pops a data_t object from the data stack and prints it on the output
+** stream. A rope is written a piece at a time, without flattening it.
+*/
+void Spasm::print(reg_t reg)
+{
+    const auto value = get_local(reg);
+    if (value.get_type() == ::Spasm::ValueType::String &&
+        !value.is_short_string())
+    {
+        heap_string(value)->ForEachPiece(
+            [this](const SPString& piece) { *ostr << piece; });
+    }
+    else
+    {
+        *ostr << value;
+    }
+}
+
+/*!
+** Pops two data objects from the data stack and pushes their sum on the
+** data stack. If any of them is a string, pushes their concatenation.
+*/
+void Spasm::plus(reg_t a0, reg_t a1, reg_t a2)
+{
+    const auto lhs = get_local(a1);
+    const auto rhs = get_local(a2);
+    if (lhs.is_double() && rhs.is_double())
+    {
+        set_local(a0, lhs + rhs);
+    }
+    else
+    {
+        set_local(a0, concat(to_string(lhs), to_string(rhs)));
+    }
+}
+
+/*!
+** Pops two data objects from the data stack and pushes their difference
+** on the data stack.
+*/
+void Spasm::minus(reg_t a0, reg_t a1, reg_t a2)
+{
+    set_local(a0, get_local(a1) - get_local(a2));
+}
+
+/*!
+** Pops two data objects from the data stack and pushes their product
+** on the data stack.
+*/
+void Spasm::multiply(reg_t a0, reg_t a1, reg_t a2)
+{
+    set_local(a0, get_local(a1) * get_local(a2));
+}
+
+/*!
+** Pops two data objects from the data stack and pushes their division
+** on the data stack.
+*/
+void Spasm::divide(reg_t a0, reg_t a1, reg_t a2)
+{
+    set_local(a0, get_local(a1) / get_local(a2));
+}
+
+/*!
+** Pops two data objects from the data stack and pushes their modulus
+** on the data stack.
+*/
+void Spasm::modulus(reg_t a0, reg_t a1, reg_t a2)
+{
+    set_local(a0, get_local(a1) % get_local(a2));
+}
+
+/*!
+** Conditional execution.
+** If the data_t object on top of the data stack evaluates to true
+** execution continues from the place pointed by number in the next bytes
+*/
+void Spasm::gotrue(reg_t a0, reg_t a1)
+{
+    if (get_local(a0))
+    {
+        go(a1);
+    }
+}
+
+/*!
+** Conditional execution.
+** If the data_t object on top of the data stack evaluates to false
+** execution continues from the place pointed by number in the next bytes
+*/
+void Spasm::gofalse(reg_t a0, reg_t a1)
+{
+    if (!get_local(a0))
+    {
+        go(a1);
+    }
+}
+
+/*!
+** Unconditional execution.
+** Execution continues from the opcode pointed by the next bytes
+*/
+void Spasm::go(reg_t a0)
+{
+    m_PC = PC_t(a0);
+}
+
+/*!
+** Function call. A new frame with the specified size is created, the
+** return address is saved in the return stack and the new pc is loaded.
+*/
+void Spasm::call(reg_t a0)
+{
+    Frame call{m_PC, PC_t(m_FP - &data_stack[0]),
+               m_SP - &data_stack[0] - PC_t((*(m_SP - 1)).get_double()) - 1};
+    m_Frames.push(std::move(call));
+    m_FP = m_SP - 1;
+    go(a0);
+}
+
+/*!
+** Calls a0 in place of the current function. The arguments and their count
+** on the top of the stack replace those of the current function, so the
+** callee returns to the caller of the current function and the frames stay
+** as they are. Only a function can make a tail call.
+*/
+void Spasm::tail_call(reg_t a0)
+{
+    const auto count = PC_t((*(m_SP - 1)).get_double());
+    const auto first = m_FP - PC_t(m_FP->get_double());
+    m_SP = std::copy(m_SP - count - 1, m_SP, first);
+    m_FP = m_SP - 1;
+    go(a0);
+}
+
+/*!
+** Binds a call past the end of the code with the binder and continues with
+** the code of the binder. The tasks run the code of the machine, so a
+** machine with a task pool does not bind, the code would change under them.
+** \return false if the call can not be bound
+*/
+bool Spasm::bind_call(reg_t& a0, size_t size)
+{
+    if (!m_Binder)
+    {
+        std::cerr << "Call outside of the program: " << a0 << std::endl;
+        return false;
+    }
+    if (m_Tasks)
+    {
+        std::cerr << "Lazy call with a task pool: " << a0 << std::endl;
+        return false;
+    }
+    const auto position = m_PC - (PC_t(1) << size);
+    auto binding = m_Binder(PC_t(a0), position);
+    if (binding.Address >= binding.CodeSize)
+    {
+        std::cerr << "Unresolved call: " << a0 << std::endl;
+        return false;
+    }
+    set_program(std::move(binding.Code), binding.CodeSize);
+    a0 = reg_t(binding.Address);
+    return true;
+}
+
+/*!
+** Function return. The frame of the current function is destroyed and the
+** saved return address is loaded in the pc. Returning from the bottom frame
+** finishes the fiber.
+*/
+void Spasm::ret(reg_t reg)
+{
+    if (m_Frames.empty())
+    {
+        finish(get_local(reg));
+        return;
+    }
+    Frame parent = m_Frames.top();
+    m_Frames.pop();
+    m_SP = &data_stack[parent.StackPointer];
     *(m_SP - 1) = m_FP[reg];
     m_FP = &data_stack[parent.FramePointer];
     m_PC = parent.ReturnAddress;
 }
 
+/*!
+** Loads the global slot a1 in a0
+*/
+void Spasm::get_global(reg_t a0, reg_t a1)
+{
+    assert(size_t(a1) < m_Globals.size() && "Unknown global");
+    set_local(a0, m_Globals[size_t(a1)]);
+}
+
+/*!
+** Stores a1 in the global slot a0
+*/
+void Spasm::set_global(reg_t a0, reg_t a1)
+{
+    assert(size_t(a0) < m_Globals.size() && "Unknown global");
+    m_Globals[size_t(a0)] = get_local(a1);
+}
+
+/*!
+** Transfers control to the handler of the instruction at. The frames
+** without a handler are destroyed and the search continues from their
+** call. The stack of the frame that catches is as it was before the call,
+** without the slot for the result.
+** \return false if nothing catches, the frames of the fiber are gone then
+*/
+bool Spasm::unwind(PC_t at)
+{
+    for (;;)
+    {
+        if (const auto handler = find_handler(at))
+        {
+            m_PC = handler->Handler;
+            return true;
+        }
+        if (m_Frames.empty())
+        {
+            return false;
+        }
+        const Frame parent = m_Frames.top();
+        m_Frames.pop();
+        m_SP = &data_stack[parent.StackPointer - 1];
+        m_FP = &data_stack[parent.FramePointer];
+        // the return address is past the call, so step back into it
+        at = parent.ReturnAddress - 1;
+    }
+}
+
+/*!
+** Throws m_Exception from the instruction at, see unwind.
+** \return false if nothing catches it, it is reported then
+*/
+bool Spasm::raise(PC_t at)
+{
+    if (unwind(at))
+    {
+        return true;
+    }
+    std::cerr << "Uncaught exception: " << m_Exception << std::endl;
+    return false;
+}
+
+const Spasm::ExceptionHandler* Spasm::find_handler(PC_t at) const
+{
+    if (!m_Handlers)
+    {
+        return nullptr;
+    }
+    const ExceptionHandler* result = nullptr;
+    for (const auto& handler : *m_Handlers)
+    {
+        if (handler.Begin <= at && at < handler.End &&
+            (!result ||
+             handler.End - handler.Begin < result->End - result->Begin))
+        {
+            result = &handler;
+        }
+    }
+    return result;
+}
+
+/*!
+** Calls the native function with index a1. Its arguments are the registers
+** starting from a2 and the result is stored in a0.
+*/
+void Spasm::call_native(reg_t a0, reg_t a1, reg_t a2)
+{
+    assert(m_Natives && "No native functions are set");
+    const auto& native = m_Natives->Get(size_t(a1));
+    assert(&data_stack[0] <= (m_FP + a2));
+    assert((m_FP + a2 + reg_t(native.Arity)) <= m_SP);
+    set_local(a0, native.Function(m_FP + a2, native.Arity));
+}
+
+/*!
+** Creates a fiber that starts from a1 with the value of a2 in its register
+** 0 and puts it at the end of the run queue. a0 gets the fiber.
+*/
+void Spasm::spawn(reg_t a0, reg_t a1, reg_t a2)
+{
+    auto fiber = new Fiber;
+    m_Heap.emplace_back(fiber);
+    fiber->PC = PC_t(a1);
+    fiber->Stack.resize(FiberStackSize);
+    fiber->Stack[0] = get_local(a2);
+    fiber->StackPointer = 1;
+    schedule(fiber);
+    set_local(a0, data_t(::Spasm::ValueType::Object, (void*)fiber));
+}
+
+/*!
+** Gives the value of a0 to the fiber that resumed the current one and
+** switches to it. If there is no such fiber, the current one goes at the
+** end of the run queue and the next ready fiber runs.
+*/
+void Spasm::yield(reg_t a0)
+{
+    auto fiber = m_Current;
+    if (fiber->Resumer)
+    {
+        const auto value = get_local(a0);
+        auto resumer = fiber->Resumer;
+        fiber->Resumer = nullptr;
+        fiber->State = Fiber::Suspended;
+        switch_to(resumer);
+        set_local(resumer->ResumeRegister, value);
+    }
+    else
+    {
+        schedule(fiber);
+        run_next();
+    }
+}
+
+/*!
+** Runs the fiber in a1 until it yields or finishes and stores the value
+** it gave in a0. Resuming a finished fiber gives its result again.
+*/
+void Spasm::resume(reg_t a0, reg_t a1)
+{
+    auto fiber = to_fiber(get_local(a1));
+    if (fiber->State == Fiber::Done)
+    {
+        set_local(a0, fiber->Result);
+        return;
+    }
+    assert((fiber->State == Fiber::Ready ||
+            fiber->State == Fiber::Suspended) &&
+           "The fiber is already running");
+    fiber->Resumer = m_Current;
+    m_Current->ResumeRegister = a0;
+    m_Current->State = Fiber::Blocked;
+    switch_to(fiber);
+}
+
+/*!
+** Finishes the current fiber with result and switches to its resumer or
+** to the next ready fiber. Finishing the root fiber stops the machine.
+*/
+void Spasm::finish(data_t result)
+{
+    auto fiber = m_Current;
+    if (fiber == m_Root)
+    {
+        fiber->Result = result;
+        m_PC = m_CodeSize;
+        return;
+    }
+    fiber->State = Fiber::Done;
+    fiber->Result = result;
+    auto resumer = fiber->Resumer;
+    fiber->Resumer = nullptr;
+    if (resumer)
+    {
+        switch_to(resumer);
+        set_local(resumer->ResumeRegister, result);
+    }
+    else
+    {
+        run_next();
+    }
+    fiber->Stack = DataStack();
+    fiber->Frames = FrameStack();
+}
+
+void Spasm::schedule(Fiber* fiber)
+{
+    fiber->State = Fiber::Ready;
+    if (!fiber->Queued)
+    {
+        fiber->Queued = true;
+        m_RunQueue.push_back(fiber);
+    }
+}
+
+/*!
+** Switches to the first ready fiber in the run queue. The entries of the
+** fibers that were resumed directly after being queued are skipped.
+*/
+void Spasm::run_next()
+{
+    for (;;)
+    {
+        assert(!m_RunQueue.empty() && "No fiber is ready to run");
+        auto fiber = m_RunQueue.front();
+        m_RunQueue.pop_front();
+        fiber->Queued = false;
+        if (fiber->State == Fiber::Ready)
+        {
+            switch_to(fiber);
+            return;
+        }
+    }
+}
+
+/*!
+** Saves the registers and the stacks of the current fiber and loads those
+** of fiber. The stacks are swapped, so nothing is copied.
+*/
+void Spasm::switch_to(Fiber* fiber)
+{
+    auto current = m_Current;
+    if (fiber != current)
+    {
+        current->PC = m_PC;
+        current->StackPointer = PC_t(m_SP - &data_stack[0]);
+        current->FramePointer = PC_t(m_FP - &data_stack[0]);
+        std::swap(current->Stack, data_stack);
+        std::swap(current->Frames, m_Frames);
+
+        std::swap(fiber->Stack, data_stack);
+        std::swap(fiber->Frames, m_Frames);
+        m_PC = fiber->PC;
+        m_SP = &data_stack[0] + fiber->StackPointer;
+        m_FP = &data_stack[0] + fiber->FramePointer;
+        m_Current = fiber;
+    }
+    fiber->State = Fiber::Running;
+}
+
+Spasm::Fiber* Spasm::to_fiber(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::Object);
+    auto object = static_cast<HeapObject*>(value.get_pointer());
+    assert(object->GetKind() == HeapObject::Kind::Fiber);
+    return static_cast<Fiber*>(object);
+}
+
+/*!
+** Forks a task that calls a1 with the value of a2 in its register 0, like
+** a spawned fiber. The task may run on any worker of the task pool. a0 gets
+** the task.
+*/
+void Spasm::fork(reg_t a0, reg_t a1, reg_t a2)
+{
+    assert(m_Tasks && "No task pool is set");
+    auto task = new Task;
+    m_Heap.emplace_back(task);
+    task->Owner = this;
+    task->Entry = PC_t(a1);
+    task->Argument = export_value(get_local(a2));
+    set_local(a0, data_t(::Spasm::ValueType::Object, (void*)task));
+    m_Tasks->Fork(task);
+}
+
+/*!
+** Waits for the task in a1 and stores its result in a0. The thread runs
+** other tasks while waiting.
+*/
+void Spasm::join(reg_t a0, reg_t a1)
+{
+    auto task = to_task(get_local(a1));
+    if (!task->Done.load(std::memory_order_acquire))
+    {
+        m_Tasks->Join(task);
+    }
+    set_local(a0, import_value(task->Result));
+}
+
+/*!
+** Waits for the tasks that were forked, but not joined. They refer to the
+** program and the heap of the machine.
+*/
+void Spasm::join_tasks()
+{
+    if (!m_Tasks)
+    {
+        return;
+    }
+    for (const auto& object : m_Heap)
+    {
+        if (object->GetKind() == HeapObject::Kind::Task)
+        {
+            auto task = static_cast<Task*>(object.get());
+            if (!task->Done.load(std::memory_order_acquire))
+            {
+                m_Tasks->Join(task);
+            }
+        }
+    }
+}
+
+/*!
+** Runs the task to completion with the program of the machine that forked
+** it and returns its result.
+*/
+data_t Spasm::run_task(const Task& task)
+{
+    const auto& owner = *task.Owner;
+    if (m_Program != owner.m_Program)
+    {
+        set_program(owner.m_Program, owner.m_CodeSize);
+    }
+    m_Natives = owner.m_Natives;
+    m_Tasks = owner.m_Tasks;
+    m_Handlers = owner.m_Handlers;
+    m_Globals.assign(owner.m_Globals.size(), data_t{});
+    istr = owner.istr;
+    ostr = owner.ostr;
+    reset();
+    m_PC = task.Entry;
+    push_data(import_value(task.Argument));
+    run();
+    join_tasks();
+    return export_value(m_Root->Result);
+}
+
+/*!
+** Prepares a value to be read by another machine. Long strings are
+** flattened, so the other machine can copy them without touching the
+** string table of this one.
+*/
+data_t Spasm::export_value(data_t value)
+{
+    assert(value.get_type() != ::Spasm::ValueType::Object &&
+           value.get_type() != ::Spasm::ValueType::Array &&
+           "Objects can not be passed between machines");
+    if (value.get_type() == ::Spasm::ValueType::String &&
+        !value.is_short_string())
+    {
+        return data_t(::Spasm::ValueType::String, (void*)flatten(value));
+    }
+    return value;
+}
+
+/*!
+** Copies a value exported by another machine in this one.
+*/
+data_t Spasm::import_value(data_t value)
+{
+    if (value.get_type() == ::Spasm::ValueType::String &&
+        !value.is_short_string())
+    {
+        const auto& s = static_cast<const SPStringValue*>(value.get_pointer())
+                            ->GetValue();
+        return make_string(s.data(), s.size());
+    }
+    return value;
+}
+
+Task* Spasm::to_task(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::Object);
+    auto object = static_cast<HeapObject*>(value.get_pointer());
+    assert(object->GetKind() == HeapObject::Kind::Task);
+    return static_cast<Task*>(object);
+}
+
+/*!
+** Stores the channel attached with index a1 in a0.
+*/
+void Spasm::load_channel(reg_t a0, reg_t a1)
+{
+    assert(size_t(a1) < m_Channels.size() && "Unknown channel");
+    set_local(a0,
+              data_t(::Spasm::ValueType::Object, (void*)m_Channels[size_t(a1)]));
+}
+
+/*!
+** Sends the value of a1 on the channel in a0, waits while it is full.
+*/
+void Spasm::send(reg_t a0, reg_t a1)
+{
+    to_channel(get_local(a0))->Send(export_value(get_local(a1)));
+}
+
+/*!
+** Receives a value from the channel in a1 and stores it in a0, waits
+** while the channel is empty.
+*/
+void Spasm::receive(reg_t a0, reg_t a1)
+{
+    set_local(a0, import_value(to_channel(get_local(a1))->Receive()));
+}
+
+Channel* Spasm::to_channel(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::Object);
+    auto object = static_cast<HeapObject*>(value.get_pointer());
+    assert(object->GetKind() == HeapObject::Kind::Channel);
+    return static_cast<Channel*>(object);
+}
+
+/*!
+** Stores a new array of a1 zeros in a0.
+** \return false if a1 is not a length or the memory runs out
+*/
+bool Spasm::vector_new(reg_t a0, reg_t a1)
+{
+    size_t length;
+    if (!to_index(get_local(a1), std::vector<double>().max_size(), length))
+    {
+        return set_error("Length out of range");
+    }
+    NumberArray* array;
+    try
+    {
+        array = new NumberArray(length);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return set_error("Out of memory");
+    }
+    m_Heap.emplace_back(array);
+    set_local(a0, data_t(::Spasm::ValueType::Array, (void*)array));
+    return true;
+}
+
+/*!
+** Stores the element of the array in a1 with index a2 in a0.
+** \return false if the index is out of the array, see set_error
+*/
+bool Spasm::vector_get(reg_t a0, reg_t a1, reg_t a2)
+{
+    const auto& elements = to_array(get_local(a1))->Elements;
+    size_t index;
+    if (elements.empty() ||
+        !to_index(get_local(a2), elements.size() - 1, index))
+    {
+        return set_error("Index out of range");
+    }
+    set_local(a0, data_t(elements[index]));
+    return true;
+}
+
+/*!
+** Sets the element of the array in a0 with index a1 to a2.
+** \return false if the index is out of the array, see set_error
+*/
+bool Spasm::vector_set(reg_t a0, reg_t a1, reg_t a2)
+{
+    auto& elements = to_array(get_local(a0))->Elements;
+    size_t index;
+    if (elements.empty() ||
+        !to_index(get_local(a1), elements.size() - 1, index))
+    {
+        return set_error("Index out of range");
+    }
+    elements[index] = get_local(a2).get_double();
+    return true;
+}
+
+/*!
+** Adds the arrays in a1 and a2 element by element into the array in a0.
+** The three have the same length, a0 may be one of the others.
+** \return false if the lengths differ, see set_error
+*/
+bool Spasm::vector_add(reg_t a0, reg_t a1, reg_t a2)
+{
+    auto& out = to_array(get_local(a0))->Elements;
+    const auto& a = to_array(get_local(a1))->Elements;
+    const auto& b = to_array(get_local(a2))->Elements;
+    if (out.size() != a.size() || a.size() != b.size())
+    {
+        return set_error("Lengths differ");
+    }
+    m_Vectors.Add(out.data(), a.data(), b.data(), out.size());
+    return true;
+}
+
+/*!
+** Multiplies the arrays in a1 and a2 element by element into a0.
+** \return false if the lengths differ, see set_error
+*/
+bool Spasm::vector_mul(reg_t a0, reg_t a1, reg_t a2)
+{
+    auto& out = to_array(get_local(a0))->Elements;
+    const auto& a = to_array(get_local(a1))->Elements;
+    const auto& b = to_array(get_local(a2))->Elements;
+    if (out.size() != a.size() || a.size() != b.size())
+    {
+        return set_error("Lengths differ");
+    }
+    m_Vectors.Mul(out.data(), a.data(), b.data(), out.size());
+    return true;
+}
+
+/*!
+** Multiplies the array in a1 by the number in a2 into the array in a0.
+** \return false if the lengths differ, see set_error
+*/
+bool Spasm::vector_scale(reg_t a0, reg_t a1, reg_t a2)
+{
+    auto& out = to_array(get_local(a0))->Elements;
+    const auto& a = to_array(get_local(a1))->Elements;
+    if (out.size() != a.size())
+    {
+        return set_error("Lengths differ");
+    }
+    m_Vectors.Scale(out.data(), a.data(), get_local(a2).get_double(),
+                    out.size());
+    return true;
+}
+
+/*!
+** Stores the sum of the elements of the array in a1 in a0.
+*/
+void Spasm::vector_sum(reg_t a0, reg_t a1)
+{
+    const auto& a = to_array(get_local(a1))->Elements;
+    set_local(a0, data_t(m_Vectors.Sum(a.data(), a.size())));
+}
+
+/*!
+** Stores the dot product of the arrays in a1 and a2 in a0.
+** \return false if the lengths differ, see set_error
+*/
+bool Spasm::vector_dot(reg_t a0, reg_t a1, reg_t a2)
+{
+    const auto& a = to_array(get_local(a1))->Elements;
+    const auto& b = to_array(get_local(a2))->Elements;
+    if (a.size() != b.size())
+    {
+        return set_error("Lengths differ");
+    }
+    set_local(a0, data_t(m_Vectors.Dot(a.data(), b.data(), a.size())));
+    return true;
+}
+
+NumberArray* Spasm::to_array(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::Array);
+    return static_cast<NumberArray*>(value.get_pointer());
+}
+
+/*!
+** Stores a new empty map in a0.
+*/
+void Spasm::map_new(reg_t a0)
+{
+    auto map = new ValueMap;
+    m_Heap.emplace_back(map);
+    set_local(a0, data_t(::Spasm::ValueType::Object, (void*)map));
+}
+
+/*!
+** Stores the value of the map in a1 with key a2 in a0, undefined if the map
+** has no such key.
+*/
+void Spasm::map_get(reg_t a0, reg_t a1, reg_t a2)
+{
+    const auto& entries = to_map(get_local(a1))->Entries;
+    const auto position = entries.find(map_key(get_local(a2)));
+    set_local(a0, position != entries.end()
+                      ? position->second
+                      : data_t(::Spasm::ValueType::Undefined, uint64_t(0)));
+}
+
+/*!
+** Sets the value of the map in a0 with key a1 to a2.
+*/
+void Spasm::map_set(reg_t a0, reg_t a1, reg_t a2)
+{
+    to_map(get_local(a0))->Entries[map_key(get_local(a1))] = get_local(a2);
+}
+
+/*!
+** Stores whether the map in a1 has the key a2 in a0.
+*/
+void Spasm::map_has(reg_t a0, reg_t a1, reg_t a2)
+{
+    const auto& entries = to_map(get_local(a1))->Entries;
+    const auto key = map_key(get_local(a2));
+    set_local(a0, data_t(entries.find(key) != entries.end()));
+}
+
+/*!
+** Removes the key a2 from the map in a1 and stores whether it was there
+** in a0.
+*/
+void Spasm::map_delete(reg_t a0, reg_t a1, reg_t a2)
+{
+    auto& entries = to_map(get_local(a1))->Entries;
+    set_local(a0, data_t(entries.erase(map_key(get_local(a2))) != 0));
+}
+
+ValueMap* Spasm::to_map(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::Object);
+    auto object = static_cast<HeapObject*>(value.get_pointer());
+    assert(object->GetKind() == HeapObject::Kind::Map);
+    return static_cast<ValueMap*>(object);
+}
+
+/*!
+** Maps the file with the name in a1 and stores its read-only buffer in a0,
+** false if the file can not be opened.
+*/
+void Spasm::buffer_open(reg_t a0, reg_t a1)
+{
+    const auto name = get_local(a1);
+    const auto path =
+        name.is_short_string()
+            ? std::string(name.short_string_data(), name.short_string_length())
+            : flatten(name)->GetValue();
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(path))
+    {
+        set_local(a0, data_t(false));
+        return;
+    }
+    const auto data = const_cast<uint8_t*>(file->Data());
+    const auto size = file->Size();
+    auto buffer = new ByteBuffer(std::move(file), data, size, false);
+    m_Heap.emplace_back(buffer);
+    set_local(a0, data_t(::Spasm::ValueType::Object, (void*)buffer));
+}
+
+/*!
+** Stores a new writable buffer of a1 zero bytes in a0.
+** \return false if a1 is not a size or the memory runs out
+*/
+bool Spasm::buffer_new(reg_t a0, reg_t a1)
+{
+    size_t length;
+    if (!to_index(get_local(a1), std::vector<uint8_t>().max_size(),
+                      length))
+    {
+        return set_error("Size out of range");
+    }
+    std::shared_ptr<std::vector<uint8_t>> bytes;
+    try
+    {
+        bytes = std::make_shared<std::vector<uint8_t>>(length);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return set_error("Out of memory");
+    }
+    const auto data = bytes->data();
+    const auto size = bytes->size();
+    auto buffer = new ByteBuffer(std::move(bytes), data, size, true);
+    m_Heap.emplace_back(buffer);
+    set_local(a0, data_t(::Spasm::ValueType::Object, (void*)buffer));
+    return true;
+}
+
+/*!
+** Stores the number of bytes of the buffer in a1 in a0.
+*/
+void Spasm::buffer_size(reg_t a0, reg_t a1)
+{
+    set_local(a0, data_t(double(to_buffer(get_local(a1))->Size)));
+}
+
+/*!
+** Stores the a3 bytes of the buffer in a1 from offset a2 in a0. The slice
+** shares the bytes of the buffer.
+** \return false if the slice is out of the buffer, see set_error
+*/
+bool Spasm::buffer_slice(reg_t a0, reg_t a1, reg_t a2, reg_t a3)
+{
+    const auto source = to_buffer(get_local(a1));
+    size_t offset;
+    size_t length;
+    if (!to_index(get_local(a2), source->Size, offset) ||
+        !to_index(get_local(a3), source->Size - offset, length))
+    {
+        return set_error("Slice out of range");
+    }
+    auto buffer = new ByteBuffer(source->Storage, source->Data + offset,
+                                 length, source->Writable);
+    m_Heap.emplace_back(buffer);
+    set_local(a0, data_t(::Spasm::ValueType::Object, (void*)buffer));
+    return true;
+}
+
+/*!
+** Stores the number at offset a2 of the buffer in a1 in a0, a3 is the
+** format of the number.
+** \return false if the number is out of the buffer, see set_error
+*/
+bool Spasm::buffer_get(reg_t a0, reg_t a1, reg_t a2, reg_t a3)
+{
+    const auto buffer = to_buffer(get_local(a1));
+    const auto format = ByteBuffer::Format(a3);
+    const auto width = ByteBuffer::Width(format);
+    size_t offset;
+    if (width > buffer->Size ||
+        !to_index(get_local(a2), buffer->Size - width, offset))
+    {
+        return set_error("Offset out of range");
+    }
+    set_local(a0, data_t(buffer->Get(offset, format)));
+    return true;
+}
+
+/*!
+** Writes a2 at offset a1 of the buffer in a0, a3 is the format of the
+** number.
+** \return false if the buffer is read-only, the number is out of it or
+** a2 does not fit the format
+*/
+bool Spasm::buffer_set(reg_t a0, reg_t a1, reg_t a2, reg_t a3)
+{
+    const auto buffer = to_buffer(get_local(a0));
+    const auto format = ByteBuffer::Format(a3);
+    const auto width = ByteBuffer::Width(format);
+    if (!buffer->Writable)
+    {
+        return set_error("The buffer is read-only");
+    }
+    size_t offset;
+    if (width > buffer->Size ||
+        !to_index(get_local(a1), buffer->Size - width, offset))
+    {
+        return set_error("Offset out of range");
+    }
+    const auto value = get_local(a2);
+    if (value.get_type() != ::Spasm::ValueType::Number ||
+        !ByteBuffer::Fits(format, value.get_double()))
+    {
+        return set_error("Value out of range");
+    }
+    buffer->Set(offset, format, value.get_double());
+    return true;
+}
+
+/*!
+** Converts value to an index of at most limit. Negative numbers, NaN and
+** the other types are not indices, so nothing undefined is converted.
+*/
+bool Spasm::to_index(data_t value, size_t limit, size_t& index) const
+{
+    if (value.get_type() != ::Spasm::ValueType::Number)
+    {
+        return false;
+    }
+    const auto number = value.get_double();
+    if (!(number >= 0 && number <= double(limit)))
+    {
+        return false;
+    }
+    index = size_t(number);
+    return index <= limit;
+}
+
+/*!
+** Makes message the exception that the failed vector or buffer
+** instruction throws.
+** \return false, for the instruction to return
+*/
+bool Spasm::set_error(const char* message)
+{
+    m_Exception = make_string(message, std::strlen(message));
+    return false;
+}
+
+ByteBuffer* Spasm::to_buffer(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::Object);
+    auto object = static_cast<HeapObject*>(value.get_pointer());
+    assert(object->GetKind() == HeapObject::Kind::Buffer);
+    return static_cast<ByteBuffer*>(object);
+}
+
+/*!
+** Returns the key of a map for a value. Long strings become their interned
+** flat string, so equal strings are the same pointer, see ValueMapHash.
+*/
+data_t Spasm::map_key(data_t value)
+{
+    if (value.get_type() == ::Spasm::ValueType::String &&
+        !value.is_short_string())
+    {
+        return data_t(::Spasm::ValueType::String, (void*)flatten(value));
+    }
+    return value;
+}
+
 /*!
 ** Local variable with index top of the data stack is pushed on top of the
 ** data stack.
@@ -430,12 +1887,111 @@ void Spasm::greatereq(reg_t a0, reg_t a1, reg_t a2)
 
 void Spasm::equal(reg_t a0, reg_t a1, reg_t a2)
 {
-    set_local(a0, get_local(a1) == get_local(a2));
+    set_local(a0, data_t(strict_equals(get_local(a1), get_local(a2))));
 }
 
 void Spasm::not_equal(reg_t a0, reg_t a1, reg_t a2)
 {
-    set_local(a0, get_local(a1) != get_local(a2));
+    set_local(a0, data_t(!strict_equals(get_local(a1), get_local(a2))));
+}
+
+/*!
+** Converts the value to a string, as it would have been printed.
+*/
+data_t Spasm::to_string(data_t value)
+{
+    if (value.get_type() == ::Spasm::ValueType::String)
+    {
+        return value;
+    }
+    std::ostringstream result;
+    result << value;
+    const auto s = result.str();
+    return make_string(s.data(), s.size());
+}
+
+/*!
+** Makes a string value, short strings are kept inline and are never
+** interned. So a string has exactly one representation - inline, interned
+** or a rope longer than the inline capacity.
+*/
+data_t Spasm::make_string(const char* s, size_t length)
+{
+    if (length <= data_t::ShortStringCapacity)
+    {
+        return data_t::short_string(s, length);
+    }
+    return data_t(::Spasm::ValueType::String, (void*)m_Strings.Get(s, length));
+}
+
+/*!
+** Concatenates two string values. Results that fit inline do not touch the
+** string table at all.
+*/
+data_t Spasm::concat(data_t lhs, data_t rhs)
+{
+    if (lhs.is_short_string() && rhs.is_short_string())
+    {
+        const auto left = lhs.short_string_length();
+        const auto right = rhs.short_string_length();
+        if (left + right <= data_t::ShortStringCapacity)
+        {
+            char result[data_t::ShortStringCapacity];
+            std::copy_n(lhs.short_string_data(), left, result);
+            std::copy_n(rhs.short_string_data(), right, result + left);
+            return data_t::short_string(result, left + right);
+        }
+    }
+    const auto result = m_Strings.Concat(heap_string(lhs), heap_string(rhs));
+    return data_t(::Spasm::ValueType::String, (void*)result);
+}
+
+/*!
+** Returns the string table entry of a string value, interning short strings
+** so they can become a part of a rope.
+*/
+const SPStringValue* Spasm::heap_string(data_t value)
+{
+    assert(value.get_type() == ::Spasm::ValueType::String);
+    if (value.is_short_string())
+    {
+        return m_Strings.Get(value.short_string_data(),
+                             value.short_string_length());
+    }
+    return static_cast<const SPStringValue*>(value.get_pointer());
+}
+
+/*!
+** Returns the interned flat string of a string value.
+*/
+const SPStringValue* Spasm::flatten(data_t value)
+{
+    return m_Strings.Flatten(heap_string(value));
+}
+
+/*!
+** Numbers are compared by value, strings by content and everything else by
+** identity. Interned strings are equal only if they are the same, so ropes
+** are flattened before comparing. Short strings never equal a long one and
+** are compared by their representation with the rest.
+*/
+bool Spasm::strict_equals(data_t lhs, data_t rhs)
+{
+    if (lhs.is_double() && rhs.is_double())
+    {
+        return lhs.get_double() == rhs.get_double();
+    }
+    const auto type = lhs.get_type();
+    if (type != rhs.get_type())
+    {
+        return false;
+    }
+    if (type == ::Spasm::ValueType::String && !lhs.is_short_string() &&
+        !rhs.is_short_string())
+    {
+        return flatten(lhs) == flatten(rhs);
+    }
+    return lhs.is_identical(rhs);
 }
 
 data_t Spasm::get_local(reg_t reg)
@@ -461,10 +2017,27 @@ data_t Spasm::pop_data()
 
 void Spasm::push_data(data_t data)
 {
-    assert(m_SP < &data_stack[data_stack.size() - 1]);
+    reserve_stack(1);
     *(m_SP++) = data;
 }
 
+/*!
+** Makes room for count more values on the data stack. The stack grows, so
+** the fibers can start with small stacks.
+*/
+void Spasm::reserve_stack(size_t count)
+{
+    const auto used = size_t(m_SP - &data_stack[0]);
+    if (used + count < data_stack.size())
+    {
+        return;
+    }
+    const auto frame = m_FP - &data_stack[0];
+    data_stack.resize(std::max(data_stack.size() * 2, used + count + 1));
+    m_SP = &data_stack[0] + used;
+    m_FP = &data_stack[0] + frame;
+}
+
 reg_t Spasm::read_reg(size_t size)
 {
     return read_integer(size);
@@ -480,22 +2053,22 @@ int64_t Spasm::read_integer(size_t size)
     switch (size)
     {
         case 0:
-            return m_ByteCode[m_PC++];
+            return int8_t(m_ByteCode[m_PC++]);
         case 1:
         {
-            auto result = *reinterpret_cast<int16_t*>(&m_ByteCode[0] + m_PC);
+            auto result = *reinterpret_cast<const int16_t*>(m_ByteCode + m_PC);
             m_PC += 2;
             return result;
         }
         case 2:
         {
-            auto result = *reinterpret_cast<int32_t*>(&m_ByteCode[0] + m_PC);
+            auto result = *reinterpret_cast<const int32_t*>(m_ByteCode + m_PC);
             m_PC += 4;
             return result;
         }
         case 3:
         {
-            auto result = *reinterpret_cast<int64_t*>(&m_ByteCode[0] + m_PC);
+            auto result = *reinterpret_cast<const int64_t*>(m_ByteCode + m_PC);
             m_PC += 8;
             return result;
         }
@@ -509,8 +2082,7 @@ data_t Spasm::read_string(size_t size)
     const auto length = size_t(read_integer(size));
     const auto s = reinterpret_cast<const char*>(&m_ByteCode[m_PC]);
     m_PC += length;
-    const auto value = m_Strings.Get(s, length);
-    return data_t(::Spasm::ValueType::String, (void*)value);
+    return make_string(s, length);
 }
 
 }  // namespace SpasmImpl
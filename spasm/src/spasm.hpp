@@ -1,14 +1,20 @@
 #ifndef SPASM_HPP
 #define SPASM_HPP
 
+#include "channel.hpp"
 #include "spasm_impl.hpp"
+#include "tasks.hpp"
 
 namespace Spasm
 {
 using SpasmImpl::byte;
+using SpasmImpl::Channel;
+using SpasmImpl::NativeFunction;
+using SpasmImpl::NativeRegistry;
 using SpasmImpl::OpCodes;
 using SpasmImpl::PC_t;
 using SpasmImpl::Spasm;
+using SpasmImpl::TaskPool;
 }  // namespace Spasm
 
 #endif  // #ifndef SPASM_HPP
@@ -4,9 +4,23 @@
 #include <iostream>
 #include <cstdint>
 
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include "object.hpp"
 #include "types.hpp"
 
+//! Inlines the helpers the interpreter loop runs for each instruction. The
+//! loop is past the size up to which the compiler inlines calls on its own.
+#if defined(_MSC_VER)
+#define SPASM_INLINE __forceinline
+#else
+#define SPASM_INLINE inline __attribute__((always_inline))
+#endif
+
 namespace SpasmImpl
 {
 enum OpCodes : char
@@ -37,7 +51,40 @@ enum OpCodes : char
     GreaterEq,
     Equal,
     NotEqual,
-    LastIndex = NotEqual,
+    CallNative,
+    Spawn,
+    Yield,
+    Resume,
+    Fork,
+    Join,
+    LoadChannel,
+    Send,
+    Receive,
+    VNew,
+    VGet,
+    VSet,
+    VAdd,
+    VMul,
+    VScale,
+    VSum,
+    VDot,
+    Throw,
+    Catch,
+    GetG,
+    SetG,
+    TailCall,
+    MapNew,
+    MapGet,
+    MapSet,
+    MapHas,
+    MapDelete,
+    BOpen,
+    BNew,
+    BSize,
+    BSlice,
+    BGet,
+    BSet,
+    LastIndex = BSet,
 };
 static_assert(LastIndex < 0x3f, "Too many opcodes");
 
@@ -46,14 +93,80 @@ class StringTable
    public:
     const SPStringValue* Get(const char* s, size_t length)
     {
-        SPString v(s, length);
-        auto pos = m_Strings.insert(SPStringValue(v));
+        return Get(SPString(s, length));
+    }
+
+    const SPStringValue* Get(SPString s)
+    {
+        auto pos = m_Strings.insert(SPStringValue(std::move(s)));
         return &(*pos.first);
     }
 
+    const SPStringValue* Concat(const SPStringValue* left,
+                                const SPStringValue* right);
+    const SPStringValue* Flatten(const SPStringValue* s);
+
    private:
+    //! Concatenations shorter than that are copied instead of making a rope
+    static const size_t MinRopeLength = 64;
+
     typedef std::unordered_set<SPStringValue> StringMap;
     StringMap m_Strings;
+
+    typedef std::deque<SPStringValue> RopeHeap;
+    //! Storage for the rope nodes, never moves them
+    RopeHeap m_Ropes;
+};
+
+class TaskPool;
+struct Task;
+class Channel;
+struct NumberArray;
+struct ValueMap;
+struct ByteBuffer;
+struct VectorKernels;
+
+//! Host function called by the CallNative opcode
+/*!
+** args points to the arguments in the frame of the caller, so they are
+** neither copied nor converted. count is the arity of the function.
+*/
+typedef data_t (*NativeFunction)(data_t* args, size_t count);
+
+//! The host functions available to the programs
+/*!
+** The embedder registers the functions before running the machine. The
+** programs call them by the index returned from Register.
+*/
+class NativeRegistry
+{
+   public:
+    struct Native
+    {
+        std::string Name;
+        NativeFunction Function;
+        size_t Arity;
+    };
+
+    size_t Register(std::string name, NativeFunction function, size_t arity)
+    {
+        m_Natives.push_back(Native{std::move(name), function, arity});
+        return m_Natives.size() - 1;
+    }
+
+    static const size_t NotFound = size_t(-1);
+    size_t Find(const std::string& name) const;
+
+    const Native& Get(size_t index) const
+    {
+        assert(index < m_Natives.size() && "Unknown native function");
+        return m_Natives[index];
+    }
+
+    size_t Size() const { return m_Natives.size(); }
+
+   private:
+    std::vector<Native> m_Natives;
 };
 
 //! The Abstract Stack Machine
@@ -71,6 +184,96 @@ class Spasm
                     std::istream& = std::cin,
                     std::ostream& = std::cout);
     ~Spasm();
+
+    //! Sets the host functions for CallNative, the registry must outlive run
+    void SetNatives(const NativeRegistry& natives) { m_Natives = &natives; }
+
+    //! Sets the pool that runs the tasks of Fork, it must outlive run
+    void SetTaskPool(TaskPool& tasks) { m_Tasks = &tasks; }
+
+    //! Attaches a channel, the programs load it by the returned index
+    size_t AddChannel(Channel& channel)
+    {
+        m_Channels.push_back(&channel);
+        return m_Channels.size() - 1;
+    }
+
+    //! The code in [Begin, End) throws to Handler
+    struct ExceptionHandler
+    {
+        PC_t Begin;
+        PC_t End;
+        PC_t Handler;
+    };
+    typedef std::vector<ExceptionHandler> ExceptionHandlers;
+
+    //! Sets the handler table of the program
+    /*!
+    ** The table is consulted only by Throw, so the code in a try range runs
+    ** exactly as without it. Nested ranges are allowed, the narrowest wins.
+    ** The table is shared with the tasks and kept by LoadSnapshot.
+    */
+    void SetExceptionHandlers(ExceptionHandlers handlers)
+    {
+        m_Handlers =
+            std::make_shared<const ExceptionHandlers>(std::move(handlers));
+    }
+
+    //! The code of the program after a call is bound
+    struct CallBinding
+    {
+        //! The address of the called function
+        PC_t Address;
+        //! The code with the module, the machine shares its ownership
+        std::shared_ptr<const byte> Code;
+        PC_t CodeSize;
+    };
+    //! Binds a call to an address past the end of the code
+    /*!
+    ** Gets the address of the call and the position of the address in the
+    ** code. Returns an Address past the end of the code if it fails.
+    */
+    typedef std::function<CallBinding(PC_t address, PC_t position)>
+        CallBinder;
+
+    //! Sets the binder of the calls past the end of the code
+    /*!
+    ** A lazily linked program calls the modules that are not loaded yet
+    ** past the end of its code, see ASM::Linker. The binder loads the module,
+    ** patches the call and gives the address of the function and the code
+    ** with the module, see ASM::Linker::image. The code must not change
+    ** after it is given, the machine runs it in place from then on and
+    ** frees it with the next bind. The handler table is not changed, the
+    ** binder sets it if the module has handlers. The tasks share the code
+    ** of their machine, so a machine with a task pool does not bind.
+    */
+    void SetCallBinder(CallBinder binder) { m_Binder = std::move(binder); }
+
+    //! Sets the global slots of the program by their names
+    /*!
+    ** The programs reach the globals by slot with GetG and SetG, the names
+    ** are kept only for the embedder and for debugging. All globals are
+    ** undefined after Initialize. A task starts with its own empty globals.
+    */
+    void SetGlobals(std::vector<std::string> names);
+
+    static const size_t NoGlobal = size_t(-1);
+    //! Returns the slot of the global name or NoGlobal
+    size_t FindGlobal(const std::string& name) const;
+    const std::string& GlobalName(size_t slot) const;
+    size_t GlobalCount() const { return m_Globals.size(); }
+
+    data_t GetGlobal(size_t slot) const
+    {
+        assert(slot < m_Globals.size() && "Unknown global");
+        return m_Globals[slot];
+    }
+    void SetGlobal(size_t slot, data_t value)
+    {
+        assert(slot < m_Globals.size() && "Unknown global");
+        m_Globals[slot] = value;
+    }
+
     Spasm(const Spasm&) = delete;
     Spasm& operator=(const Spasm&) = delete;
 
@@ -79,21 +282,126 @@ class Spasm
         Success,
         Exception,
         NotImplemented,
+        //! The budget of run ran out, the next run continues from there
+        Suspended,
     };
     RunResult run();
 
+    //! Runs until the program ends or budget backward jumps and calls
+    /*!
+    ** Only the instructions that can repeat are counted, so a straight
+    ** line of code always finishes. A suspended machine keeps all of its
+    ** state and any run continues right after the last counted instruction.
+    */
+    RunResult run(uint64_t budget);
+
+    //! Runs as run does and counts the executed instructions
+    /*!
+    ** For the benchmarks, the other runs do not count.
+    */
+    RunResult RunCounted(uint64_t budget = UINT64_MAX);
+
+    //! Number of instructions executed by the counted runs of the machine
+    uint64_t InstructionCount() const { return m_Executed; }
+
+    //! A program shared by all the machines that run it, see Attach
+    struct ProgramImage
+    {
+        //! Copies the bytecode, once for all the machines
+        ProgramImage(const byte* code, PC_t size);
+        //! Uses the bytecode in place, e.g. a mapped file
+        ProgramImage(std::shared_ptr<const byte> code, PC_t size);
+
+        std::shared_ptr<const byte> Code;
+        PC_t CodeSize;
+        ExceptionHandlers Handlers;
+        //! The names of the global slots
+        std::vector<std::string> Globals;
+        //! The addresses of the functions that Call finds by name
+        std::unordered_map<std::string, PC_t> Exports;
+    };
+
+    //! Sets the program of the machine without copying it
+    /*!
+    ** A machine made once and attached to a shared image serves any number
+    ** of Calls, the image lives as long as a machine uses it. The handlers
+    ** and the globals of the image replace those of the machine.
+    */
+    void Attach(std::shared_ptr<const ProgramImage> image,
+                std::istream& = std::cin,
+                std::ostream& = std::cout);
+
+    static const PC_t NoExport = PC_t(-1);
+    //! Returns the address of the exported function name or NoExport
+    PC_t FindExport(const std::string& name) const;
+
+    //! Calls the function at address with the arguments and waits for it
+    /*!
+    ** The machine is Reset first, so the calls only share the globals. The
+    ** function gets the arguments as if called with Call and its ret gives
+    ** result. A Halt in the function also ends the call, without result.
+    */
+    RunResult Call(PC_t address,
+                   const data_t* args,
+                   size_t count,
+                   data_t& result);
+    //! Calls the exported function name, see FindExport
+    RunResult Call(const std::string& name,
+                   const std::vector<data_t>& args,
+                   data_t& result);
+
+    //! Rewinds the machine to the start of the program
+    /*!
+    ** The stacks, the frames and the globals keep their memory. When the
+    ** last run made no heap objects nothing is freed or allocated at all.
+    ** The globals keep their values, except those of the heap objects,
+    ** which are freed.
+    */
+    void Reset();
+
+    //! Writes the state of the machine to a relocatable image
+    /*!
+    ** The machine is usually paused by a halt after its initialization.
+    ** All tasks must be joined and the channels are saved by their index.
+    ** A machine with byte buffers can not be saved.
+    */
+    bool SaveSnapshot(const std::string& path);
+
+    //! Restores a machine saved by SaveSnapshot
+    /*!
+    ** The image is mapped and the bytecode is used in place. The channels
+    ** must be attached in the same order as in the saved machine.
+    */
+    bool LoadSnapshot(const std::string& path,
+                      std::istream& = std::cin,
+                      std::ostream& = std::cout);
+
    private:
+    friend class TaskPool;
+
     //! Program counter - points the current opcode
     PC_t m_PC = 0;
 
+    uint64_t m_Executed = 0;
+
     typedef SPVector<byte> ByteCode;
-    //! bytecode of the program
-    ByteCode m_ByteCode;
+    //! bytecode of the program, shared with the machines running its tasks
+    /*!
+    ** It keeps alive whatever holds the bytecode - a copy of the program
+    ** or a mapped snapshot.
+    */
+    std::shared_ptr<const byte> m_Program;
+    const byte* m_ByteCode = nullptr;
+    PC_t m_CodeSize = 0;
 
     typedef SPVector<data_t> DataStack;
     //! stack for storing arguments and local variables
     DataStack data_stack;
 
+    //! the global slots, shared by all fibers
+    DataStack m_Globals;
+    std::vector<std::string> m_GlobalNames;
+
     //! Stack pointer - always the top of the stack
     data_t* m_SP = nullptr;
 
@@ -107,57 +415,202 @@ class Spasm
         PC_t StackPointer;
     };
 
-    typedef std::stack<Frame> FrameStack;
+    typedef std::stack<Frame, std::vector<Frame>> FrameStack;
     //! Stack for function frames
     FrameStack m_Frames;
 
+    //! A cooperative thread of execution with its own stacks
+    /*!
+    ** The registers and the stacks of the running fiber live in the
+    ** machine, they are swapped in and out of the fiber on a switch.
+    */
+    struct Fiber : HeapObject
+    {
+        enum Status
+        {
+            Ready,
+            Running,
+            //! Yielded to its resumer and waits for another resume
+            Suspended,
+            //! Waits for the fiber it resumed to yield or finish
+            Blocked,
+            Done,
+        };
+
+        Fiber() : HeapObject(Kind::Fiber) {}
+
+        PC_t PC = 0;
+        DataStack Stack;
+        PC_t StackPointer = 0;
+        PC_t FramePointer = 0;
+        FrameStack Frames;
+
+        Status State = Ready;
+        //! Whether the fiber is in the run queue, the entry may be stale
+        bool Queued = false;
+        //! The fiber that resumed this one, it gets the next value
+        Fiber* Resumer = nullptr;
+        //! The register that gets the value of the fiber this one resumed
+        reg_t ResumeRegister = 0;
+        data_t Result;
+    };
+
+    //! Initial size of the data stack of a spawned fiber, it grows on demand
+    static const size_t FiberStackSize = 16;
+
+    Fiber* m_Root = nullptr;
+    Fiber* m_Current = nullptr;
+
+    typedef std::deque<Fiber*> RunQueue;
+    //! Fibers ready to run, in order
+    RunQueue m_RunQueue;
+
+    typedef std::vector<std::unique_ptr<HeapObject>> Heap;
+    Heap m_Heap;
+
     StringTable m_Strings;
 
+    const NativeRegistry* m_Natives = nullptr;
+
+    TaskPool* m_Tasks = nullptr;
+
+    std::vector<Channel*> m_Channels;
+
+    std::shared_ptr<const ExceptionHandlers> m_Handlers;
+
+    CallBinder m_Binder;
+
+    std::shared_ptr<const ProgramImage> m_ProgramImage;
+
+    //! The value of the last Throw, Catch takes it
+    data_t m_Exception;
+
+    //! The vector kernels for the CPU
+    const VectorKernels& m_Vectors;
+
     //! Input stream for read () operation
     std::istream* istr;
 
     //! Output stream for print () opertion
     std::ostream* ostr;
 
-    void push(reg_t reg);
-    void popto(reg_t reg);
+    SPASM_INLINE void push(reg_t reg);
+    SPASM_INLINE void popto(reg_t reg);
     void dup();
 
     void print(reg_t reg);
     void read(reg_t reg);
 
-    void plus(reg_t a0, reg_t a1, reg_t a2);
-    void minus(reg_t a0, reg_t a1, reg_t a2);
-    void multiply(reg_t a0, reg_t a1, reg_t a2);
-    void divide(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void plus(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void minus(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void multiply(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void divide(reg_t a0, reg_t a1, reg_t a2);
     void modulus(reg_t a0, reg_t a1, reg_t a2);
 
-    void gotrue(reg_t a0, reg_t a1);
-    void gofalse(reg_t a0, reg_t a1);
-    void go(reg_t a0);
+    SPASM_INLINE void gotrue(reg_t a0, reg_t a1);
+    SPASM_INLINE void gofalse(reg_t a0, reg_t a1);
+    SPASM_INLINE void go(reg_t a0);
 
     void call(reg_t a0);
+    SPASM_INLINE void tail_call(reg_t a0);
+    bool bind_call(reg_t& a0, size_t size);
     void ret(reg_t a0);
+    void call_native(reg_t a0, reg_t a1, reg_t a2);
+
+    void get_global(reg_t a0, reg_t a1);
+    void set_global(reg_t a0, reg_t a1);
+
+    bool unwind(PC_t at);
+    bool raise(PC_t at);
+    bool to_index(data_t value, size_t limit, size_t& index) const;
+    bool set_error(const char* message);
+    const ExceptionHandler* find_handler(PC_t at) const;
+
+    void spawn(reg_t a0, reg_t a1, reg_t a2);
+    void yield(reg_t a0);
+    void resume(reg_t a0, reg_t a1);
+    void finish(data_t result);
+    void schedule(Fiber* fiber);
+    void run_next();
+    void switch_to(Fiber* fiber);
+    Fiber* to_fiber(data_t value);
+
+    void fork(reg_t a0, reg_t a1, reg_t a2);
+    void join(reg_t a0, reg_t a1);
+    void join_tasks();
+    data_t run_task(const Task& task);
+    data_t export_value(data_t value);
+    data_t import_value(data_t value);
+    Task* to_task(data_t value);
+
+    void load_channel(reg_t a0, reg_t a1);
+    void send(reg_t a0, reg_t a1);
+    void receive(reg_t a0, reg_t a1);
+    Channel* to_channel(data_t value);
+
+    bool vector_new(reg_t a0, reg_t a1);
+    bool vector_get(reg_t a0, reg_t a1, reg_t a2);
+    bool vector_set(reg_t a0, reg_t a1, reg_t a2);
+    bool vector_add(reg_t a0, reg_t a1, reg_t a2);
+    bool vector_mul(reg_t a0, reg_t a1, reg_t a2);
+    bool vector_scale(reg_t a0, reg_t a1, reg_t a2);
+    void vector_sum(reg_t a0, reg_t a1);
+    bool vector_dot(reg_t a0, reg_t a1, reg_t a2);
+    NumberArray* to_array(data_t value);
+
+    void map_new(reg_t a0);
+    void map_get(reg_t a0, reg_t a1, reg_t a2);
+    void map_set(reg_t a0, reg_t a1, reg_t a2);
+    void map_has(reg_t a0, reg_t a1, reg_t a2);
+    void map_delete(reg_t a0, reg_t a1, reg_t a2);
+    ValueMap* to_map(data_t value);
+    data_t map_key(data_t value);
+
+    void buffer_open(reg_t a0, reg_t a1);
+    bool buffer_new(reg_t a0, reg_t a1);
+    void buffer_size(reg_t a0, reg_t a1);
+    bool buffer_slice(reg_t a0, reg_t a1, reg_t a2, reg_t a3);
+    bool buffer_get(reg_t a0, reg_t a1, reg_t a2, reg_t a3);
+    bool buffer_set(reg_t a0, reg_t a1, reg_t a2, reg_t a3);
+    ByteBuffer* to_buffer(data_t value);
+
+    //! The loop of run, Counted counts the instructions
+    template <bool Counted>
+    RunResult execute(uint64_t budget);
+
+    void reset();
+    void set_program(std::shared_ptr<const byte> program, PC_t size);
+
+    class SnapshotWriter;
+    class SnapshotReader;
 
     void load();
     void store();
 
-    void less(reg_t a0, reg_t a1, reg_t a2);
-    void lesseq(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void less(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void lesseq(reg_t a0, reg_t a1, reg_t a2);
+
+    SPASM_INLINE void greater(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void greatereq(reg_t a0, reg_t a1, reg_t a2);
 
-    void greater(reg_t a0, reg_t a1, reg_t a2);
-    void greatereq(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void equal(reg_t a0, reg_t a1, reg_t a2);
+    SPASM_INLINE void not_equal(reg_t a0, reg_t a1, reg_t a2);
 
-    void equal(reg_t a0, reg_t a1, reg_t a2);
-    void not_equal(reg_t a0, reg_t a1, reg_t a2);
+    data_t to_string(data_t value);
+    data_t make_string(const char* s, size_t length);
+    data_t concat(data_t lhs, data_t rhs);
+    const SPStringValue* heap_string(data_t value);
+    const SPStringValue* flatten(data_t value);
+    SPASM_INLINE bool strict_equals(data_t lhs, data_t rhs);
 
-    data_t get_local(reg_t reg);
-    void set_local(reg_t reg, data_t data);
+    SPASM_INLINE data_t get_local(reg_t reg);
+    SPASM_INLINE void set_local(reg_t reg, data_t data);
     data_t pop_data();
-    void push_data(data_t);
-    reg_t read_reg(size_t size);
-    data_t read_number(size_t size);
-    int64_t read_integer(size_t size);
+    SPASM_INLINE void push_data(data_t);
+    SPASM_INLINE void reserve_stack(size_t count);
+    SPASM_INLINE reg_t read_reg(size_t size);
+    SPASM_INLINE data_t read_number(size_t size);
+    SPASM_INLINE int64_t read_integer(size_t size);
     data_t read_string(size_t size);
 };
 
@@ -1,22 +1,79 @@
 #pragma once
 
+#include <cassert>
 #include <string>
+#include <vector>
 
 namespace SpasmImpl
 {
 typedef std::string SPString;
 
+//! An immutable string - either a flat (interned) string or a rope.
+/*!
+** Ropes are concatenation nodes that keep the left and right parts and the
+** total length. They are flattened lazily into an interned string the first
+** time their content is needed.
+*/
 class SPStringValue
 {
    public:
-    explicit SPStringValue(SPString s) : m_Value(std::move(s)) {}
+    explicit SPStringValue(SPString s)
+        : m_Value(std::move(s)), m_Length(m_Value.size())
+    {
+    }
+
+    SPStringValue(const SPStringValue* left, const SPStringValue* right)
+        : m_Left(left),
+          m_Right(right),
+          m_Length(left->GetLength() + right->GetLength())
+    {
+    }
 
     SPStringValue(const SPStringValue&) = delete;
     SPStringValue(SPStringValue&&) = default;
     SPStringValue& operator=(const SPStringValue&) = delete;
     SPStringValue& operator=(SPStringValue&&) = default;
 
-    const SPString& GetValue() const { return m_Value; }
+    const SPString& GetValue() const
+    {
+        assert(!IsRope() && "Flatten the rope first");
+        return m_Value;
+    }
+
+    size_t GetLength() const { return m_Length; }
+
+    bool IsRope() const { return m_Left != nullptr; }
+    const SPStringValue* GetLeft() const { return m_Left; }
+    const SPStringValue* GetRight() const { return m_Right; }
+
+    //! The interned flat string of a rope, if it was already flattened
+    const SPStringValue* GetFlat() const { return m_Flat; }
+    void SetFlat(const SPStringValue* flat) const { m_Flat = flat; }
+
+    //! Calls f for each flat piece of the string from left to right
+    template <typename Function>
+    void ForEachPiece(Function f) const
+    {
+        std::vector<const SPStringValue*> pending(1, this);
+        while (!pending.empty())
+        {
+            auto current = pending.back();
+            pending.pop_back();
+            if (current->m_Flat)
+            {
+                current = current->m_Flat;
+            }
+            if (current->IsRope())
+            {
+                pending.push_back(current->m_Right);
+                pending.push_back(current->m_Left);
+            }
+            else
+            {
+                f(current->m_Value);
+            }
+        }
+    }
 
     bool operator==(const SPStringValue& rhs) const
     {
@@ -27,6 +84,10 @@ class SPStringValue
 
    private:
     SPString m_Value;
+    const SPStringValue* m_Left = nullptr;
+    const SPStringValue* m_Right = nullptr;
+    mutable const SPStringValue* m_Flat = nullptr;
+    size_t m_Length;
 };
 }  // namespace SpasmImpl
 
@@ -40,4 +101,4 @@ struct hash<SpasmImpl::SPStringValue>
         return std::hash<SpasmImpl::SPString>{}(v.GetValue());
     }
 };
-}  // namespace std
\ No newline at end of file
+}  // namespace std
@@ -0,0 +1,172 @@
+#ifndef TAGGED_VALUE_HPP
+#define TAGGED_VALUE_HPP
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "value_type.hpp"
+
+namespace Spasm
+{
+//! A 64 bit word with the type in its low 3 bits and boxed doubles
+/*!
+** Numbers have tag 0. Integers up to 59 bits keep their value in the bits
+** above bit 3, the other doubles are boxed and bit 3 is set. The boxes are
+** 16 byte aligned, so the word without its low 4 bits is the address.
+** The other types keep their payload in the bits above the tag.
+*/
+struct TaggedValue
+{
+    TaggedValue() : m_Bits(0) {}
+
+    explicit TaggedValue(double v)
+    {
+        if (v > -MaxInteger && v < MaxInteger && v == double(int64_t(v)) &&
+            !(v == 0 && std::signbit(v)))
+        {
+            m_Bits = uint64_t(int64_t(v)) << 4;
+        }
+        else
+        {
+            m_Bits = uint64_t(box(v)) | BoxedBit;
+        }
+    }
+
+    explicit TaggedValue(bool v) : TaggedValue(ValueType::Boolean, uint64_t(v))
+    {
+    }
+
+    TaggedValue(ValueType tag, uint64_t payload)
+    {
+        assert(tag != ValueType::Number && "Numbers are made from doubles");
+        assert(!(payload >> 48) && "Use only pointers to the heap.");
+        m_Bits = (payload << 3) | uint64_t(tag);
+    }
+
+    TaggedValue(ValueType tag, void* pointer)
+        : TaggedValue(tag, (uint64_t)pointer)
+    {
+    }
+
+    //! Strings up to that length are stored inside the value
+    static const size_t ShortStringCapacity = 7;
+
+    //! Makes a string with the characters in the upper 7 bytes
+    /*!
+    ** Bit 3 marks the string as short, as with the boxed numbers, and the
+    ** length takes the rest of the low byte.
+    */
+    static TaggedValue short_string(const char* s, size_t length)
+    {
+        assert(length <= ShortStringCapacity);
+        TaggedValue value;
+        value.m_Bits = uint64_t(ValueType::String) | BoxedBit | (length << 4);
+        for (size_t i = 0; i < length; ++i)
+        {
+            value.m_Bits |= uint64_t(uint8_t(s[i])) << ((i + 1) * 8);
+        }
+        return value;
+    }
+
+    bool is_short_string() const
+    {
+        return (m_Bits & 0xf) == (uint64_t(ValueType::String) | BoxedBit);
+    }
+
+    size_t short_string_length() const
+    {
+        assert(is_short_string());
+        return (m_Bits >> 4) & 0xf;
+    }
+
+    const char* short_string_data() const
+    {
+        assert(is_short_string());
+        return reinterpret_cast<const char*>(&m_Bits) + 1;
+    }
+
+    bool is_double() const { return !(m_Bits & TagMask); }
+
+    double get_double() const
+    {
+        assert(is_double());
+        if (m_Bits & BoxedBit)
+        {
+            return reinterpret_cast<const Box*>(m_Bits & ~uint64_t(0xf))
+                ->Number;
+        }
+        return double(int64_t(m_Bits) >> 4);
+    }
+
+    ValueType get_type() const { return ValueType(m_Bits & TagMask); }
+
+    void* get_pointer() const { return (void*)(m_Bits >> 3); }
+
+    bool get_boolean() const
+    {
+        assert(get_type() == ValueType::Boolean);
+        return (m_Bits >> 3) != 0;
+    }
+
+    //! Numbers with non zero bits, the value of booleans and everything else
+    explicit operator bool() const
+    {
+        switch (get_type())
+        {
+            case ValueType::Number:
+            {
+                const auto v = get_double();
+                uint64_t bits;
+                std::memcpy(&bits, &v, sizeof(v));
+                return bits != 0;
+            }
+            case ValueType::Boolean:
+                return get_boolean();
+            default:
+                return true;
+        }
+    }
+
+    //! Whether the two values have the same bits, boxes are not compared
+    bool is_identical(const TaggedValue& other) const
+    {
+        return m_Bits == other.m_Bits;
+    }
+
+   private:
+    static const uint64_t TagMask = 0x7;
+    static const uint64_t BoxedBit = 0x8;
+    static constexpr double MaxInteger = double(int64_t(1) << 59);
+
+    struct alignas(16) Box
+    {
+        double Number;
+    };
+
+    //! Allocates a box for a double
+    /*!
+    ** The machine has no collector yet, so the boxes are never freed. Each
+    ** thread takes them from its own chunks.
+    */
+    static Box* box(double v)
+    {
+        static const size_t ChunkSize = 4096;
+        static thread_local Box* next = nullptr;
+        static thread_local Box* end = nullptr;
+        if (next == end)
+        {
+            next = new Box[ChunkSize];
+            end = next + ChunkSize;
+        }
+        assert(!(uint64_t(next) & 0xf));
+        next->Number = v;
+        return next++;
+    }
+
+    uint64_t m_Bits;
+};
+}  // namespace Spasm
+
+#endif  // TAGGED_VALUE_HPP
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include "spasm.hpp"
+#include "tasks.hpp"
+
+namespace SpasmImpl
+{
+WorkDeque::WorkDeque()
+{
+    for (auto& task : m_Tasks)
+    {
+        task.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+bool WorkDeque::Push(Task* task)
+{
+    const auto bottom = m_Bottom.load(std::memory_order_relaxed);
+    const auto top = m_Top.load(std::memory_order_acquire);
+    if (bottom - top >= Capacity)
+    {
+        return false;
+    }
+    m_Tasks[bottom % Capacity].store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Task* WorkDeque::Pop()
+{
+    const auto bottom = m_Bottom.load(std::memory_order_relaxed) - 1;
+    m_Bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = m_Top.load(std::memory_order_relaxed);
+    if (top > bottom)
+    {
+        m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto task = m_Tasks[bottom % Capacity].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        // the last task, race with the thieves for it
+        if (!m_Top.compare_exchange_strong(top, top + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+        {
+            task = nullptr;
+        }
+        m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+Task* WorkDeque::Steal()
+{
+    auto top = m_Top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = m_Bottom.load(std::memory_order_acquire);
+    if (top >= bottom)
+    {
+        return nullptr;
+    }
+    auto task = m_Tasks[top % Capacity].load(std::memory_order_relaxed);
+    if (!m_Top.compare_exchange_strong(top, top + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return task;
+}
+
+struct TaskPool::Worker
+{
+    explicit Worker(size_t index) : Random(uint32_t(index) + 1) {}
+
+    WorkDeque Tasks;
+    //! The machines of the nested tasks, a waiting task keeps its machine
+    std::vector<std::unique_ptr<Spasm>> Machines;
+    size_t Depth = 0;
+    //! State of the xorshift generator for choosing the victims
+    uint32_t Random;
+};
+
+//! The worker of the current thread, pools are told apart by their id
+/*!
+** A new pool may get the address of a destroyed one, so the address can
+** not tell whether the worker is still alive.
+*/
+static thread_local struct
+{
+    uint64_t PoolId;
+    void* Worker;
+} t_Worker = {0, nullptr};
+
+static std::atomic<uint64_t> s_NextPoolId{1};
+
+TaskPool::TaskPool(size_t workers) : m_Id(s_NextPoolId.fetch_add(1))
+{
+    workers = std::max<size_t>(workers, 1);
+    for (size_t i = 0; i < workers; ++i)
+    {
+        m_Workers.emplace_back(new Worker(i));
+    }
+    for (size_t i = 1; i < workers; ++i)
+    {
+        auto worker = m_Workers[i].get();
+        m_Threads.emplace_back([this, worker] { WorkerLoop(*worker); });
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop.store(true);
+    }
+    m_WakeUp.notify_all();
+    for (auto& thread : m_Threads)
+    {
+        thread.join();
+    }
+}
+
+TaskPool::Worker& TaskPool::CurrentWorker()
+{
+    if (t_Worker.PoolId != m_Id)
+    {
+        t_Worker.PoolId = m_Id;
+        t_Worker.Worker = m_Workers[0].get();
+    }
+    return *static_cast<Worker*>(t_Worker.Worker);
+}
+
+void TaskPool::Fork(Task* task)
+{
+    auto& worker = CurrentWorker();
+    if (!worker.Tasks.Push(task))
+    {
+        // the deque is full, there is enough parallelism already
+        Execute(worker, task);
+        return;
+    }
+    if (m_Sleeping.load(std::memory_order_relaxed) > 0)
+    {
+        m_WakeUp.notify_one();
+    }
+}
+
+void TaskPool::Join(Task* task)
+{
+    auto& worker = CurrentWorker();
+    while (!task->Done.load(std::memory_order_acquire))
+    {
+        if (!RunOne(worker))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/*!
+** Runs a task from the own deque or steals one from a random victim.
+*/
+bool TaskPool::RunOne(Worker& worker)
+{
+    auto task = worker.Tasks.Pop();
+    const auto count = m_Workers.size();
+    if (!task && count > 1)
+    {
+        worker.Random ^= worker.Random << 13;
+        worker.Random ^= worker.Random >> 17;
+        worker.Random ^= worker.Random << 5;
+        const auto first = worker.Random % count;
+        for (size_t i = 0; i < count && !task; ++i)
+        {
+            auto& victim = *m_Workers[(first + i) % count];
+            if (&victim != &worker)
+            {
+                task = victim.Tasks.Steal();
+            }
+        }
+    }
+    if (!task)
+    {
+        return false;
+    }
+    Execute(worker, task);
+    return true;
+}
+
+void TaskPool::Execute(Worker& worker, Task* task)
+{
+    if (worker.Depth == worker.Machines.size())
+    {
+        worker.Machines.emplace_back(new Spasm);
+    }
+    auto& machine = *worker.Machines[worker.Depth++];
+    task->Result = machine.run_task(*task);
+    --worker.Depth;
+    task->Done.store(true, std::memory_order_release);
+}
+
+bool TaskPool::HasWork() const
+{
+    for (const auto& worker : m_Workers)
+    {
+        if (!worker->Tasks.Empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::WorkerLoop(Worker& worker)
+{
+    t_Worker.PoolId = m_Id;
+    t_Worker.Worker = &worker;
+    // number of failed attempts to find a task before going to sleep
+    const int SpinCount = 64;
+    int idle = 0;
+    while (!m_Stop.load(std::memory_order_relaxed))
+    {
+        if (RunOne(worker))
+        {
+            idle = 0;
+            continue;
+        }
+        if (++idle < SpinCount)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Sleeping.fetch_add(1);
+        // the timeout covers a fork that missed the sleeping count
+        m_WakeUp.wait_for(lock, std::chrono::milliseconds(1), [this] {
+            return m_Stop.load() || HasWork();
+        });
+        m_Sleeping.fetch_sub(1);
+        idle = 0;
+    }
+}
+}  // namespace SpasmImpl
@@ -0,0 +1,107 @@
+#ifndef TASKS_HPP
+#define TASKS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "object.hpp"
+#include "types.hpp"
+
+namespace SpasmImpl
+{
+//! A call forked by the Fork opcode that may run on another thread
+/*!
+** The argument and the result are passed by value. Long strings are
+** flattened by the sender and copied by the receiver, so the machines
+** never share their heaps.
+*/
+struct Task : HeapObject
+{
+    Task() : HeapObject(Kind::Task) {}
+
+    //! The machine that forked the task, it gives the program and natives
+    const Spasm* Owner = nullptr;
+    PC_t Entry = 0;
+    data_t Argument;
+    data_t Result;
+    std::atomic<bool> Done{false};
+};
+
+//! Work-stealing deque of Chase and Lev with a fixed capacity
+/*!
+** The owner pushes and pops at the bottom, the other workers steal from
+** the top. Only the steals and the pop of the last task synchronize.
+*/
+class WorkDeque
+{
+   public:
+    WorkDeque();
+
+    //! Returns false if the deque is full
+    bool Push(Task* task);
+    Task* Pop();
+    Task* Steal();
+
+    bool Empty() const
+    {
+        return m_Bottom.load(std::memory_order_relaxed) <=
+               m_Top.load(std::memory_order_relaxed);
+    }
+
+   private:
+    static const int64_t Capacity = 1 << 12;
+
+    alignas(64) std::atomic<int64_t> m_Top{0};
+    alignas(64) std::atomic<int64_t> m_Bottom{0};
+    alignas(64) std::atomic<Task*> m_Tasks[Capacity];
+};
+
+//! Runs the tasks forked by the machines on all cores
+/*!
+** Every worker has a work-stealing deque and its own machines that share
+** the program image of the machine that forked the task. A worker waiting
+** in Join runs other tasks meanwhile, so nested fork/join never blocks a
+** thread. The thread that runs the root machine is the worker 0, only one
+** such thread may use the pool at a time.
+*/
+class TaskPool
+{
+   public:
+    //! workers counts the thread that runs the root machine too
+    explicit TaskPool(size_t workers = std::thread::hardware_concurrency());
+    ~TaskPool();
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    size_t Workers() const { return m_Workers.size(); }
+
+    //! Queues the task on the current worker
+    void Fork(Task* task);
+    //! Runs tasks until task is done
+    void Join(Task* task);
+
+   private:
+    struct Worker;
+
+    Worker& CurrentWorker();
+    bool RunOne(Worker& worker);
+    void Execute(Worker& worker, Task* task);
+    void WorkerLoop(Worker& worker);
+    bool HasWork() const;
+
+    const uint64_t m_Id;
+    std::vector<std::unique_ptr<Worker>> m_Workers;
+    std::vector<std::thread> m_Threads;
+
+    std::atomic<bool> m_Stop{false};
+    std::atomic<int> m_Sleeping{0};
+    std::mutex m_Mutex;
+    std::condition_variable m_WakeUp;
+};
+}  // namespace SpasmImpl
+
+#endif  // TASKS_HPP
@@ -0,0 +1,124 @@
+#ifndef UNION_VALUE_HPP
+#define UNION_VALUE_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "value_type.hpp"
+
+namespace Spasm
+{
+//! A 16 byte value with its type next to a union of the payloads
+/*!
+** Nothing is encoded, so every access is a plain load, but the values take
+** twice the memory of the other representations.
+*/
+struct UnionValue
+{
+    UnionValue() : m_Type(ValueType::Number) { m_Data.Number = 0.0; }
+
+    explicit UnionValue(double v) : m_Type(ValueType::Number)
+    {
+        m_Data.Number = v;
+    }
+
+    explicit UnionValue(bool v) : UnionValue(ValueType::Boolean, uint64_t(v))
+    {
+    }
+
+    UnionValue(ValueType tag, uint64_t payload) : m_Type(tag)
+    {
+        assert(tag != ValueType::Number && "Numbers are made from doubles");
+        m_Data.Payload = payload;
+    }
+
+    UnionValue(ValueType tag, void* pointer)
+        : UnionValue(tag, (uint64_t)pointer)
+    {
+    }
+
+    //! Strings up to that length are stored inside the value
+    static const size_t ShortStringCapacity = 8;
+
+    static UnionValue short_string(const char* s, size_t length)
+    {
+        assert(length <= ShortStringCapacity);
+        UnionValue value(ValueType::String, uint64_t(0));
+        value.m_Short = true;
+        value.m_Length = uint8_t(length);
+        std::memcpy(value.m_Data.Chars, s, length);
+        return value;
+    }
+
+    bool is_short_string() const
+    {
+        return m_Type == ValueType::String && m_Short;
+    }
+
+    size_t short_string_length() const
+    {
+        assert(is_short_string());
+        return m_Length;
+    }
+
+    const char* short_string_data() const
+    {
+        assert(is_short_string());
+        return m_Data.Chars;
+    }
+
+    bool is_double() const { return m_Type == ValueType::Number; }
+
+    double get_double() const
+    {
+        assert(is_double());
+        return m_Data.Number;
+    }
+
+    ValueType get_type() const { return m_Type; }
+
+    void* get_pointer() const { return (void*)m_Data.Payload; }
+
+    bool get_boolean() const
+    {
+        assert(get_type() == ValueType::Boolean);
+        return m_Data.Payload != 0;
+    }
+
+    //! Numbers with non zero bits, the value of booleans and everything else
+    explicit operator bool() const
+    {
+        switch (m_Type)
+        {
+            case ValueType::Number:
+            case ValueType::Boolean:
+                return m_Data.Payload != 0;
+            default:
+                return true;
+        }
+    }
+
+    //! Whether the two values have the same type and bits
+    bool is_identical(const UnionValue& other) const
+    {
+        return m_Type == other.m_Type && m_Short == other.m_Short &&
+               m_Length == other.m_Length &&
+               m_Data.Payload == other.m_Data.Payload;
+    }
+
+   private:
+    union {
+        double Number;
+        uint64_t Payload;
+        char Chars[ShortStringCapacity];
+    } m_Data;
+    ValueType m_Type;
+    bool m_Short = false;
+    uint8_t m_Length = 0;
+};
+
+static_assert(sizeof(UnionValue) == 16, "The union should take 16 bytes");
+}  // namespace Spasm
+
+#endif  // UNION_VALUE_HPP
@@ -0,0 +1,90 @@
+#ifndef VALUE_MAP_HPP
+#define VALUE_MAP_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#include "../../gctest/src/flat_hash_map/flat_hash_map.hpp"
+#include "object.hpp"
+#include "types.hpp"
+
+namespace SpasmImpl
+{
+//! Hashes a key of a ValueMap without looking at the characters
+/*!
+** The machine gives the long strings as their interned flat string, so
+** they are hashed by pointer. Numbers are hashed by their bits, with both
+** zeros the same and all NaNs the same, as ValueMapEqual has them. The
+** table spreads the hash with a fibonacci multiply, so the bits are only
+** folded to the width of size_t - the low bits of a small integer are all
+** zero.
+*/
+struct ValueMapHash
+{
+    size_t operator()(data_t key) const
+    {
+        if (key.is_double())
+        {
+            const auto number = key.get_double();
+            if (number == 0)
+            {
+                return 0;
+            }
+            if (number != number)
+            {
+                return 1;
+            }
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof(number));
+            return Fold(bits);
+        }
+        uint64_t payload = 0;
+        uint64_t tag = uint64_t(key.get_type());
+        if (key.is_short_string())
+        {
+            std::memcpy(&payload, key.short_string_data(),
+                        key.short_string_length());
+            tag |= uint64_t(key.short_string_length()) << 8;
+        }
+        else
+        {
+            payload = uint64_t(key.get_pointer());
+        }
+        return Fold(payload) ^ Fold(tag * 0x9e3779b97f4a7c15ull);
+    }
+
+   private:
+    static size_t Fold(uint64_t bits) { return size_t(bits ^ (bits >> 32)); }
+};
+
+//! Numbers are equal by value and NaN equals itself, the rest by identity
+struct ValueMapEqual
+{
+    bool operator()(data_t lhs, data_t rhs) const
+    {
+        if (lhs.is_double() && rhs.is_double())
+        {
+            const auto a = lhs.get_double();
+            const auto b = rhs.get_double();
+            return a == b || (a != a && b != b);
+        }
+        return lhs.is_identical(rhs);
+    }
+};
+
+//! A dictionary of values, the operand of the map opcodes
+/*!
+** An open addressing table, so a lookup touches one contiguous run of
+** slots instead of following the nodes of a bucket list.
+*/
+struct ValueMap : HeapObject
+{
+    ValueMap() : HeapObject(Kind::Map) {}
+
+    typedef ska::flat_hash_map<data_t, data_t, ValueMapHash, ValueMapEqual>
+        Table;
+    Table Entries;
+};
+}  // namespace SpasmImpl
+
+#endif  // VALUE_MAP_HPP
@@ -0,0 +1,21 @@
+#ifndef VALUE_TYPE_HPP
+#define VALUE_TYPE_HPP
+
+namespace Spasm
+{
+enum class ValueType
+{
+    Number,
+    Null,
+    Undefined,
+    Boolean,
+    String,
+    Array,
+    Object,
+    Function,
+};
+
+static_assert(int(ValueType::Function) < 8, "Too many types");
+}  // namespace Spasm
+
+#endif  // VALUE_TYPE_HPP
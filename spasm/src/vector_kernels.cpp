@@ -0,0 +1,266 @@
+#include "vector_kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SPASM_VECTOR_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) || !defined(SPASM_VECTOR_X64)
+//! MSVC compiles the intrinsics of any instruction set without flags
+#define SPASM_TARGET_AVX2
+#else
+#define SPASM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace SpasmImpl
+{
+namespace
+{
+void ScalarAdd(double* out, const double* a, const double* b, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = a[i] + b[i];
+    }
+}
+
+void ScalarMul(double* out, const double* a, const double* b, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = a[i] * b[i];
+    }
+}
+
+void ScalarScale(double* out, const double* a, double factor, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = a[i] * factor;
+    }
+}
+
+double ScalarSum(const double* a, size_t count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sum += a[i];
+    }
+    return sum;
+}
+
+double ScalarDot(const double* a, const double* b, size_t count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+const VectorKernels Scalar = {
+    ScalarAdd, ScalarMul, ScalarScale, ScalarSum, ScalarDot, "scalar",
+};
+
+#if SPASM_VECTOR_X64
+// SSE2 is a part of x86-64, so these need no detection
+
+void Sse2Add(double* out, const double* a, const double* b, size_t count)
+{
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        _mm_storeu_pd(out + i,
+                      _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    ScalarAdd(out + i, a + i, b + i, count - i);
+}
+
+void Sse2Mul(double* out, const double* a, const double* b, size_t count)
+{
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        _mm_storeu_pd(out + i,
+                      _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    ScalarMul(out + i, a + i, b + i, count - i);
+}
+
+void Sse2Scale(double* out, const double* a, double factor, size_t count)
+{
+    const auto f = _mm_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), f));
+    }
+    ScalarScale(out + i, a + i, factor, count - i);
+}
+
+double Sse2Horizontal(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+//! Two accumulators hide the latency of the additions
+double Sse2Sum(const double* a, size_t count)
+{
+    auto s0 = _mm_setzero_pd();
+    auto s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+    }
+    return Sse2Horizontal(_mm_add_pd(s0, s1)) + ScalarSum(a + i, count - i);
+}
+
+double Sse2Dot(const double* a, const double* b, size_t count)
+{
+    auto s0 = _mm_setzero_pd();
+    auto s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        s0 = _mm_add_pd(
+            s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(
+            s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    return Sse2Horizontal(_mm_add_pd(s0, s1)) +
+           ScalarDot(a + i, b + i, count - i);
+}
+
+const VectorKernels Sse2 = {
+    Sse2Add, Sse2Mul, Sse2Scale, Sse2Sum, Sse2Dot, "sse2",
+};
+
+SPASM_TARGET_AVX2
+void Avx2Add(double* out, const double* a, const double* b, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                                _mm256_loadu_pd(b + i)));
+    }
+    ScalarAdd(out + i, a + i, b + i, count - i);
+}
+
+SPASM_TARGET_AVX2
+void Avx2Mul(double* out, const double* a, const double* b, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                                _mm256_loadu_pd(b + i)));
+    }
+    ScalarMul(out + i, a + i, b + i, count - i);
+}
+
+SPASM_TARGET_AVX2
+void Avx2Scale(double* out, const double* a, double factor, size_t count)
+{
+    const auto f = _mm256_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), f));
+    }
+    ScalarScale(out + i, a + i, factor, count - i);
+}
+
+SPASM_TARGET_AVX2
+double Avx2Horizontal(__m256d v)
+{
+    const auto half = _mm_add_pd(_mm256_castpd256_pd128(v),
+                                 _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+SPASM_TARGET_AVX2
+double Avx2Sum(const double* a, size_t count)
+{
+    auto s0 = _mm256_setzero_pd();
+    auto s1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+    }
+    return Avx2Horizontal(_mm256_add_pd(s0, s1)) +
+           ScalarSum(a + i, count - i);
+}
+
+SPASM_TARGET_AVX2
+double Avx2Dot(const double* a, const double* b, size_t count)
+{
+    auto s0 = _mm256_setzero_pd();
+    auto s1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                             _mm256_loadu_pd(b + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                             _mm256_loadu_pd(b + i + 4)));
+    }
+    return Avx2Horizontal(_mm256_add_pd(s0, s1)) +
+           ScalarDot(a + i, b + i, count - i);
+}
+
+const VectorKernels Avx2 = {
+    Avx2Add, Avx2Mul, Avx2Scale, Avx2Sum, Avx2Dot, "avx2",
+};
+
+bool HasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    const bool avx2 = (info[1] & (1 << 5)) != 0;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    // the OS has to save the upper halves of the registers
+    return avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+}  // namespace
+
+const VectorKernels& VectorKernels::Get()
+{
+    static const VectorKernels& kernels = *Supported().front();
+    return kernels;
+}
+
+std::vector<const VectorKernels*> VectorKernels::Supported()
+{
+    std::vector<const VectorKernels*> kernels;
+#if SPASM_VECTOR_X64
+    if (HasAvx2())
+    {
+        kernels.push_back(&Avx2);
+    }
+    kernels.push_back(&Sse2);
+#endif
+    kernels.push_back(&Scalar);
+    return kernels;
+}
+}  // namespace SpasmImpl
@@ -0,0 +1,46 @@
+#ifndef VECTOR_KERNELS_HPP
+#define VECTOR_KERNELS_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "object.hpp"
+
+namespace SpasmImpl
+{
+//! A packed array of doubles, the operand of the vector opcodes
+struct NumberArray : HeapObject
+{
+    explicit NumberArray(size_t length)
+        : HeapObject(Kind::Array), Elements(length)
+    {
+    }
+
+    std::vector<double> Elements;
+};
+
+//! Elementwise kernels over arrays of doubles
+/*!
+** The kernels for the best instruction set of the CPU are picked once, on
+** the first call of Get. The output may be one of the inputs. The SIMD
+** kernels add in a different order than the scalar ones, so sums may
+** differ in the last bits.
+*/
+struct VectorKernels
+{
+    void (*Add)(double* out, const double* a, const double* b, size_t count);
+    void (*Mul)(double* out, const double* a, const double* b, size_t count);
+    void (*Scale)(double* out, const double* a, double factor, size_t count);
+    double (*Sum)(const double* a, size_t count);
+    double (*Dot)(const double* a, const double* b, size_t count);
+    //! The instruction set of the kernels - "avx2", "sse2" or "scalar"
+    const char* Name;
+
+    static const VectorKernels& Get();
+
+    //! The kernels of every instruction set the CPU supports, best first
+    static std::vector<const VectorKernels*> Supported();
+};
+}  // namespace SpasmImpl
+
+#endif  // VECTOR_KERNELS_HPP